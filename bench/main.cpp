@@ -0,0 +1,365 @@
+#include "../rectify/rectify.h"
+#include "../utils/decoder.h"
+#include "../utils/frameBus.h"
+#include "../utils/replay.h"
+#include "../utils/utils.h"
+#include "../utils/yuyv.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+struct benchSize {
+    const char *name;
+    int width;
+    int height;
+};
+
+const benchSize BENCH_SIZES[] = {{"1080p", 1920, 1080}, {"4K", 3840, 2160}};
+/* Per eye, the side-by-side preview at PREVIEW_SCALE 2 and the full 4K capture */
+const benchSize RECTIFY_SIZES[] = {{"preview", 960, 1080}, {"full", 1920, 2160}};
+
+/**
+  * @brief  Make synthetic jpeg
+  * @note   Gradient plus noise, 4:2:2 sampled like most UVC MJPEG streams.
+  * @param  width       int
+  * @param  height      int
+  * @param  restartRows int, MCU rows per restart interval, 0 for none
+  * @param  restartMcus int, MCUs per restart interval, used when restartRows is 0
+  * @retval Compressed jpeg bytes
+**/
+vector<unsigned char> makeJpeg(int width, int height, int restartRows, int restartMcus = 0) {
+    struct jpeg_compress_struct cinfo {};
+    struct jpeg_error_mgr jErr {};
+    unsigned char *outBuf = nullptr;
+    unsigned long outLen = 0;
+    vector<unsigned char> row(width * 3);
+    unsigned int seed = 1;
+
+    cinfo.err = jpeg_std_error(&jErr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &outBuf, &outLen);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, true);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+    cinfo.restart_in_rows = restartRows;
+    cinfo.restart_interval = restartRows > 0 ? 0 : restartMcus;
+    jpeg_start_compress(&cinfo, true);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int y = (int) cinfo.next_scanline;
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int) (seed >> 29);
+            row[x * 3 + 0] = (unsigned char) ((x * 255 / width + noise) & 0xff);
+            row[x * 3 + 1] = (unsigned char) ((y * 255 / height + noise) & 0xff);
+            row[x * 3 + 2] = (unsigned char) (((x + y) / 8 + noise) & 0xff);
+        }
+        JSAMPROW rowPtr = row.data();
+        jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    vector<unsigned char> jpg(outBuf, outBuf + outLen);
+    free(outBuf);
+    return jpg;
+}
+
+/**
+  * @brief  Make synthetic YUYV frame
+  * @note   Same gradient plus noise as makeJpeg(), as an uncompressed camera would deliver it.
+  * @param  width   int, even
+  * @param  height  int
+  * @retval Packed Y0 U Y1 V bytes
+**/
+vector<unsigned char> makeYuyv(int width, int height) {
+    vector<unsigned char> yuyv((size_t) width * height * 2);
+    unsigned int seed = 1;
+
+    for (int y = 0; y < height; ++y) {
+        unsigned char *row = yuyv.data() + (size_t) y * width * 2;
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            row[2 * x] = (unsigned char) (16 + (x * 219 / width + (seed >> 29)) % 220);
+            row[2 * x + 1] = (unsigned char) (x & 1 ? 16 + y * 224 / height : 240 - x * 224 / width);
+        }
+    }
+    return yuyv;
+}
+
+/**
+  * @brief  Run benchmark
+  * @note   One warm-up call, then iterations timed calls.
+  * @param  name        const char *
+  * @param  iterations  int
+  * @param  fn          Decode call, returns 0 on success
+  * @retval Milliseconds per call
+**/
+double runBench(const char *name, int iterations, const function<int()> &fn) {
+    if (fn() < 0) {
+        printf("  %-24s failed\n", name);
+        return -1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        fn();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+
+    printf("  %-24s %8.2f ms/frame %8.1f fps\n", name, ms, 1000.0 / ms);
+    return ms;
+}
+
+/**
+  * @brief  Bench a recording
+  * @note   Replays the file as fast as possible, looping, so every run decodes the same frames
+  * @param  path        const char *
+  * @param  iterations  int
+  * @retval 0           If the recording could be replayed
+**/
+int benchReplay(const char *path, int iterations) {
+    struct videoDev vd {};
+    struct frameLease lease {};
+    struct jpegStream js {};
+    struct jpegParallel jp {};
+
+    if (replayOpen(&vd, path, REPLAY_LOOP) < 0 || playStream(&vd) < 0)
+        return -1;
+    vector<unsigned char> rgb((size_t) vd.raw_W * vd.raw_H * 3);
+    auto decodeNext = [&](function<int()> decode) {
+        if (leaseFrame(&vd, &lease) < 0)
+            return -1;
+        int ret = decode();
+        releaseFrame(&vd, &lease);
+        return ret;
+    };
+
+    printf("%s (%dx%d)\n", path, vd.raw_W, vd.raw_H);
+    jpegStreamInit(&js);
+    runBench("replay persistent", iterations, [&] {
+        return decodeNext([&] {
+            return jpegStreamDecode(&js, (const unsigned char *) lease.mem, lease.bytes_Used, rgb.data(), 0);
+        });
+    });
+    jpegStreamFree(&js);
+    jpegParallelInit(&jp, 0);
+    runBench("replay parallel", iterations, [&] {
+        return decodeNext([&] {
+            return jpegParallelDecode(&jp, (const unsigned char *) lease.mem, lease.bytes_Used, rgb.data(), 0);
+        });
+    });
+    jpegParallelFree(&jp);
+
+    stopStream(&vd);
+    closeVideoDevice(&vd);
+    return 0;
+}
+
+/**
+  * @brief  Stress the frame bus
+  * @note   One publisher writes frames as fast as it can while readers attach through their own mappings and check
+  *         that every frame they accept carries its own number at both ends, i.e. no torn read got through the seqlock.
+  * @param  frameSize   size_t
+  * @param  readers     int
+  * @param  seconds     double
+  * @retval 0           If no reader saw a torn frame
+**/
+int benchFrameBus(size_t frameSize, int readers, double seconds) {
+    struct frameBusWriter fw {};
+    vector<struct frameBusReader> fr(readers);
+    vector<unsigned long> corrupt(readers, 0);
+    vector<thread> threads;
+    vector<unsigned char> frame(frameSize, 0x5a);
+    atomic<bool> isRunning{true};
+    const char *name = "/usbCamBench";
+
+    if (frameBusCreate(&fw, name, V4L2_PIX_FMT_YUYV, 0, 0, frameSize, 0) < 0)
+        return -1;
+    for (int r = 0; r < readers; ++r) {
+        if (frameBusAttach(&fr[r], name) < 0)
+            return -1;
+        threads.emplace_back([&, r] {
+            struct frameBusFrame f {};
+            while (frameBusWait(&fr[r], &f, 100) >= 0 && isRunning) {
+                uint64_t first, last;
+                memcpy(&first, f.data, sizeof(first));
+                memcpy(&last, f.data + f.size - sizeof(last), sizeof(last));
+                if (first != f.frame || last != f.frame)
+                    corrupt[r]++;
+            }
+        });
+    }
+
+    uint64_t published = 0;
+    const void *parts[1] = {frame.data()};
+    size_t sizes[1] = {frameSize};
+    auto start = chrono::steady_clock::now();
+    double elapsed;
+    while ((elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count()) < seconds) {
+        memcpy(frame.data(), &published, sizeof(published));
+        memcpy(frame.data() + frameSize - sizeof(published), &published, sizeof(published));
+        frameBusPublish(&fw, parts, sizes, 1, (uint32_t) published, 0);
+        published++;
+    }
+    isRunning = false;
+    for (auto &t : threads)
+        t.join();
+    frameBusDestroy(&fw);
+
+    unsigned long read = 0, missed = 0, retries = 0, torn = 0;
+    for (int r = 0; r < readers; ++r) {
+        read += fr[r].frames_Read;
+        missed += fr[r].frames_Missed;
+        retries += fr[r].retries;
+        torn += corrupt[r];
+        frameBusDetach(&fr[r]);
+    }
+    printf("  %d reader%s %8.1f fps published, %8.1f fps read each, %5.1f%% missed, %lu retries, %lu torn\n", readers,
+           readers > 1 ? "s" : " ", published / elapsed, read / elapsed / readers, 100.0 * missed / (read + missed + 1), retries, torn);
+    return torn == 0 ? 0 : -1;
+}
+
+/**
+  * @brief  Bench rectification
+  * @note   Both eyes of a side-by-side RGB24 frame through rectifierApply(), on one thread and on every core
+  * @param  config      const char *, calibration or remap tables
+  * @param  eyeW        int
+  * @param  eyeH        int
+  * @param  iterations  int
+  * @retval 0           If the rectifier could be set up
+**/
+int benchRectify(const char *config, int eyeW, int eyeH, int iterations) {
+    int width = eyeW * 2, cores = (int) max(1u, thread::hardware_concurrency());
+    vector<unsigned char> src((size_t) width * eyeH * 3), dst(src.size());
+
+    for (int y = 0; y < eyeH; ++y) {
+        for (int x = 0; x < width; ++x) {
+            unsigned char *px = src.data() + ((size_t) y * width + x) * 3;
+            px[0] = (unsigned char) (x * 255 / width);
+            px[1] = (unsigned char) (y * 255 / eyeH);
+            px[2] = (unsigned char) ((x ^ y) & 0xff);
+        }
+    }
+    for (int threads : {1, cores}) {
+        struct stereoRectifier sr {};
+        char name[32];
+
+        if (rectifierInit(&sr, config, width, eyeH, threads) < 0)
+            return -1;
+        snprintf(name, sizeof(name), "rectify, %d thread%s", threads, threads > 1 ? "s" : "");
+        runBench(name, iterations, [&] {
+            return rectifierApply(&sr, src.data(), width * 3, dst.data(), width * 3);
+        });
+        rectifierFree(&sr);
+        if (cores == 1)
+            break;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 50;
+
+    // bench <iterations> <recording> measures recorded frames instead of the synthetic ones
+    if (argc > 2)
+        return benchReplay(argv[2], iterations);
+
+    for (const auto &size : BENCH_SIZES) {
+        vector<unsigned char> jpg = makeJpeg(size.width, size.height, 0);
+        vector<unsigned char> rstJpg = makeJpeg(size.width, size.height, 1);
+        vector<unsigned char> eyeRstJpg = makeJpeg(size.width, size.height, 0, size.width / 32);
+        vector<unsigned char> rgb((size_t) size.width * size.height * 3);
+        struct jpegStream js {};
+        struct jpegParallel jp {};
+        struct jpegStereo jst {};
+        int mid = size.width / 2;
+
+        printf("%s (%dx%d, %zu bytes)\n", size.name, size.width, size.height, jpg.size());
+
+        runBench("per-call jpegDecoder", iterations, [&] {
+            return jpegDecoder(jpg.data(), (int) jpg.size(), rgb.data());
+        });
+
+        jpegStreamInit(&js);
+        runBench("persistent jpegStream", iterations, [&] {
+            return jpegStreamDecode(&js, jpg.data(), (int) jpg.size(), rgb.data(), 0);
+        });
+
+        jpegParallelInit(&jp, 0);
+        runBench("parallel, no DRI", iterations, [&] {
+            return jpegParallelDecode(&jp, jpg.data(), (int) jpg.size(), rgb.data(), 0);
+        });
+        runBench("parallel, DRI 1 row", iterations, [&] {
+            return jpegParallelDecode(&jp, rstJpg.data(), (int) rstJpg.size(), rgb.data(), 0);
+        });
+        jpegParallelFree(&jp);
+
+        jpegStereoInit(&jst);
+        runBench("stereo, no DRI", iterations, [&] {
+            return jpegStereoDecode(&jst, jpg.data(), (int) jpg.size(), rgb.data(), rgb.data() + (size_t) mid * size.height * 3, 0);
+        });
+        runBench("stereo, DRI half row", iterations, [&] {
+            return jpegStereoDecode(&jst, eyeRstJpg.data(), (int) eyeRstJpg.size(), rgb.data(), rgb.data() + (size_t) mid * size.height * 3, 0);
+        });
+        jpegStereoFree(&jst);
+
+        int chromaW = (size.width + 1) / 2, chromaH = (size.height + 1) / 2;
+        unsigned char *planes[3] = {rgb.data(), rgb.data() + (size_t) size.width * size.height, rgb.data() + (size_t) size.width * size.height + (size_t) chromaW * chromaH};
+        int pitches[3] = {size.width, chromaW, chromaW};
+        runBench("planar YUV 4:2:0", iterations, [&] {
+            return jpegStreamDecodeYUV(&js, jpg.data(), (int) jpg.size(), planes, pitches);
+        });
+
+        for (int scale : {2, 4, 8}) {
+            char name[32];
+            snprintf(name, sizeof(name), "scaled 1/%d", scale);
+            js.scale_Denom = scale;
+            runBench(name, iterations, [&] {
+                return jpegStreamDecode(&js, jpg.data(), (int) jpg.size(), rgb.data(), 0);
+            });
+        }
+        jpegStreamFree(&js);
+
+        // uncompressed capture at the same resolution, compare with "persistent jpegStream" above
+        vector<unsigned char> yuyv = makeYuyv(size.width, size.height);
+        vector<unsigned char> bgra((size_t) size.width * size.height * 4);
+        for (int kernel : {YUYV_KERNEL_SCALAR, YUYV_KERNEL_SSE2, YUYV_KERNEL_AVX2}) {
+            if (!yuyvKernelAvailable(kernel))
+                continue;
+            for (int output : {YUYV_OUT_RGB24, YUYV_OUT_BGRA}) {
+                char name[32];
+                snprintf(name, sizeof(name), "YUYV %s to %s", yuyvKernelName(kernel), output == YUYV_OUT_BGRA ? "BGRA" : "RGB24");
+                runBench(name, iterations, [&] {
+                    return yuyvConvert(yuyv.data(), 0, V4L2_PIX_FMT_YUYV, output == YUYV_OUT_BGRA ? bgra.data() : rgb.data(), 0,
+                                       output, size.width, size.height, kernel);
+                });
+            }
+        }
+    }
+
+    // both eyes of the side-by-side stereo camera, with the calibration the capture app uses
+    for (const auto &size : RECTIFY_SIZES) {
+        printf("stereo rectify %s (%dx%d per eye)\n", size.name, size.width, size.height);
+        benchRectify("../config/intrinsics.yml", size.width, size.height, iterations);
+    }
+
+    // compressed 1080p and uncompressed 4K YUYV frames fanned out through shared memory
+    for (size_t frameSize : {(size_t) 512 << 10, (size_t) 3840 * 2160 * 2}) {
+        printf("frame bus (%zu KB frames)\n", frameSize >> 10);
+        for (int readers : {1, 2, 4, 8})
+            benchFrameBus(frameSize, readers, 1.0);
+    }
+
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include "calibrate.h"
+#include "../rectify/remapLut.h"
 
 int IF_SPLIT = 0;
+/* Decode scales (1, 2, 4 or 8) the live rectifier gets precomputed remap tables for */
+vector<int> LUT_SCALES = {1, 2};
 
 int main() {
     if (IF_SPLIT) {
@@ -65,13 +68,30 @@ int main() {
     errorReProjection = stereoCalibrate(objectPoints, imgPointsL, imgPointsR, interMatL, disCoeL, interMatR, disCoeR, imgSize, R, T, E, F, CALIB_USE_INTRINSIC_GUESS);
     cout << "Error of ReProjection = " << errorReProjection << endl;
 
+    stereoRectify(interMatL, disCoeL, interMatR, disCoeR, imgSize, R, T, RL, RR, PL, PR, Q, CALIB_ZERO_DISPARITY, 0, imgSize,
+                  &validROI[0], &validROI[1]);
+
     /* Load image for 3d-reconstruction */
     if (fs.isOpened()) {
-        cout << "in";
-        fs << "R" << R << "T" << T << "RL" << RL << "RR" << RR << "PL" << PL << "PR" << PR << "Q" << Q;
+        fs << "imgSize" << imgSize << "R" << R << "T" << T << "RL" << RL << "RR" << RR << "PL" << PL << "PR" << PR << "Q" << Q;
         fs.release();
     }
 
+    /* Remap tables for the live rectifier, keyed by the calibration exactly as rectifierInit() reads it back */
+    struct stereoCalibration sc;
+    if (loadCalibration(&sc, "../../config/intrinsics.yml") == 0) {
+        for (int scale : LUT_SCALES) {
+            Size eyeSize((imgSize.width + scale - 1) / scale, (imgSize.height + scale - 1) / scale);
+            Mat xy[2], frac[2];
+            if (computeRemap(&sc, eyeSize, xy, frac) < 0)
+                continue;
+            uint64_t hash = calibrationHash(&sc, eyeSize);
+            string lutPath = remapLutPath("../../config/intrinsics.yml", hash);
+            if (writeRemapLut(lutPath.c_str(), hash, xy, frac) == 0)
+                cout << "Wrote " << lutPath << " for " << eyeSize.width << "x" << eyeSize.height << " per eye" << endl;
+        }
+    }
+
     namedWindow("Canvas", 1);
     cout << "Loading images for 3d-reconstruction...";
     Mat canvas(imgSize.height, imgSize.width * 2, CV_8UC3), viewL, viewR;
@@ -1,63 +1,507 @@
+#include "rectify/rectify.h"
+#include "utils/capture.h"
+#include "utils/decoder.h"
+#include "utils/dmabufShare.h"
+#include "utils/frameBus.h"
+#include "utils/framePool.h"
+#include "utils/preTrigger.h"
+#include "utils/recorder.h"
+#include "utils/replay.h"
+#include "utils/snapshot.h"
+#include "utils/tripleBuffer.h"
 #include "utils/utils.h"
-#include <unistd.h>
+#include "utils/yuyv.h"
+#include <atomic>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
+#include <vector>
 
 struct videoDev vDev;
+struct captureWorker capWorker;
+struct jpegParallel jParallel;
+struct jpegStream jStream;
+struct jpegStereo jStereo;
+struct mjpegRecorder recorder;
+struct snapshotWriter snapWriter;
+struct preTrigger preTrig;
+struct dmabufServer shareServer;
+struct frameBusWriter frameBus;
+struct framePool previewPool;
+tripleBuffer<videoFrame> previewBuf;
+struct stereoRectifier rectifier;
+std::atomic<bool> isDecoding{false};
+std::atomic<unsigned long> framesDecoded{0};
+std::atomic<unsigned long> framesPresented{0};
 
-int main() {
+/* V4L2_PIX_FMT_MJPEG, V4L2_PIX_FMT_YUYV / UYVY to skip jpeg decode at lower resolutions, or NV12 / NV16 (and their M variants) */
+unsigned int CAPTURE_FORMAT = V4L2_PIX_FMT_MJPEG;
+/* V4L2 buffers to request, the driver may grant a different count */
+int CAPTURE_BUFFERS = 4;
+/* V4L2_MEMORY_USERPTR captures straight into an application pool sized from the negotiated image size, MMAP uses driver buffers */
+unsigned int CAPTURE_MEMORY = V4L2_MEMORY_MMAP;
+/* Back the USERPTR pool with huge pages, MAP_HUGETLB if pages are reserved, transparent huge pages otherwise */
+int CAPTURE_HUGE_PAGES = 1;
+/* Print buffer queue depth and drop counts every STATS_INTERVAL_MS, 0 to disable */
+int STATS_INTERVAL_MS = 0;
+/* Preview is decoded at 1/PREVIEW_SCALE size in the DCT domain: 1, 2, 4 or 8 */
+int PREVIEW_SCALE = 2;
+/* Side-by-side stereo camera, each eye of an RGB24 MJPEG preview is decoded on its own thread straight into its half, 0 for a plain camera */
+int STEREO_DECODE = 1;
+/* Preview as YUV with GPU colour conversion (I420, or YUY2 / UYVY as captured), always full size */
+int PREVIEW_YUV = 0;
+/* Decode on its own thread and present the newest frame at every vsync, 0 decodes into the locked texture inline (always for NV12 / NV16) */
+int RENDER_THREAD = 1;
+/* Record every captured frame untouched to this file, e.g. "../image/record.ucmj", nullptr to disable */
+const char *RECORD_FILE = nullptr;
+/* Frames the recording may queue for the disk, 0 for RECORDER_SLOTS. Each is allocated at the driver's worst case frame size up front */
+int RECORD_SLOTS = 0;
+/* Snapshots that may be waiting for the disk at the same time */
+int SNAPSHOTS_IN_FLIGHT = 4;
+/* Keep the last PRETRIGGER_SECONDS (at most PRETRIGGER_MB) of compressed frames, 't' or SIGUSR1 saves them plus POSTTRIGGER_SECONDS, 0 to disable */
+int PRETRIGGER_SECONDS = 0;
+int PRETRIGGER_MB = 256;
+int POSTTRIGGER_SECONDS = 5;
+/* Share the capture buffers with local processes over DMABUF on this socket, e.g. "/tmp/usbCam.sock", nullptr to disable */
+const char *SHARE_SOCKET = nullptr;
+/* Publish frames to any number of local readers through shared memory under this name, e.g. "/usbCam", nullptr to disable */
+const char *FRAME_BUS = nullptr;
+/* 1 publishes the decoded preview frames (needs RENDER_THREAD), 0 the frames as captured */
+int FRAME_BUS_DECODED = 0;
+/* Rectify both halves of the side-by-side preview with this calibration, e.g. "../config/intrinsics.yml" or a remap-*.lut the calibrate tool wrote next to it, nullptr to disable (needs RGB24 preview and RENDER_THREAD). Works on the preview, i.e. at 1/PREVIEW_SCALE of the captured eyes */
+const char *RECTIFY_CONFIG = nullptr;
+/* Threads for rectification, 0 for one per core */
+int RECTIFY_THREADS = 0;
+
+/**
+  * @brief  Trigger signal handler
+  * @note   SIGUSR1 saves a pre-trigger clip
+  * @param  sig int
+  * @retval None
+**/
+void onTriggerSignal(int sig) {
+    (void) sig;
+    preTriggerFire(&preTrig);
+}
+
+/**
+  * @brief  Print capture stats
+  * @note   Buffers queued in the driver versus held by the application, for tuning CAPTURE_BUFFERS
+  * @param  None
+  * @retval None
+**/
+void printCaptureStats() {
+    struct bufferStats stats {};
+
+    if (queryBufferStats(&vDev, &stats) < 0)
+        return;
+    printf("Buffers: %d queued, %d done, %d held (max %d) of %d | captured %lu, dropped %lu\n", stats.queued, stats.done,
+           stats.held, stats.max_Held, stats.count, capWorker.frames_Captured.load(), capWorker.frames_Dropped.load());
+}
+
+/**
+  * @brief  Packed YUV capture
+  * @note   YUYV and UYVY frames need no decode, only a copy or a colour conversion
+  * @param  None
+  * @retval true    If the device delivers packed YUV
+**/
+bool isPackedYUV() {
+    return vDev.raw_Format == V4L2_PIX_FMT_YUYV || vDev.raw_Format == V4L2_PIX_FMT_UYVY;
+}
+
+/**
+  * @brief  Semi-planar capture
+  * @note   NV12 and NV16, one or two memory planes, are shown through an NV12 texture
+  * @param  None
+  * @retval true    If the device delivers semi-planar YUV
+**/
+bool isSemiPlanar() {
+    switch (vDev.raw_Format) {
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV12M:
+        case V4L2_PIX_FMT_NV16:
+        case V4L2_PIX_FMT_NV16M:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+  * @brief  Preview texture format
+  * @note   None
+  * @param  None
+  * @retval SDL pixel format matching previewLayout()
+**/
+Uint32 previewTextureFormat() {
+    if (isSemiPlanar())
+        return SDL_PIXELFORMAT_NV12;
+    if (!PREVIEW_YUV)
+        return SDL_PIXELFORMAT_RGB24;
+    if (isPackedYUV())
+        return vDev.raw_Format == V4L2_PIX_FMT_UYVY ? SDL_PIXELFORMAT_UYVY : SDL_PIXELFORMAT_YUY2;
+    return SDL_PIXELFORMAT_IYUV;
+}
+
+/**
+  * @brief  Preview pixel format
+  * @note   The previewTextureFormat() layout as a V4L2 fourcc, for frame bus readers
+  * @param  None
+  * @retval V4L2_PIX_FMT_* of previewLayout()
+**/
+unsigned int previewPixelFormat() {
+    switch (previewTextureFormat()) {
+        case SDL_PIXELFORMAT_NV12:
+            return V4L2_PIX_FMT_NV12;
+        case SDL_PIXELFORMAT_UYVY:
+            return V4L2_PIX_FMT_UYVY;
+        case SDL_PIXELFORMAT_YUY2:
+            return V4L2_PIX_FMT_YUYV;
+        case SDL_PIXELFORMAT_IYUV:
+            return V4L2_PIX_FMT_YUV420;
+        default:
+            return V4L2_PIX_FMT_RGB24;
+    }
+}
+
+/**
+  * @brief  Decode preview
+  * @note   RGB24 through the parallel decoder or the YUYV kernels, I420 planes or the packed frame as is in PREVIEW_YUV mode
+  * @param  lease   struct frameLease
+  * @param  planes  RGB buffer in planes[0], or Y, U and V planes
+  * @param  pitches bytes between rows of each plane
+  * @retval 0       If decode successful
+**/
+int decodePreview(const struct frameLease &lease, unsigned char *const planes[3], const int pitches[3]) {
+    const unsigned char *frame = (const unsigned char *) lease.mem;
+
+    if (isSemiPlanar()) {
+        // NV16 carries CbCr for every row, NV12 for every second one
+        int chromaStep = vDev.raw_Format == V4L2_PIX_FMT_NV16 || vDev.raw_Format == V4L2_PIX_FMT_NV16M ? 2 : 1;
+        int chromaH = (vDev.raw_H + 1) / 2;
+        if (lease.num_Planes < 2 || lease.plane_Bytes[0] < vDev.plane_Pitch[0] * vDev.raw_H ||
+            lease.plane_Bytes[1] < vDev.plane_Pitch[1] * (chromaH - 1) * chromaStep + vDev.raw_W)
+            return -1;
+        for (int row = 0; row < vDev.raw_H; ++row)
+            memcpy(planes[0] + (size_t) row * pitches[0], (const unsigned char *) lease.planes[0] + (size_t) row * vDev.plane_Pitch[0], vDev.raw_W);
+        for (int row = 0; row < chromaH; ++row)
+            memcpy(planes[1] + (size_t) row * pitches[1], (const unsigned char *) lease.planes[1] + (size_t) row * chromaStep * vDev.plane_Pitch[1], vDev.raw_W);
+        return 0;
+    }
+
+    if (isPackedYUV()) {
+        int srcPitch = vDev.plane_Pitch[0] > 0 ? vDev.plane_Pitch[0] : vDev.raw_W * 2;
+        if (lease.bytes_Used < srcPitch * vDev.raw_H)
+            return -1;
+        if (!PREVIEW_YUV)
+            return yuyvConvert(frame, srcPitch, vDev.raw_Format, planes[0], pitches[0], YUYV_OUT_RGB24, vDev.raw_W, vDev.raw_H);
+        for (int row = 0; row < vDev.raw_H; ++row)
+            memcpy(planes[0] + (size_t) row * pitches[0], frame + (size_t) row * srcPitch, vDev.raw_W * 2);
+        return 0;
+    }
+    if (PREVIEW_YUV)
+        return jpegStreamDecodeYUV(&jStream, frame, lease.bytes_Used, planes, pitches);
+    if (STEREO_DECODE)
+        return jpegStereoDecode(&jStereo, frame, lease.bytes_Used, planes[0], planes[0] + (size_t) vDev.rgb_W / 2 * 3, pitches[0]);
+    return jpegParallelDecode(&jParallel, frame, lease.bytes_Used, planes[0], pitches[0]);
+}
+
+/**
+  * @brief  Preview layout
+  * @note   Tightly packed RGB24 or YUY2, or I420 / NV12 planes one after another
+  * @param  base    unsigned char *
+  * @param  planes  unsigned char *[3]
+  * @param  pitches int[3]
+  * @retval Bytes needed for one preview frame
+**/
+size_t previewLayout(unsigned char *base, unsigned char *planes[3], int pitches[3]) {
+    int chromaW = (vDev.rgb_W + 1) / 2, chromaH = (vDev.rgb_H + 1) / 2;
+
+    if (isSemiPlanar()) {
+        pitches[0] = pitches[1] = pitches[2] = chromaW * 2;
+        planes[0] = base;
+        planes[1] = planes[2] = base + (size_t) pitches[0] * vDev.rgb_H;
+        return (size_t) pitches[0] * (vDev.rgb_H + chromaH);
+    }
+    if (!PREVIEW_YUV || isPackedYUV()) {
+        int bytesPerPixel = PREVIEW_YUV ? 2 : 3;
+        planes[0] = planes[1] = planes[2] = base;
+        pitches[0] = pitches[1] = pitches[2] = vDev.rgb_W * bytesPerPixel;
+        return (size_t) vDev.rgb_W * vDev.rgb_H * bytesPerPixel;
+    }
+    pitches[0] = vDev.rgb_W;
+    pitches[1] = pitches[2] = chromaW;
+    planes[0] = base;
+    planes[1] = base + (size_t) vDev.rgb_W * vDev.rgb_H;
+    planes[2] = planes[1] + (size_t) chromaW * chromaH;
+    return (size_t) vDev.rgb_W * vDev.rgb_H + 2 * (size_t) chromaW * chromaH;
+}
+
+/**
+  * @brief  Acquire preview frame
+  * @note   Takes a frame from previewPool and describes it as a previewLayout() frame
+  * @param  frame   videoFrame
+  * @retval 0       If frame acquired, -1 if every frame is still out
+**/
+int acquirePreviewFrame(videoFrame &frame) {
+    unsigned char *planes[3];
+    int pitches[3];
+
+    if (framePoolAcquire(&previewPool, frame) < 0)
+        return -1;
+    frame.size = previewLayout(frame.data(), planes, pitches);
+    frame.pixel_Format = previewPixelFormat();
+    frame.width = vDev.rgb_W;
+    frame.height = vDev.rgb_H;
+    frame.pitch = pitches[0];
+    return 0;
+}
+
+/**
+  * @brief  Decode loop
+  * @note   Runs on the decode thread, pops the newest capture and publishes it to previewBuf without ever waiting on the renderer
+  * @note   Every capture is decoded into a fresh pooled frame that moves on to the renderer, which hands it back to
+  *         previewPool once shown. A frame the renderer never picked up comes back here and is returned at once.
+  * @param  None
+  * @retval None
+**/
+void decodeLoop() {
+    struct frameLease lease {};
+    unsigned char *planes[3];
+    int pitches[3];
+
+    while (isDecoding) {
+        if (popFrame(&capWorker, &lease, 100) < 0) {
+            if (capWorker.has_Failed)
+                break;
+            continue;
+        }
+
+        // with rectification the remap writes a second frame and the decoded one goes back to the pool
+        videoFrame decoded, rectified;
+        if (acquirePreviewFrame(decoded) < 0 || (RECTIFY_CONFIG != nullptr && acquirePreviewFrame(rectified) < 0)) {
+            releaseFrame(&vDev, &lease);
+            continue;
+        }
+        previewLayout(decoded.data(), planes, pitches);
+        int ret = decodePreview(lease, planes, pitches);
+        decoded.sequence = lease.sequence;
+        decoded.timestamp_Us = (int64_t) lease.timestamp.tv_sec * 1000000 + lease.timestamp.tv_usec;
+        releaseFrame(&vDev, &lease);
+        if (ret == 0 && RECTIFY_CONFIG != nullptr) {
+            ret = rectifierApply(&rectifier, decoded.data(), pitches[0], rectified.data(), pitches[0]);
+            rectified.sequence = decoded.sequence;
+            rectified.timestamp_Us = decoded.timestamp_Us;
+            decoded = std::move(rectified);
+        }
+
+        if (ret == 0) {
+            if (FRAME_BUS != nullptr && FRAME_BUS_DECODED) {
+                const void *parts[1] = {decoded.data()};
+                size_t sizes[1] = {decoded.size};
+                frameBusPublish(&frameBus, parts, sizes, 1, decoded.sequence, decoded.timestamp_Us);
+            }
+            previewBuf.back() = std::move(decoded);
+            previewBuf.publish();
+            previewBuf.back().reset();
+            framesDecoded++;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
     strcpy(vDev.dev_Name, "/dev/video2");
     vDev.raw_W = 3840;
     vDev.raw_H = 2160;
-    vDev.raw_Format = V4L2_PIX_FMT_MJPEG;
+    vDev.raw_Format = CAPTURE_FORMAT;
+    vDev.raw_Fps = 30;
     vDev.is_Streaming = 0;
+    vDev.nb_Buffer = CAPTURE_BUFFERS;
+    vDev.mem_Type = CAPTURE_MEMORY;
+    vDev.huge_Pages = CAPTURE_HUGE_PAGES;
 
-    if (openVideoDevice(&vDev) < 0)
+    // ./camera <recording> replays a recorded or raw mjpeg file at its original pace instead of the camera
+    if (argc > 1) {
+        if (replayOpen(&vDev, argv[1], REPLAY_REALTIME | REPLAY_LOOP) < 0)
+            return -1;
+    } else if (openVideoDevice(&vDev) < 0)
         return -1;
     if (playStream(&vDev) < 0)
         return -1;
-    if (SDLInit(vDev.raw_W, vDev.raw_H) < 0)
-        return -1;
 
-    vDev.raw_Buf = (unsigned char *) calloc(1, vDev.raw_W * vDev.raw_H * 2);
-    vDev.rgb_W = vDev.raw_W;
-    vDev.rgb_H = vDev.raw_H;
-    vDev.rgb_Size = vDev.rgb_W * vDev.rgb_H * 4;
-    vDev.rgb_Buf = (unsigned char *) calloc(1, vDev.rgb_Size);
+    if (PREVIEW_YUV || isPackedYUV() || isSemiPlanar())
+        PREVIEW_SCALE = 1;
+    // semi-planar frames need no decoding, a decode thread would only add a copy through the preview slots
+    if (isSemiPlanar())
+        RENDER_THREAD = 0;
+    vDev.rgb_W = jpegScaledSize(vDev.raw_W, PREVIEW_SCALE);
+    vDev.rgb_H = jpegScaledSize(vDev.raw_H, PREVIEW_SCALE);
 
-    int imgCount = 0;
-    char fileName[100];
-    FILE *imgFile;
+    struct frameLease lease {};
+    std::thread decodeThread;
+    unsigned char *planes[3];
+    int pitches[3];
 
-    while (true) {
-        if (grabFrame(&vDev) < 0) {
-            sleep(10);
-            continue;
-        }
+    // at most four preview frames are out at once: one published, one being shown and two being decoded and rectified
+    size_t previewSize = previewLayout(nullptr, planes, pitches);
+    if (framePoolInit(&previewPool, previewSize, 4) < 0)
+        return -1;
+    if (RECTIFY_CONFIG != nullptr && (previewTextureFormat() != SDL_PIXELFORMAT_RGB24 || !RENDER_THREAD)) {
+        printf("Rectification needs RGB24 preview and RENDER_THREAD, disabled\n");
+        RECTIFY_CONFIG = nullptr;
+    }
+    if (RECTIFY_CONFIG != nullptr) {
+        if (rectifierInit(&rectifier, RECTIFY_CONFIG, vDev.rgb_W, vDev.rgb_H, RECTIFY_THREADS) < 0)
+            return -1;
+    }
+
+    if (SDLInit(vDev.rgb_W, vDev.rgb_H, previewTextureFormat(), RENDER_THREAD) < 0)
+        return -1;
+    jParallel.scale_Denom = PREVIEW_SCALE;
+    if (jpegParallelInit(&jParallel, 0) < 0)
+        return -1;
+    if (STEREO_DECODE && (vDev.raw_Format != V4L2_PIX_FMT_MJPEG || PREVIEW_YUV || vDev.rgb_W % 2 != 0)) {
+        printf("Stereo decode needs an RGB24 MJPEG preview of even width, disabled\n");
+        STEREO_DECODE = 0;
+    }
+    jStereo.scale_Denom = PREVIEW_SCALE;
+    if (STEREO_DECODE && jpegStereoInit(&jStereo) < 0)
+        return -1;
+    size_t rawSize = vDev.raw_Size > 0 ? (size_t) vDev.raw_Size : (size_t) vDev.raw_W * vDev.raw_H * 2;
+    if (snapshotInit(&snapWriter, vDev.raw_Format == V4L2_PIX_FMT_MJPEG ? "../image/img_%d.jpg" : "../image/img_%d.yuv", SNAPSHOTS_IN_FLIGHT, rawSize) < 0)
+        return -1;
+    addCaptureTap(&capWorker, snapshotTap, &snapWriter);
+    if ((PRETRIGGER_SECONDS > 0 || RECORD_FILE != nullptr) && vDev.raw_Format != V4L2_PIX_FMT_MJPEG) {
+        printf("Recording needs MJPEG capture, disabled\n");
+        PRETRIGGER_SECONDS = 0;
+        RECORD_FILE = nullptr;
+    }
+    if (PRETRIGGER_SECONDS > 0) {
+        if (preTriggerInit(&preTrig, "../image/clip_%d.ucmj", vDev.raw_W, vDev.raw_H, (size_t) PRETRIGGER_MB << 20,
+                           PRETRIGGER_SECONDS, POSTTRIGGER_SECONDS) < 0)
+            return -1;
+        addCaptureTap(&capWorker, preTriggerTap, &preTrig);
+        signal(SIGUSR1, onTriggerSignal);
+    }
+    if (RECORD_FILE != nullptr) {
+        if (recorderOpen(&recorder, RECORD_FILE, vDev.raw_W, vDev.raw_H, RECORD_SLOTS, rawSize) < 0)
+            return -1;
+        addCaptureTap(&capWorker, recorderTap, &recorder);
+    }
+    if (SHARE_SOCKET != nullptr && argc == 1) {
+        if (dmabufServerInit(&shareServer, &vDev, SHARE_SOCKET) < 0)
+            return -1;
+        addCaptureTap(&capWorker, dmabufServerTap, &shareServer);
+    }
+    if (FRAME_BUS != nullptr && FRAME_BUS_DECODED && !RENDER_THREAD) {
+        printf("Decoded frame bus needs RENDER_THREAD, publishing captured frames\n");
+        FRAME_BUS_DECODED = 0;
+    }
+    if (FRAME_BUS != nullptr && FRAME_BUS_DECODED) {
+        if (frameBusCreate(&frameBus, FRAME_BUS, previewPixelFormat(), vDev.rgb_W, vDev.rgb_H, previewSize, 0) < 0)
+            return -1;
+    } else if (FRAME_BUS != nullptr) {
+        if (frameBusCreate(&frameBus, FRAME_BUS, vDev.raw_Format, vDev.raw_W, vDev.raw_H, rawSize, 0) < 0)
+            return -1;
+        addCaptureTap(&capWorker, frameBusTap, &frameBus);
+    }
+    if (startCapture(&capWorker, &vDev, CAPTURE_LATEST) < 0)
+        return -1;
+    if (RENDER_THREAD) {
+        isDecoding = true;
+        decodeThread = std::thread(decodeLoop);
+    }
 
+    Uint32 lastStats = SDL_GetTicks();
+    while (true) {
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
-                case SDL_KEYDOWN:
-                    printf("Key %s Down! Snap image no.%d\n", SDL_GetKeyName(event.key.keysym.sym), imgCount);
-                    sprintf(fileName, "../image/img_%d.jpg", imgCount++);
-                    imgFile = fopen(fileName, "wb");
-                    std::fwrite(vDev.raw_Buf, sizeof(&vDev.raw_Buf), vDev.raw_W * vDev.raw_H * 2, imgFile);
-                    fclose(imgFile);
-                            break;
+                case SDL_KEYDOWN: {
+                    if (PRETRIGGER_SECONDS > 0 && event.key.keysym.sym == SDLK_t) {
+                        printf("Key %s Down! Saving the last %d seconds\n", SDL_GetKeyName(event.key.keysym.sym), PRETRIGGER_SECONDS);
+                        preTriggerFire(&preTrig);
+                        break;
+                    }
+                    int number = snapshotRequest(&snapWriter);
+                    if (number < 0)
+                        printf("Key %s Down! Snapshots still being written, skipped\n", SDL_GetKeyName(event.key.keysym.sym));
+                    else
+                        printf("Key %s Down! Snap image no.%d\n", SDL_GetKeyName(event.key.keysym.sym), number);
+                    break;
+                }
                 case SDL_QUIT:
                     goto ExitApp;
             }
         }
 
-        jpegDecoder(vDev.raw_Buf, vDev.raw_Size, vDev.rgb_Buf);
-        SDLDisplay(vDev.rgb_Buf, vDev.rgb_W, vDev.rgb_H);
+        if (STATS_INTERVAL_MS > 0 && SDL_GetTicks() - lastStats >= (Uint32) STATS_INTERVAL_MS) {
+            printCaptureStats();
+            lastStats = SDL_GetTicks();
+        }
+
+        if (RENDER_THREAD) {
+            // present whatever is newest, SDL_RenderPresent blocks on vsync here and nowhere else
+            if (!previewBuf.acquire()) {
+                if (capWorker.has_Failed)
+                    goto ExitApp;
+                SDL_Delay(1);
+                continue;
+            }
+            previewLayout(previewBuf.front().data(), planes, pitches);
+            if (previewTextureFormat() == SDL_PIXELFORMAT_IYUV)
+                SDLDisplayYUV(planes, pitches, vDev.rgb_W, vDev.rgb_H);
+            else
+                SDLDisplay(planes[0], vDev.rgb_W, vDev.rgb_H, pitches[0]);
+            // the texture has its own copy now, the frame goes back to the pool from this thread
+            previewBuf.front().reset();
+            framesPresented++;
+            continue;
+        }
+
+        if (popFrame(&capWorker, &lease, 100) < 0) {
+            if (capWorker.has_Failed)
+                goto ExitApp;
+            continue;
+        }
+
+        // decode straight into the locked streaming texture
+        Uint32 textureFormat = previewTextureFormat();
+        int ret = textureFormat == SDL_PIXELFORMAT_IYUV || textureFormat == SDL_PIXELFORMAT_NV12 ? SDLLockFrameYUV(planes, pitches)
+                                                                                                 : SDLLockFrame(&planes[0], &pitches[0]);
+        if (ret < 0) {
+            releaseFrame(&vDev, &lease);
+            continue;
+        }
+        ret = decodePreview(lease, planes, pitches);
+        releaseFrame(&vDev, &lease);
+        SDLUnlockFrame(vDev.rgb_W, vDev.rgb_H, ret == 0);
+        if (ret == 0) {
+            framesDecoded++;
+            framesPresented++;
+        }
     }
 ExitApp:
+    isDecoding = false;
+    if (decodeThread.joinable())
+        decodeThread.join();
+    printf("Presented %lu of %lu decoded frames\n", framesPresented.load(), framesDecoded.load());
+    stopCapture(&capWorker);
+    recorderClose(&recorder);
+    snapshotFree(&snapWriter);
+    preTriggerFree(&preTrig);
+    dmabufServerFree(&shareServer);
+    frameBusDestroy(&frameBus);
+    jpegParallelFree(&jParallel);
+    jpegStereoFree(&jStereo);
+    jpegStreamFree(&jStream);
     SDLFree();
+    rectifierFree(&rectifier);
+    for (int i = 0; i < 3; ++i)
+        previewBuf.slot(i).reset();
+    framePoolFree(&previewPool);
     stopStream(&vDev);
     closeVideoDevice(&vDev);
-    free(vDev.raw_Buf);
-    free(vDev.rgb_Buf);
     return 0;
 }
@@ -0,0 +1,124 @@
+#include "rectify.h"
+#include <algorithm>
+#include <cstdio>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+/**
+  * @brief  Initial stereo rectifier
+  * @note   Uses fixed-point (CV_16SC2 + CV_16UC1) remap tables for the left and right half of a side-by-side frame.
+  * @note   A .lut path is mapped as is. For a calibration file the tables the calibration tool wrote next to it are
+  *         mapped when their key matches, otherwise they are computed here, see computeRemap().
+  * @note   Turns OpenCV's own threading off for the whole process until rectifierFree(), see below.
+  * @param  sr      struct stereoRectifier
+  * @param  path    const char *, intrinsics or remap tables written by the calibration tool
+  * @param  width   int, side-by-side frame width, both eyes
+  * @param  height  int
+  * @param  threads int, 0 for one per core
+  * @retval 0       If rectifier created
+**/
+int rectifierInit(struct stereoRectifier *sr, const char *path, int width, int height, int threads) {
+    struct stereoCalibration sc;
+    std::string name(path);
+    cv::Mat xy[2], frac[2];
+
+    if (sr->is_Init)
+        return 0;
+    if (width <= 0 || height <= 0 || width % 2 != 0) {
+        printf("Error: %dx%d is not a side-by-side frame\n", width, height);
+        return -1;
+    }
+
+    cv::Size eyeSize(width / 2, height);
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".lut") == 0) {
+        if (mapRemapLut(&sr->lut, path) < 0)
+            return -1;
+        if (sr->lut.xy[0].size() != eyeSize) {
+            printf("Error: %s was built for %dx%d eyes, not %dx%d\n", path, sr->lut.xy[0].cols, sr->lut.xy[0].rows, eyeSize.width, eyeSize.height);
+            unmapRemapLut(&sr->lut);
+            return -1;
+        }
+    } else {
+        if (loadCalibration(&sc, path) < 0)
+            return -1;
+        if (sc.img_Size.area() == 0)
+            printf("No imgSize in %s, assuming it was calibrated at %dx%d per eye\n", path, eyeSize.width, eyeSize.height);
+        uint64_t hash = calibrationHash(&sc, eyeSize);
+        std::string lutPath = remapLutPath(path, hash);
+        if (access(lutPath.c_str(), R_OK) == 0 && mapRemapLut(&sr->lut, lutPath.c_str()) == 0 &&
+            (sr->lut.calib_Hash != hash || sr->lut.xy[0].size() != eyeSize))
+            unmapRemapLut(&sr->lut);
+        if (sr->lut.map != nullptr)
+            printf("Using remap tables %s\n", lutPath.c_str());
+        else if (computeRemap(&sc, eyeSize, xy, frac) < 0)
+            return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        cv::Mat *map = i == 0 ? sr->map_L : sr->map_R;
+        map[0] = sr->lut.map != nullptr ? sr->lut.xy[i] : xy[i];
+        map[1] = sr->lut.map != nullptr ? sr->lut.frac[i] : frac[i];
+    }
+
+    // bands are spread over our own pool, keep remap itself from fanning out again underneath. cv::setNumThreads()
+    // is process-wide, not per pool: every OpenCV call in the process runs single threaded until rectifierFree()
+    // puts the previous setting back. Nothing else in the capture app uses OpenCV.
+    sr->cv_Threads = cv::getNumThreads();
+    cv::setNumThreads(1);
+    if (threads <= 0)
+        threads = (int) std::max(1u, std::thread::hardware_concurrency());
+    sr->eye_W = eyeSize.width;
+    sr->eye_H = eyeSize.height;
+    sr->bands = std::min(threads * RECTIFY_BANDS_PER_THREAD, eyeSize.height);
+    threadPoolInit(&sr->pool, threads - 1);
+    sr->is_Init = 1;
+    printf("Rectifying %dx%d per eye\n", eyeSize.width, eyeSize.height);
+    return 0;
+}
+
+/**
+  * @brief  Free stereo rectifier
+  * @note   Restores the OpenCV thread count rectifierInit() found
+  * @param  sr  struct stereoRectifier
+  * @retval None
+**/
+void rectifierFree(struct stereoRectifier *sr) {
+    if (!sr->is_Init)
+        return;
+    threadPoolFree(&sr->pool);
+    for (int i = 0; i < 2; ++i) {
+        sr->map_L[i].release();
+        sr->map_R[i].release();
+    }
+    unmapRemapLut(&sr->lut);
+    cv::setNumThreads(sr->cv_Threads);
+    sr->is_Init = 0;
+}
+
+/**
+  * @brief  Rectify frame
+  * @note   Bilinear remap of both eyes of an RGB24 side-by-side frame, in row bands across the pool. Cannot work in place.
+  * @param  sr          struct stereoRectifier
+  * @param  src         const unsigned char *, eye_W * 2 by eye_H RGB24
+  * @param  srcPitch    int, bytes between rows
+  * @param  dst         unsigned char *, same layout as src
+  * @param  dstPitch    int, bytes between rows
+  * @retval 0           If frame rectified
+**/
+int rectifierApply(struct stereoRectifier *sr, const unsigned char *src, int srcPitch, unsigned char *dst, int dstPitch) {
+    if (!sr->is_Init || src == dst)
+        return -1;
+
+    cv::Mat srcFrame(sr->eye_H, sr->eye_W * 2, CV_8UC3, (void *) src, srcPitch);
+    cv::Mat dstFrame(sr->eye_H, sr->eye_W * 2, CV_8UC3, dst, dstPitch);
+    threadPoolRun(&sr->pool, sr->bands * 2, [&](int index) {
+        int eye = index % 2, band = index / 2;
+        int row0 = sr->eye_H * band / sr->bands, row1 = sr->eye_H * (band + 1) / sr->bands;
+        const cv::Mat *map = eye == 0 ? sr->map_L : sr->map_R;
+        cv::Mat srcEye = srcFrame(cv::Rect(eye * sr->eye_W, 0, sr->eye_W, sr->eye_H));
+        cv::Mat dstBand = dstFrame(cv::Rect(eye * sr->eye_W, row0, sr->eye_W, row1 - row0));
+        cv::remap(srcEye, dstBand, map[0].rowRange(row0, row1), map[1].rowRange(row0, row1), cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+    });
+    return 0;
+}
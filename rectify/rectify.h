@@ -0,0 +1,26 @@
+#ifndef USBCAM_RECTIFY_H
+#define USBCAM_RECTIFY_H
+
+#include "../utils/threadPool.h"
+#include "remapLut.h"
+#include <opencv2/core.hpp>
+
+#define RECTIFY_BANDS_PER_THREAD 2
+
+struct stereoRectifier {
+    int eye_W;
+    int eye_H;
+    cv::Mat map_L[2];
+    cv::Mat map_R[2];
+    struct remapLut lut;
+    struct threadPool pool;
+    int bands;
+    int cv_Threads;
+    int is_Init;
+};
+
+int rectifierInit(struct stereoRectifier *sr, const char *path, int width, int height, int threads);
+void rectifierFree(struct stereoRectifier *sr);
+int rectifierApply(struct stereoRectifier *sr, const unsigned char *src, int srcPitch, unsigned char *dst, int dstPitch);
+
+#endif
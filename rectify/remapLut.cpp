@@ -0,0 +1,305 @@
+#include "remapLut.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <opencv2/calib3d.hpp>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/**
+  * @brief  FNV-1a
+  * @param  hash    uint64_t, FNV_OFFSET to start
+  * @param  data    const void *
+  * @param  size    size_t
+  * @retval Updated hash
+**/
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+  * @brief  Hash matrix
+  * @note   Shape and values as doubles, so the hash does not depend on how the matrix was stored
+  * @param  hash    uint64_t
+  * @param  m       cv::Mat
+  * @retval Updated hash
+**/
+static uint64_t hashMat(uint64_t hash, const cv::Mat &m) {
+    cv::Mat values;
+    int32_t shape[2] = {m.rows, m.cols};
+
+    hash = fnv1a(hash, shape, sizeof(shape));
+    if (m.empty())
+        return hash;
+    m.convertTo(values, CV_64F);
+    return fnv1a(hash, values.data, values.total() * values.elemSize());
+}
+
+/**
+  * @brief  Align offset
+  * @param  offset  uint64_t
+  * @retval offset rounded up to REMAP_LUT_ALIGN
+**/
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + REMAP_LUT_ALIGN - 1) & ~(uint64_t) (REMAP_LUT_ALIGN - 1);
+}
+
+/**
+  * @brief  Scale camera matrix
+  * @note   Focal lengths and principal point follow the image when it is resized, also non-uniformly
+  * @param  K   cv::Mat, 3x3 camera matrix
+  * @param  sx  double
+  * @param  sy  double
+  * @retval Scaled copy of K
+**/
+static cv::Mat scaleCamera(const cv::Mat &K, double sx, double sy) {
+    cv::Mat scaled;
+
+    K.convertTo(scaled, CV_64F);
+    scaled.row(0) *= sx;
+    scaled.row(1) *= sy;
+    return scaled;
+}
+
+/**
+  * @brief  Load calibration
+  * @note   M1/D1/M2/D2/R/T are required, RL/RR/PL/PR/Q and imgSize are used when the calibration tool wrote them
+  * @param  sc      struct stereoCalibration
+  * @param  path    const char *, e.g. "../config/intrinsics.yml"
+  * @retval 0       If calibration loaded
+**/
+int loadCalibration(struct stereoCalibration *sc, const char *path) {
+    cv::FileStorage fs;
+
+    try {
+        fs.open(path, cv::FileStorage::READ);
+    } catch (const cv::Exception &e) {
+        printf("Error: Unable to parse %s: %s\n", path, e.what());
+        return -1;
+    }
+    if (!fs.isOpened()) {
+        printf("Error: Unable to open %s\n", path);
+        return -1;
+    }
+
+    fs["M1"] >> sc->K[0];
+    fs["D1"] >> sc->D[0];
+    fs["M2"] >> sc->K[1];
+    fs["D2"] >> sc->D[1];
+    fs["R"] >> sc->R;
+    fs["T"] >> sc->T;
+    fs["RL"] >> sc->rect[0];
+    fs["RR"] >> sc->rect[1];
+    fs["PL"] >> sc->proj[0];
+    fs["PR"] >> sc->proj[1];
+    fs["Q"] >> sc->Q;
+    cv::read(fs["imgSize"], sc->img_Size, cv::Size());
+
+    if (sc->K[0].size() != cv::Size(3, 3) || sc->K[1].size() != cv::Size(3, 3) || sc->R.size() != cv::Size(3, 3) ||
+        sc->T.total() != 3 || sc->D[0].empty() || sc->D[1].empty()) {
+        printf("Error: %s lacks M1, D1, M2, D2, R or T\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Remap table path
+  * @note   Tables sit next to the calibration file, named by their key so stale ones are never picked up
+  * @param  configPath  const char *, e.g. "../config/intrinsics.yml"
+  * @param  hash        uint64_t, calibrationHash()
+  * @retval e.g. "../config/remap-0123456789abcdef.lut"
+**/
+std::string remapLutPath(const char *configPath, uint64_t hash) {
+    std::string dir(configPath);
+    char name[32];
+
+    size_t slash = dir.find_last_of('/');
+    dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+    snprintf(name, sizeof(name), "remap-%016llx.lut", (unsigned long long) hash);
+    return dir + name;
+}
+
+/**
+  * @brief  Calibration hash
+  * @note   FNV-1a over the table version, eye size, calibration size, M1/D1/M2/D2/R/T and the stored RL/RR/PL/PR,
+  *         i.e. everything computeRemap() output depends on. The stored rectification only matters at the calibration
+  *         size, but hashing it at every size keeps the key independent of that rule.
+  * @param  sc      struct stereoCalibration
+  * @param  eyeSize cv::Size
+  * @retval 64-bit hash
+**/
+uint64_t calibrationHash(const struct stereoCalibration *sc, cv::Size eyeSize) {
+    int32_t sizes[5] = {REMAP_LUT_VERSION, eyeSize.width, eyeSize.height, sc->img_Size.width, sc->img_Size.height};
+    uint64_t hash = fnv1a(FNV_OFFSET, sizes, sizeof(sizes));
+
+    for (int i = 0; i < 2; ++i) {
+        hash = hashMat(hash, sc->K[i]);
+        hash = hashMat(hash, sc->D[i]);
+        hash = hashMat(hash, sc->rect[i]);
+        hash = hashMat(hash, sc->proj[i]);
+    }
+    hash = hashMat(hash, sc->R);
+    return hashMat(hash, sc->T);
+}
+
+/**
+  * @brief  Compute remap tables
+  * @note   The stored rectification is only used at the calibration size, any other eye size runs stereoRectify()
+  *         on intrinsics scaled from the calibration size. An unknown calibration size is taken to be the eye size.
+  * @param  sc      struct stereoCalibration
+  * @param  eyeSize cv::Size
+  * @param  xy      cv::Mat[2], CV_16SC2 per eye
+  * @param  frac    cv::Mat[2], CV_16UC1 per eye
+  * @retval 0       If tables computed
+**/
+int computeRemap(const struct stereoCalibration *sc, cv::Size eyeSize, cv::Mat xy[2], cv::Mat frac[2]) {
+    cv::Size calibSize = sc->img_Size.area() > 0 ? sc->img_Size : eyeSize;
+    cv::Mat K[2] = {sc->K[0], sc->K[1]}, rect[2] = {sc->rect[0], sc->rect[1]}, proj[2] = {sc->proj[0], sc->proj[1]}, Q;
+
+    try {
+        if (calibSize != eyeSize) {
+            double sx = (double) eyeSize.width / calibSize.width, sy = (double) eyeSize.height / calibSize.height;
+            K[0] = scaleCamera(K[0], sx, sy);
+            K[1] = scaleCamera(K[1], sx, sy);
+            rect[0].release();
+        }
+        if (rect[0].empty() || rect[1].empty() || proj[0].empty() || proj[1].empty()) {
+            cv::stereoRectify(K[0], sc->D[0], K[1], sc->D[1], eyeSize, sc->R, sc->T, rect[0], rect[1], proj[0], proj[1], Q,
+                              cv::CALIB_ZERO_DISPARITY, 0, eyeSize);
+        }
+        for (int i = 0; i < 2; ++i)
+            cv::initUndistortRectifyMap(K[i], sc->D[i], rect[i], proj[i], eyeSize, CV_16SC2, xy[i], frac[i]);
+    } catch (const cv::Exception &e) {
+        printf("Error: Unable to build remap tables: %s\n", e.what());
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Write remap tables
+  * @note   Written to path.tmp and renamed, a reader mapping path never sees a half written file
+  * @param  path    const char *
+  * @param  hash    uint64_t, calibrationHash() the tables were computed for
+  * @param  xy      cv::Mat[2], CV_16SC2 per eye
+  * @param  frac    cv::Mat[2], CV_16UC1 per eye
+  * @retval 0       If tables written
+**/
+int writeRemapLut(const char *path, uint64_t hash, const cv::Mat xy[2], const cv::Mat frac[2]) {
+    struct remapLutHeader header {};
+    std::string tmpPath = std::string(path) + ".tmp";
+    uint64_t offset = alignOffset(sizeof(header));
+    bool ok = true;
+
+    for (int i = 0; i < 2; ++i) {
+        if (xy[i].type() != CV_16SC2 || frac[i].type() != CV_16UC1 || xy[i].size() != xy[0].size() || frac[i].size() != xy[0].size()) {
+            printf("Error: Remap tables are not a CV_16SC2 / CV_16UC1 pair\n");
+            return -1;
+        }
+    }
+
+    header.magic = REMAP_LUT_MAGIC;
+    header.version = REMAP_LUT_VERSION;
+    header.calib_Hash = hash;
+    header.eye_W = xy[0].cols;
+    header.eye_H = xy[0].rows;
+    for (int i = 0; i < 2; ++i) {
+        header.xy_Offset[i] = offset;
+        offset = alignOffset(offset + xy[i].total() * xy[i].elemSize());
+        header.frac_Offset[i] = offset;
+        offset = alignOffset(offset + frac[i].total() * frac[i].elemSize());
+    }
+
+    FILE *file = fopen(tmpPath.c_str(), "wb");
+    if (file == nullptr) {
+        printf("Error: Unable to create %s\n", tmpPath.c_str());
+        return -1;
+    }
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < 2; ++i) {
+        const cv::Mat *tables[2] = {&xy[i], &frac[i]};
+        uint64_t offsets[2] = {header.xy_Offset[i], header.frac_Offset[i]};
+        for (int t = 0; ok && t < 2; ++t) {
+            cv::Mat table = tables[t]->isContinuous() ? *tables[t] : tables[t]->clone();
+            ok = fseek(file, (long) offsets[t], SEEK_SET) == 0 && fwrite(table.data, table.elemSize(), table.total(), file) == table.total();
+        }
+    }
+    if (fclose(file) != 0 || !ok || rename(tmpPath.c_str(), path) != 0) {
+        printf("Error: Unable to write %s\n", path);
+        unlink(tmpPath.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Map remap tables
+  * @note   The tables are used straight from the read-only mapping, nothing is parsed or copied
+  * @param  lut     struct remapLut
+  * @param  path    const char *
+  * @retval 0       If tables mapped
+**/
+int mapRemapLut(struct remapLut *lut, const char *path) {
+    struct remapLutHeader header {};
+    struct stat st {};
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(header) || pread(fd, &header, sizeof(header), 0) != (ssize_t) sizeof(header) ||
+        header.magic != REMAP_LUT_MAGIC || header.version != REMAP_LUT_VERSION || header.eye_W <= 0 || header.eye_H <= 0) {
+        printf("Error: %s is not a remap table this version can read\n", path);
+        close(fd);
+        return -1;
+    }
+    uint64_t pixels = (uint64_t) header.eye_W * header.eye_H;
+    for (int i = 0; i < 2; ++i) {
+        if (header.xy_Offset[i] + pixels * 4 > (uint64_t) st.st_size || header.frac_Offset[i] + pixels * 2 > (uint64_t) st.st_size) {
+            printf("Error: %s is truncated\n", path);
+            close(fd);
+            return -1;
+        }
+    }
+
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    lut->map = map;
+    lut->map_Size = st.st_size;
+    lut->calib_Hash = header.calib_Hash;
+    for (int i = 0; i < 2; ++i) {
+        lut->xy[i] = cv::Mat(header.eye_H, header.eye_W, CV_16SC2, (unsigned char *) map + header.xy_Offset[i]);
+        lut->frac[i] = cv::Mat(header.eye_H, header.eye_W, CV_16UC1, (unsigned char *) map + header.frac_Offset[i]);
+    }
+    return 0;
+}
+
+/**
+  * @brief  Unmap remap tables
+  * @param  lut struct remapLut
+  * @retval None
+**/
+void unmapRemapLut(struct remapLut *lut) {
+    if (lut->map == nullptr)
+        return;
+    for (int i = 0; i < 2; ++i) {
+        lut->xy[i].release();
+        lut->frac[i].release();
+    }
+    munmap(lut->map, lut->map_Size);
+    lut->map = nullptr;
+}
@@ -0,0 +1,59 @@
+#ifndef USBCAM_REMAP_LUT_H
+#define USBCAM_REMAP_LUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <opencv2/core.hpp>
+#include <string>
+
+#define REMAP_LUT_MAGIC 0x544c5255 /* "URLT" */
+#define REMAP_LUT_VERSION 1
+#define REMAP_LUT_ALIGN 4096
+
+/**
+  * @brief  Precomputed remap tables
+  * @note   remapLutHeader, then per eye (left, right) the CV_16SC2 integer coordinates and the CV_16UC1 interpolation
+  *         indices of cv::initUndistortRectifyMap(), each table at a REMAP_LUT_ALIGN offset. All fields are little endian.
+  * @note   calib_Hash is calibrationHash() of the calibration and eye size the tables were built for.
+**/
+struct remapLutHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t calib_Hash;
+    int32_t eye_W;
+    int32_t eye_H;
+    uint32_t reserved[2];
+    uint64_t xy_Offset[2];
+    uint64_t frac_Offset[2];
+};
+
+static_assert(sizeof(struct remapLutHeader) == 64, "remapLutHeader layout");
+
+struct stereoCalibration {
+    cv::Mat K[2];
+    cv::Mat D[2];
+    cv::Mat R;
+    cv::Mat T;
+    cv::Mat rect[2];
+    cv::Mat proj[2];
+    cv::Mat Q;
+    cv::Size img_Size;
+};
+
+struct remapLut {
+    void *map;
+    size_t map_Size;
+    uint64_t calib_Hash;
+    cv::Mat xy[2];
+    cv::Mat frac[2];
+};
+
+int loadCalibration(struct stereoCalibration *sc, const char *path);
+std::string remapLutPath(const char *configPath, uint64_t hash);
+uint64_t calibrationHash(const struct stereoCalibration *sc, cv::Size eyeSize);
+int computeRemap(const struct stereoCalibration *sc, cv::Size eyeSize, cv::Mat xy[2], cv::Mat frac[2]);
+int writeRemapLut(const char *path, uint64_t hash, const cv::Mat xy[2], const cv::Mat frac[2]);
+int mapRemapLut(struct remapLut *lut, const char *path);
+void unmapRemapLut(struct remapLut *lut);
+
+#endif
@@ -0,0 +1,749 @@
+#include "../utils/capture.h"
+#include "../utils/utils.h"
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#define FAKE_MAX_BUFFERS 8
+#define HEADERFRAME1_BYTES 0xaf
+
+/**
+  * @brief  Fake V4L2 device
+  * @note   What the fake driver offers and what it has been handed. It only ever captures into USERPTR memory, so
+  *         the application's own pool is what the tests look at.
+  * @note   The device node is a pipe holding one byte while a filled buffer waits, which is what epoll sees.
+**/
+struct fakeDevice {
+    unsigned int buf_Type;
+    unsigned int pixel_Format;
+    int num_Planes;
+    unsigned int bytes_Per_Line;
+    unsigned int data_Offset;
+    unsigned int max_Buffers;
+    const char *bus_Info;
+
+    struct v4l2_format fmt;
+    struct v4l2_fract interval;
+    unsigned int count;
+    bool is_Streaming;
+    bool is_Queued[FAKE_MAX_BUFFERS];
+    unsigned long user_Ptr[FAKE_MAX_BUFFERS][MAX_PLANES];
+    unsigned int length[FAKE_MAX_BUFFERS][MAX_PLANES];
+    unsigned int bytes_Used[FAKE_MAX_BUFFERS][MAX_PLANES];
+    std::vector<int> done;
+    unsigned int sequence;
+    int queue_Calls;
+    int enum_Calls;
+    int pipe_Fds[2];
+    bool is_Signalled;
+};
+
+static struct fakeDevice fake;
+static std::mutex fakeLock;
+
+/**
+  * @brief  Fake frame sizes
+  * @note   Discrete sizes the fake device lists for every format
+**/
+static const struct v4l2_frmsize_discrete FAKE_SIZES[] = {{640, 480}, {1280, 720}, {1920, 1080}};
+
+/**
+  * @brief  Fake set format
+  * @note   Snaps to the nearest listed size. YUV rows are padded by 64 bytes, so pitch and width never agree.
+  * @param  fmt     struct v4l2_format
+  * @retval 0       If format set
+**/
+static int fakeSetFormat(struct v4l2_format *fmt) {
+    bool mplane = fake.buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    unsigned int width = mplane ? fmt->fmt.pix_mp.width : fmt->fmt.pix.width;
+    unsigned int height = mplane ? fmt->fmt.pix_mp.height : fmt->fmt.pix.height;
+    const struct v4l2_frmsize_discrete *best = &FAKE_SIZES[0];
+
+    if (fmt->type != fake.buf_Type)
+        return -1;
+    for (const auto &size : FAKE_SIZES) {
+        if (abs((int) (size.width * size.height) - (int) (width * height)) < abs((int) (best->width * best->height) - (int) (width * height)))
+            best = &size;
+    }
+    width = best->width;
+    height = best->height;
+
+    bool yuv = fake.pixel_Format != V4L2_PIX_FMT_MJPEG;
+    unsigned int pitch = yuv ? width + 64 : 0;
+    fake.bytes_Per_Line = pitch;
+    memset(&fmt->fmt, 0, sizeof(fmt->fmt));
+    if (mplane) {
+        struct v4l2_pix_format_mplane &mp = fmt->fmt.pix_mp;
+        mp.width = width;
+        mp.height = height;
+        mp.pixelformat = fake.pixel_Format;
+        mp.num_planes = (unsigned char) fake.num_Planes;
+        for (int p = 0; p < fake.num_Planes; ++p) {
+            mp.plane_fmt[p].bytesperline = pitch;
+            mp.plane_fmt[p].sizeimage = fake.data_Offset + (fake.num_Planes == 1 ? pitch * height * 3 / 2 : pitch * height / (p + 1));
+        }
+    } else {
+        fmt->fmt.pix.width = width;
+        fmt->fmt.pix.height = height;
+        fmt->fmt.pix.pixelformat = fake.pixel_Format;
+        fmt->fmt.pix.bytesperline = pitch;
+        fmt->fmt.pix.sizeimage = yuv ? pitch * height * 3 / 2 : width * height;
+    }
+    fake.fmt = *fmt;
+    return 0;
+}
+
+/**
+  * @brief  Fake frame intervals
+  * @note   The smaller sizes also run at 60 fps
+  * @param  ival    struct v4l2_frmivalenum
+  * @retval 0       If interval listed
+**/
+static int fakeEnumIntervals(struct v4l2_frmivalenum *ival) {
+    unsigned int rates = ival->width * ival->height <= 1280 * 720 ? 2 : 1;
+
+    if (ival->pixel_format != fake.pixel_Format || ival->index >= rates)
+        return -1;
+    ival->type = V4L2_FRMIVAL_TYPE_DISCRETE;
+    ival->discrete = {1, ival->index == 0 ? 30u : 60u};
+    return 0;
+}
+
+/**
+  * @brief  Fake queue buffer
+  * @note   Takes USERPTR buffers only and checks each plane is large enough for the negotiated format
+  * @param  buf     struct v4l2_buffer
+  * @retval 0       If buffer queued
+**/
+static int fakeQueue(const struct v4l2_buffer *buf) {
+    bool mplane = fake.buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    int planes = mplane ? fake.num_Planes : 1;
+
+    if (buf->type != fake.buf_Type || buf->memory != V4L2_MEMORY_USERPTR || buf->index >= fake.count || fake.is_Queued[buf->index])
+        return -1;
+    if (mplane && buf->length != (unsigned int) planes)
+        return -1;
+    for (int p = 0; p < planes; ++p) {
+        unsigned long ptr = mplane ? buf->m.planes[p].m.userptr : buf->m.userptr;
+        unsigned int length = mplane ? buf->m.planes[p].length : buf->length;
+        unsigned int size = mplane ? fake.fmt.fmt.pix_mp.plane_fmt[p].sizeimage : fake.fmt.fmt.pix.sizeimage;
+        if (ptr == 0 || length < size)
+            return -1;
+        fake.user_Ptr[buf->index][p] = ptr;
+        fake.length[buf->index][p] = length;
+    }
+    fake.is_Queued[buf->index] = true;
+    fake.queue_Calls++;
+    return 0;
+}
+
+/**
+  * @brief  Fake dequeue buffer
+  * @param  buf     struct v4l2_buffer
+  * @retval 0       If a filled buffer was dequeued, -1 with EAGAIN if none is
+**/
+static int fakeDequeue(struct v4l2_buffer *buf) {
+    bool mplane = fake.buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    if (buf->type != fake.buf_Type || buf->memory != V4L2_MEMORY_USERPTR)
+        return -1;
+    if (fake.done.empty()) {
+        errno = EAGAIN;
+        return -1;
+    }
+    int index = fake.done.front();
+    fake.done.erase(fake.done.begin());
+    if (fake.done.empty() && fake.is_Signalled) {
+        char byte;
+        fake.is_Signalled = read(fake.pipe_Fds[0], &byte, 1) != 1;
+    }
+    fake.is_Queued[index] = false;
+    buf->index = index;
+    buf->sequence = fake.sequence++;
+    buf->flags = 0;
+    if (mplane) {
+        for (int p = 0; p < fake.num_Planes; ++p) {
+            buf->m.planes[p].m.userptr = fake.user_Ptr[index][p];
+            buf->m.planes[p].bytesused = fake.bytes_Used[index][p];
+            buf->m.planes[p].data_offset = fake.data_Offset;
+        }
+    } else {
+        buf->m.userptr = fake.user_Ptr[index][0];
+        buf->bytesused = fake.bytes_Used[index][0];
+    }
+    return 0;
+}
+
+/**
+  * @brief  Fake ioctl
+  * @param  request unsigned long
+  * @param  arg     void *
+  * @retval 0 or -1 like ioctl()
+**/
+static int fakeIoctl(unsigned long request, void *arg) {
+    switch (request) {
+        case VIDIOC_QUERYCAP: {
+            auto *cap = (struct v4l2_capability *) arg;
+            memset(cap, 0, sizeof(struct v4l2_capability));
+            snprintf((char *) cap->driver, sizeof(cap->driver), "fake");
+            snprintf((char *) cap->card, sizeof(cap->card), "Fake Camera");
+            snprintf((char *) cap->bus_info, sizeof(cap->bus_info), "%s", fake.bus_Info);
+            cap->device_caps = V4L2_CAP_STREAMING | (fake.buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? V4L2_CAP_VIDEO_CAPTURE_MPLANE : V4L2_CAP_VIDEO_CAPTURE);
+            cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+            return 0;
+        }
+        case VIDIOC_ENUM_FMT: {
+            auto *desc = (struct v4l2_fmtdesc *) arg;
+            if (desc->index > 0 || desc->type != fake.buf_Type)
+                return -1;
+            desc->pixelformat = fake.pixel_Format;
+            snprintf((char *) desc->description, sizeof(desc->description), "%.4s", (const char *) &fake.pixel_Format);
+            return 0;
+        }
+        case VIDIOC_ENUM_FRAMESIZES: {
+            auto *size = (struct v4l2_frmsizeenum *) arg;
+            fake.enum_Calls++;
+            if (size->pixel_format != fake.pixel_Format || size->index >= sizeof(FAKE_SIZES) / sizeof(FAKE_SIZES[0]))
+                return -1;
+            size->type = V4L2_FRMSIZE_TYPE_DISCRETE;
+            size->discrete = FAKE_SIZES[size->index];
+            return 0;
+        }
+        case VIDIOC_ENUM_FRAMEINTERVALS:
+            return fakeEnumIntervals((struct v4l2_frmivalenum *) arg);
+        case VIDIOC_S_FMT:
+            return fakeSetFormat((struct v4l2_format *) arg);
+        case VIDIOC_S_PARM:
+            fake.interval = ((struct v4l2_streamparm *) arg)->parm.capture.timeperframe;
+            return 0;
+        case VIDIOC_G_PARM:
+            ((struct v4l2_streamparm *) arg)->parm.capture.timeperframe = fake.interval;
+            return 0;
+        case VIDIOC_REQBUFS: {
+            auto *req = (struct v4l2_requestbuffers *) arg;
+            if (req->type != fake.buf_Type || req->memory != V4L2_MEMORY_USERPTR)
+                return -1;
+            fake.count = req->count < fake.max_Buffers ? req->count : fake.max_Buffers;
+            req->count = fake.count;
+            return 0;
+        }
+        case VIDIOC_QUERYBUF: {
+            auto *buf = (struct v4l2_buffer *) arg;
+            if (buf->index >= fake.count)
+                return -1;
+            buf->flags = 0;
+            for (int index : fake.done)
+                buf->flags |= index == (int) buf->index ? V4L2_BUF_FLAG_DONE : 0;
+            if (fake.is_Queued[buf->index] && !(buf->flags & V4L2_BUF_FLAG_DONE))
+                buf->flags |= V4L2_BUF_FLAG_QUEUED;
+            return 0;
+        }
+        case VIDIOC_QBUF:
+            return fakeQueue((const struct v4l2_buffer *) arg);
+        case VIDIOC_DQBUF:
+            return fakeDequeue((struct v4l2_buffer *) arg);
+        case VIDIOC_STREAMON:
+        case VIDIOC_STREAMOFF:
+            fake.is_Streaming = request == VIDIOC_STREAMON;
+            return 0;
+        default:
+            errno = ENOTTY;
+            return -1;
+    }
+}
+
+/**
+  * @brief  ioctl
+  * @note   Replaces the C library's ioctl() for the whole test: V4L2 requests go to the fake device, anything else to the kernel
+**/
+extern "C" int ioctl(int fd, unsigned long request, ...) noexcept {
+    va_list args;
+
+    va_start(args, request);
+    void *arg = va_arg(args, void *);
+    va_end(args);
+    if (_IOC_TYPE(request) == 'V') {
+        std::lock_guard<std::mutex> guard(fakeLock);
+        return fakeIoctl(request, arg);
+    }
+    return (int) syscall(SYS_ioctl, fd, request, arg);
+}
+
+/**
+  * @brief  Fake fill
+  * @note   The driver fills the oldest queued buffers, every memory plane byte set to its plane number plus one,
+  *         and a single semi-planar plane gets 0x80 from the chroma rows on
+  * @param  frames      int
+  * @param  bytesUsed   unsigned int, bytes of the first plane, 0 for the whole negotiated size
+  * @retval Buffers filled
+**/
+static int fakeFill(int frames, unsigned int bytesUsed = 0) {
+    std::lock_guard<std::mutex> guard(fakeLock);
+    bool mplane = fake.buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    int planes = mplane ? fake.num_Planes : 1, filled = 0;
+
+    for (unsigned int i = 0; i < fake.count && filled < frames; ++i) {
+        bool isDone = false;
+        for (int index : fake.done)
+            isDone |= index == (int) i;
+        if (!fake.is_Queued[i] || isDone)
+            continue;
+        for (int p = 0; p < planes; ++p) {
+            unsigned int size = mplane ? fake.fmt.fmt.pix_mp.plane_fmt[p].sizeimage : fake.fmt.fmt.pix.sizeimage;
+            unsigned int used = p == 0 && bytesUsed > 0 ? bytesUsed : size;
+            auto *mem = (unsigned char *) fake.user_Ptr[i][p];
+            memset(mem, p + 1, used);
+            if (planes == 1 && fake.pixel_Format == V4L2_PIX_FMT_NV12 && bytesUsed == 0) {
+                size_t luma = (size_t) fake.bytes_Per_Line * (mplane ? fake.fmt.fmt.pix_mp.height : fake.fmt.fmt.pix.height);
+                memset(mem + fake.data_Offset + luma, 0x80, used - fake.data_Offset - luma);
+            }
+            fake.bytes_Used[i][p] = used;
+        }
+        fake.done.push_back((int) i);
+        filled++;
+    }
+    if (filled > 0 && !fake.is_Signalled)
+        fake.is_Signalled = write(fake.pipe_Fds[1], "", 1) == 1;
+    return filled;
+}
+
+/**
+  * @brief  Fake queued buffers
+  * @retval Buffers the driver holds empty, ready to capture into
+**/
+static int fakeQueued() {
+    std::lock_guard<std::mutex> guard(fakeLock);
+    int queued = 0;
+
+    for (unsigned int i = 0; i < fake.count; ++i) {
+        bool isDone = false;
+        for (int index : fake.done)
+            isDone |= index == (int) i;
+        queued += fake.is_Queued[i] && !isDone;
+    }
+    return queued;
+}
+
+/**
+  * @brief  Open fake device
+  * @note   The device node is one end of a pipe, so epoll works on it while every ioctl lands in the fake driver
+  * @note   Asks for the raw_W x raw_H at raw_Fps already in vd, 1280x720 at 30 fps if left at 0
+  * @note   Multi-planar buffers start their data 256 bytes into each plane
+  * @param  vd          struct videoDev
+  * @param  pipeFds     int[2], closed again by closeFake()
+  * @param  busInfo     const char *, keys the format cache, one per configuration
+  * @param  bufType     unsigned int
+  * @param  format      unsigned int
+  * @param  numPlanes   int, memory planes of a multi-planar format
+  * @param  buffers     int, buffers asked for
+  * @retval 0           If device opened and streaming
+**/
+static int openFake(struct videoDev *vd, int pipeFds[2], const char *busInfo, unsigned int bufType, unsigned int format, int numPlanes, int buffers) {
+    fake = fakeDevice {};
+    fake.buf_Type = bufType;
+    fake.pixel_Format = format;
+    fake.num_Planes = numPlanes;
+    fake.max_Buffers = 4;
+    fake.bus_Info = busInfo;
+    fake.data_Offset = bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? 256 : 0;
+
+    if (pipe(pipeFds) < 0)
+        return -1;
+    fake.pipe_Fds[0] = pipeFds[0];
+    fake.pipe_Fds[1] = pipeFds[1];
+    snprintf(vd->dev_Name, sizeof(vd->dev_Name), "/proc/self/fd/%d", pipeFds[0]);
+    if (vd->raw_W == 0) {
+        vd->raw_W = 1280;
+        vd->raw_H = 720;
+        vd->raw_Fps = 30;
+    }
+    vd->raw_Format = (int) format;
+    vd->nb_Buffer = buffers;
+    vd->mem_Type = V4L2_MEMORY_USERPTR;
+    if (openVideoDevice(vd) < 0)
+        return -1;
+    return playStream(vd);
+}
+
+/**
+  * @brief  Close fake device
+  * @param  vd          struct videoDev
+  * @param  pipeFds     int[2]
+  * @retval None
+**/
+static void closeFake(struct videoDev *vd, int pipeFds[2]) {
+    closeVideoDevice(vd);
+    close(pipeFds[0]);
+    close(pipeFds[1]);
+}
+
+/**
+  * @brief  Check buffer count and stats
+  * @note   The driver may grant fewer buffers than asked for, queryBufferStats() has to follow the buffers through
+  *         queued, done and held
+  * @retval Number of failed checks
+**/
+static int checkBufferStats() {
+    struct videoDev vd {};
+    struct frameLease lease {};
+    struct bufferStats stats {};
+    int pipeFds[2], failures = 0;
+
+    if (openFake(&vd, pipeFds, "test-stats", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 6) < 0) {
+        printf("Error: Fake device failed to open\n");
+        return 1;
+    }
+    if (vd.nb_Buffer != 4 || fake.queue_Calls != 4) {
+        printf("Error: Asked for 6 of 4 buffers, got %d with %d queued\n", vd.nb_Buffer, fake.queue_Calls);
+        failures++;
+    }
+
+    fakeFill(3);
+    leaseFrame(&vd, &lease);
+    queryBufferStats(&vd, &stats);
+    if (stats.count != 4 || stats.queued != 1 || stats.done != 2 || stats.held != 1 || stats.max_Held != 1) {
+        printf("Error: Stats %d buffers, %d queued, %d done, %d held, %d max held\n", stats.count, stats.queued, stats.done, stats.held, stats.max_Held);
+        failures++;
+    }
+    releaseFrame(&vd, &lease);
+    queryBufferStats(&vd, &stats);
+    if (stats.queued != 2 || stats.held != 0 || stats.max_Held != 1) {
+        printf("Error: After release %d queued, %d held, %d max held\n", stats.queued, stats.held, stats.max_Held);
+        failures++;
+    }
+
+    closeFake(&vd, pipeFds);
+    printf("%-40s %s\n", "buffer count and stats", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check USERPTR pool
+  * @note   Every buffer and plane has to be page aligned, huge page pools also start each buffer on a 2 MiB boundary.
+  *         Planes must fit the negotiated size, stay inside the pool without overlapping, and be what the driver got.
+  * @retval Number of failed checks
+**/
+static int checkUserPool() {
+    struct {
+        const char *name;
+        unsigned int bufType, format;
+        int numPlanes, hugePages;
+    } cases[] = {
+            {"USERPTR MJPEG", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 0},
+            {"USERPTR MJPEG, huge pages", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 1},
+            {"USERPTR NV12M, huge pages", V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_NV12M, 2, 1},
+    };
+    int failures = 0;
+
+    for (const auto &c : cases) {
+        struct videoDev vd {};
+        int pipeFds[2], before = failures;
+
+        vd.huge_Pages = c.hugePages;
+        if (openFake(&vd, pipeFds, c.name, c.bufType, c.format, c.numPlanes, 4) < 0 || vd.mem_Type != V4L2_MEMORY_USERPTR || vd.pool == nullptr) {
+            printf("Error: %s did not capture into a pool\n", c.name);
+            failures++;
+            continue;
+        }
+
+        auto *pool = (unsigned char *) vd.pool, *next = pool;
+        uintptr_t align = c.hugePages ? 2 << 20 : 4096;
+        for (int i = 0; i < vd.nb_Buffer; ++i) {
+            if ((uintptr_t) vd.mem[i * MAX_PLANES] % align != 0) {
+                printf("Error: %s buffer %d not %zu byte aligned\n", c.name, i, (size_t) align);
+                failures++;
+            }
+            for (int p = 0; p < vd.mem_Planes; ++p) {
+                auto *mem = (unsigned char *) vd.mem[i * MAX_PLANES + p];
+                size_t length = vd.mem_Len[i * MAX_PLANES + p];
+                size_t size = c.bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? fake.fmt.fmt.pix_mp.plane_fmt[p].sizeimage : fake.fmt.fmt.pix.sizeimage;
+                if ((uintptr_t) mem % 4096 != 0 || length < size || mem < next || mem + length > pool + vd.pool_Size ||
+                    fake.user_Ptr[i][p] != (unsigned long) mem || fake.length[i][p] != length) {
+                    printf("Error: %s buffer %d plane %d at %td, %zu of %zu bytes\n", c.name, i, p, mem - pool, length, size);
+                    failures++;
+                }
+                next = mem + length;
+            }
+        }
+
+        // the driver writes every byte of every plane
+        fakeFill(vd.nb_Buffer);
+        closeFake(&vd, pipeFds);
+        if (vd.pool != nullptr) {
+            printf("Error: %s pool not released\n", c.name);
+            failures++;
+        }
+        printf("%-40s %s\n", c.name, failures == before ? "ok" : "FAILED");
+    }
+    return failures;
+}
+
+/**
+  * @brief  Check lease references
+  * @note   A retained buffer goes back to the driver only with its last release, releasing a lease twice is harmless,
+  *         and header-only MJPEG buffers are requeued without ever being handed out
+  * @retval Number of failed checks
+**/
+static int checkLeaseRefs() {
+    struct videoDev vd {};
+    struct frameLease lease {}, shared {}, spare {};
+    int pipeFds[2], failures = 0;
+
+    if (openFake(&vd, pipeFds, "test-refs", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 4) < 0) {
+        printf("Error: Fake device failed to open\n");
+        return 1;
+    }
+
+    fakeFill(1);
+    if (leaseFrame(&vd, &lease) != 0 || leaseFrame(&vd, &spare) != 1) {
+        printf("Error: One filled buffer did not lease exactly once\n");
+        failures++;
+    }
+    int index = lease.index, queued = fake.queue_Calls;
+    shared = lease;
+    if (retainFrame(&vd, &shared) < 0) {
+        printf("Error: Leased frame could not be retained\n");
+        failures++;
+    }
+    releaseFrame(&vd, &lease);
+    if (lease.index != -1 || lease.mem != nullptr || fake.queue_Calls != queued || vd.buffers_Held != 1) {
+        printf("Error: Buffer %d requeued while still retained\n", index);
+        failures++;
+    }
+    releaseFrame(&vd, &shared);
+    releaseFrame(&vd, &shared);
+    if (fake.queue_Calls != queued + 1 || !fake.is_Queued[index] || vd.buffers_Held != 0 || retainFrame(&vd, &shared) == 0) {
+        printf("Error: Buffer %d queued %d times by its last two releases, %d held\n", index, fake.queue_Calls - queued, vd.buffers_Held.load());
+        failures++;
+    }
+
+    fakeFill(1, HEADERFRAME1_BYTES);
+    queued = fake.queue_Calls;
+    if (leaseFrame(&vd, &lease) != 1 || lease.index != -1 || fake.queue_Calls != queued + 1 || vd.buffers_Held != 0) {
+        printf("Error: Header-only MJPEG buffer was handed out or not requeued\n");
+        failures++;
+    }
+
+    closeFake(&vd, pipeFds);
+    printf("%-40s %s\n", "lease references", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check format negotiation
+  * @note   Exact sizes win, then the smallest size covering the request, then the largest below it. A second open
+  *         with the same request comes from the format cache without enumerating again.
+  * @retval Number of failed checks
+**/
+static int checkNegotiation() {
+    struct {
+        int width, height, fps;
+        int wantW, wantH, wantFps;
+    } cases[] = {
+            {1280, 720, 60, 1280, 720, 60},
+            {1000, 700, 30, 1280, 720, 30},
+            {3840, 2160, 60, 1920, 1080, 30},
+            {640, 480, 0, 640, 480, 60},
+    };
+    int failures = 0;
+
+    for (const auto &c : cases) {
+        for (int pass = 0; pass < 2; ++pass) {
+            struct videoDev vd {};
+            int pipeFds[2];
+            vd.raw_W = c.width;
+            vd.raw_H = c.height;
+            vd.raw_Fps = c.fps;
+            if (openFake(&vd, pipeFds, "test-negotiate", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 4) < 0) {
+                printf("Error: Fake device failed to open\n");
+                return failures + 1;
+            }
+            if (vd.raw_W != c.wantW || vd.raw_H != c.wantH || vd.raw_Fps != c.wantFps) {
+                printf("Error: %dx%d @ %d negotiated %dx%d @ %d, not %dx%d @ %d\n", c.width, c.height, c.fps, vd.raw_W, vd.raw_H,
+                       vd.raw_Fps, c.wantW, c.wantH, c.wantFps);
+                failures++;
+            }
+            if (pass == 1 && fake.enum_Calls != 0) {
+                printf("Error: %dx%d @ %d enumerated again instead of using the cache\n", c.width, c.height, c.fps);
+                failures++;
+            }
+            closeFake(&vd, pipeFds);
+        }
+    }
+    printf("%-40s %s\n", "format negotiation", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check plane layout
+  * @note   Single-plane NV12 is split at pitch * height, NV12M planes start at their data_offset in their own memory,
+  *         and NV12 in one multi-planar memory plane gets both
+  * @retval Number of failed checks
+**/
+static int checkPlanes() {
+    struct {
+        const char *name;
+        unsigned int bufType, format;
+        int numPlanes;
+    } cases[] = {
+            {"NV12", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_NV12, 1},
+            {"NV12M", V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_NV12M, 2},
+            {"NV12 in one MPLANE plane", V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE, V4L2_PIX_FMT_NV12, 1},
+    };
+    int failures = 0;
+
+    for (const auto &c : cases) {
+        struct videoDev vd {};
+        struct frameLease lease {};
+        int pipeFds[2], before = failures;
+
+        if (openFake(&vd, pipeFds, c.name, c.bufType, c.format, c.numPlanes, 4) < 0) {
+            printf("Error: %s fake device failed to open\n", c.name);
+            failures++;
+            continue;
+        }
+        fakeFill(1);
+        if (leaseFrame(&vd, &lease) != 0) {
+            printf("Error: %s frame not leased\n", c.name);
+            closeFake(&vd, pipeFds);
+            failures++;
+            continue;
+        }
+
+        auto *mem = (unsigned char *) vd.mem[lease.index * MAX_PLANES];
+        auto *luma = (unsigned char *) lease.planes[0], *chroma = (unsigned char *) lease.planes[1];
+        size_t lumaSize = (size_t) fake.bytes_Per_Line * vd.raw_H;
+        size_t size0 = c.bufType == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? fake.fmt.fmt.pix_mp.plane_fmt[0].sizeimage : fake.fmt.fmt.pix.sizeimage;
+        if (vd.plane_Pitch[0] != (int) fake.bytes_Per_Line || lease.num_Planes != 2 || luma != mem + fake.data_Offset) {
+            printf("Error: %s pitch %d, %d planes, luma at %td\n", c.name, vd.plane_Pitch[0], lease.num_Planes, luma - mem);
+            failures++;
+        } else if (c.numPlanes == 2) {
+            auto *mem1 = (unsigned char *) vd.mem[lease.index * MAX_PLANES + 1];
+            size_t size1 = fake.fmt.fmt.pix_mp.plane_fmt[1].sizeimage;
+            if (chroma != mem1 + fake.data_Offset || (size_t) lease.plane_Bytes[0] != size0 - fake.data_Offset ||
+                (size_t) lease.plane_Bytes[1] != size1 - fake.data_Offset || *luma != 1 || *chroma != 2) {
+                printf("Error: %s chroma at %td of its plane, %d + %d bytes\n", c.name, chroma - mem1, lease.plane_Bytes[0], lease.plane_Bytes[1]);
+                failures++;
+            }
+        } else if (chroma != luma + lumaSize || (size_t) lease.plane_Bytes[0] != lumaSize ||
+                   (size_t) lease.plane_Bytes[1] != size0 - fake.data_Offset - lumaSize || *luma != 1 || *chroma != 0x80) {
+            printf("Error: %s chroma at %td, %d + %d bytes\n", c.name, chroma - luma, lease.plane_Bytes[0], lease.plane_Bytes[1]);
+            failures++;
+        }
+        releaseFrame(&vd, &lease);
+        closeFake(&vd, pipeFds);
+        printf("%-40s %s\n", c.name, failures == before ? "ok" : "FAILED");
+    }
+    return failures;
+}
+
+/**
+  * @brief  Wait for condition
+  * @note   The capture thread runs on its own schedule, give it up to a second
+  * @param  cond    Predicate
+  * @retval true    If cond became true
+**/
+template<typename F>
+static bool waitFor(F cond) {
+    for (int i = 0; i < 1000 && !cond(); ++i)
+        usleep(1000);
+    return cond();
+}
+
+/**
+  * @brief  Check latest frame capture
+  * @note   With a consumer that does not keep up, CAPTURE_LATEST must hand stale frames straight back: only the newest
+  *         waits for the consumer, so nb_Buffer - 1 buffers stay queued (nb_Buffer - 2 while it holds one)
+  * @retval Number of failed checks
+**/
+static int checkLatestCapture() {
+    struct videoDev vd {};
+    struct captureWorker cw;
+    struct frameLease lease {}, spare {};
+    int pipeFds[2], failures = 0;
+
+    if (openFake(&vd, pipeFds, "test-latest", V4L2_BUF_TYPE_VIDEO_CAPTURE, V4L2_PIX_FMT_MJPEG, 1, 4) < 0 ||
+        startCapture(&cw, &vd, CAPTURE_LATEST) < 0) {
+        printf("Error: Fake device failed to start capturing\n");
+        return 1;
+    }
+
+    for (unsigned long i = 1; i <= 10; ++i) {
+        fakeFill(1);
+        if (!waitFor([&] { return cw.frames_Captured.load() == i && fakeQueued() == vd.nb_Buffer - 1; })) {
+            printf("Error: Frame %lu left %d of %d buffers queued, %lu captured\n", i, fakeQueued(), vd.nb_Buffer, cw.frames_Captured.load());
+            failures++;
+            break;
+        }
+    }
+    if (popFrame(&cw, &lease, 100) < 0 || lease.sequence != 9 || cw.frames_Dropped != 9) {
+        printf("Error: Popped frame %u with %lu dropped, not the newest of 10\n", lease.sequence, cw.frames_Dropped.load());
+        failures++;
+    }
+
+    // the consumer holds one buffer while it decodes
+    for (unsigned long i = 11; i <= 15; ++i) {
+        fakeFill(1);
+        if (!waitFor([&] { return cw.frames_Captured.load() == i && fakeQueued() == vd.nb_Buffer - 2; })) {
+            printf("Error: Frame %lu left %d of %d buffers queued while one is decoded\n", i, fakeQueued(), vd.nb_Buffer);
+            failures++;
+            break;
+        }
+    }
+    releaseFrame(&vd, &lease);
+    if (popFrame(&cw, &lease, 100) < 0 || lease.sequence != 14 || popFrame(&cw, &spare, 20) == 0) {
+        printf("Error: Popped frame %u, not only the newest of 15\n", lease.sequence);
+        failures++;
+    }
+    releaseFrame(&vd, &lease);
+
+    // a waiting consumer wakes as soon as a frame arrives
+    auto start = std::chrono::steady_clock::now();
+    std::thread filler([] {
+        usleep(20000);
+        fakeFill(1);
+    });
+    int ret = popFrame(&cw, &lease, 2000);
+    auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    filler.join();
+    if (ret < 0 || waited > 1000) {
+        printf("Error: Waiting consumer got a frame after %ld ms\n", (long) waited);
+        failures++;
+    }
+    releaseFrame(&vd, &lease);
+
+    stopCapture(&cw);
+    if (fakeQueued() != vd.nb_Buffer) {
+        printf("Error: %d of %d buffers queued after capture stopped\n", fakeQueued(), vd.nb_Buffer);
+        failures++;
+    }
+    closeFake(&vd, pipeFds);
+    printf("%-40s %s\n", "latest frame capture", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    char cacheDir[] = "/tmp/captureTestXXXXXX";
+    int failures = 0;
+
+    // the format cache goes to a scratch directory, not the user's
+    if (mkdtemp(cacheDir) == nullptr || setenv("XDG_CACHE_HOME", cacheDir, 1) < 0)
+        return 1;
+    failures += checkBufferStats();
+    failures += checkUserPool();
+    failures += checkLeaseRefs();
+    failures += checkNegotiation();
+    failures += checkPlanes();
+    failures += checkLatestCapture();
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+#include "../utils/decoder.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+/**
+  * @brief  Make synthetic jpeg
+  * @note   Gradient plus noise, so every seam between bands and eyes has something to get wrong.
+  * @param  width           int
+  * @param  height          int
+  * @param  vSamp           int, luma v_samp_factor, 2 for 4:2:0 and 1 for 4:2:2
+  * @param  restartRows     int, MCU rows per restart interval, 0 for none
+  * @param  restartMcus     int, MCUs per restart interval, used when restartRows is 0
+  * @retval Compressed jpeg bytes
+**/
+static vector<unsigned char> makeJpeg(int width, int height, int vSamp, int restartRows, int restartMcus) {
+    struct jpeg_compress_struct cinfo {};
+    struct jpeg_error_mgr jErr {};
+    unsigned char *outBuf = nullptr;
+    unsigned long outLen = 0;
+    vector<unsigned char> row(width * 3);
+    unsigned int seed = 7;
+
+    cinfo.err = jpeg_std_error(&jErr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &outBuf, &outLen);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 85, true);
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = vSamp;
+    cinfo.restart_in_rows = restartRows;
+    cinfo.restart_interval = restartRows > 0 ? 0 : restartMcus;
+    jpeg_start_compress(&cinfo, true);
+
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int y = (int) cinfo.next_scanline;
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int) (seed >> 27);
+            row[x * 3 + 0] = (unsigned char) ((x * 255 / width + noise) & 0xff);
+            row[x * 3 + 1] = (unsigned char) ((y * 255 / height + noise) & 0xff);
+            row[x * 3 + 2] = (unsigned char) (((x ^ y) * 4 + noise) & 0xff);
+        }
+        JSAMPROW rowPtr = row.data();
+        jpeg_write_scanlines(&cinfo, &rowPtr, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    vector<unsigned char> jpg(outBuf, outBuf + outLen);
+    free(outBuf);
+    return jpg;
+}
+
+/**
+  * @brief  Check parallel decode
+  * @note   jpegParallelDecode() has to match a single threaded decode byte for byte at every scale.
+  * @param  name    const char *
+  * @param  jpg     Compressed frame
+  * @param  width   int
+  * @param  height  int
+  * @retval Number of failed checks
+**/
+static int checkParallel(const char *name, const vector<unsigned char> &jpg, int width, int height) {
+    struct jpegStream js {};
+    struct jpegParallel jp {};
+    int failures = 0;
+
+    jpegStreamInit(&js);
+    jpegParallelInit(&jp, 4);
+    for (int scale : {1, 2, 4, 8}) {
+        size_t size = (size_t) jpegScaledSize(width, scale) * jpegScaledSize(height, scale) * 3;
+        vector<unsigned char> full(size, 0), sliced(size, 0xaa);
+
+        js.scale_Denom = scale;
+        jp.scale_Denom = scale;
+        if (jpegStreamDecode(&js, jpg.data(), (int) jpg.size(), full.data(), 0) < 0 ||
+            jpegParallelDecode(&jp, jpg.data(), (int) jpg.size(), sliced.data(), 0) < 0) {
+            printf("Error: %s 1/%d failed to decode\n", name, scale);
+            failures++;
+        } else if (full != sliced) {
+            size_t first = 0;
+            while (full[first] == sliced[first])
+                first++;
+            printf("Error: %s 1/%d differs from a full decode at row %zu\n", name, scale, first / (size / jpegScaledSize(height, scale)));
+            failures++;
+        }
+    }
+    jpegParallelFree(&jp);
+    jpegStreamFree(&js);
+    printf("%-40s %s\n", name, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check stereo decode
+  * @note   Frames split on restart segments or cropped per eye have to match jpegStreamDecodeCrop() of each eye,
+  *         frames decoded in one pass the halves of a full decode. The frame has to take the expected path, and all
+  *         run on the same decoder so switching sources is covered.
+  * @param  jst     struct jpegStereo, shared by every call
+  * @param  name    const char *
+  * @param  jpg     Compressed frame
+  * @param  width   int, even
+  * @param  height  int
+  * @param  path    int, JPEG_STEREO_SPLIT if the frame's restart intervals allow a split, otherwise JPEG_STEREO_CROP
+  *                 or JPEG_STEREO_SERIAL for the decoder with and without a second core
+  * @retval Number of failed checks
+**/
+static int checkStereo(struct jpegStereo *jst, const char *name, const vector<unsigned char> &jpg, int width, int height, int path) {
+    struct jpegStream js {};
+    int failures = 0;
+
+    jpegStreamInit(&js);
+    jpegStereoInit(jst);
+    jst->is_Concurrent = path != JPEG_STEREO_SERIAL;
+    for (int scale : {1, 2, 4, 8}) {
+        int fullW = jpegScaledSize(width, scale), eyeW = fullW / 2, eyeH = jpegScaledSize(height, scale);
+        vector<unsigned char> eyes[2], refs[2], full((size_t) fullW * eyeH * 3);
+
+        js.scale_Denom = scale;
+        jst->scale_Denom = scale;
+        for (int eye = 0; eye < 2; ++eye) {
+            eyes[eye].assign((size_t) eyeW * eyeH * 3, 0xaa);
+            refs[eye].assign((size_t) eyeW * eyeH * 3, 0);
+            if (path != JPEG_STEREO_SERIAL) {
+                jpegStreamDecodeCrop(&js, jpg.data(), (int) jpg.size(), eye, 2, refs[eye].data(), 0);
+                continue;
+            }
+            jpegStreamDecode(&js, jpg.data(), (int) jpg.size(), full.data(), 0);
+            for (int y = 0; y < eyeH; ++y)
+                memcpy(refs[eye].data() + (size_t) y * eyeW * 3, full.data() + ((size_t) y * fullW + eye * eyeW) * 3, (size_t) eyeW * 3);
+        }
+        jst->last_Path = -1;
+        if (jpegStereoDecode(jst, jpg.data(), (int) jpg.size(), eyes[0].data(), eyes[1].data(), 0) < 0) {
+            printf("Error: %s 1/%d failed to decode\n", name, scale);
+            failures++;
+        } else if (jst->last_Path != path) {
+            printf("Error: %s 1/%d took path %d, expected %d\n", name, scale, jst->last_Path, path);
+            failures++;
+        } else if (eyes[0] != refs[0] || eyes[1] != refs[1]) {
+            printf("Error: %s 1/%d differs from the reference in the %s eye\n", name, scale, eyes[0] != refs[0] ? "left" : "right");
+            failures++;
+        }
+    }
+    jpegStreamFree(&js);
+    printf("%-40s %s\n", name, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check truncated headers
+  * @note   Frames cut inside the DRI or SOS marker must be rejected without reading past the end.
+  * @retval Number of failed checks
+**/
+static int checkTruncated() {
+    vector<unsigned char> jpg = makeJpeg(64, 32, 2, 1, 0);
+    struct jpegParallel jp {};
+    vector<unsigned char> rgb(64 * 32 * 3);
+    int failures = 0;
+
+    jpegParallelInit(&jp, 2);
+    for (unsigned char marker : {0xdd, 0xda}) {
+        size_t pos = 2;
+        while (pos + 4 <= jpg.size() && jpg[pos + 1] != marker)
+            pos += 2 + ((jpg[pos + 2] << 8) | jpg[pos + 3]);
+        for (size_t cut = pos + 2; cut <= pos + 5; ++cut) {
+            vector<unsigned char> part(jpg.begin(), jpg.begin() + cut);
+            if (jpegParallelDecode(&jp, part.data(), (int) part.size(), rgb.data(), 0) == 0) {
+                printf("Error: Frame cut at %zu inside marker %02x decoded\n", cut, marker);
+                failures++;
+            }
+        }
+    }
+    jpegParallelFree(&jp);
+    printf("%-40s %s\n", "truncated DRI and SOS", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    struct jpegStereo jst {};
+    int failures = 0;
+
+    failures += checkParallel("4:2:0, DRI 1 row", makeJpeg(1920, 1080, 2, 1, 0), 1920, 1080);
+    failures += checkParallel("4:2:0, DRI 1 row, odd size", makeJpeg(1000, 566, 2, 1, 0), 1000, 566);
+    failures += checkParallel("4:2:0, DRI 40 MCUs", makeJpeg(1280, 720, 2, 0, 40), 1280, 720);
+    failures += checkParallel("4:2:0, DRI 7 MCUs", makeJpeg(640, 480, 2, 0, 7), 640, 480);
+    failures += checkParallel("4:2:2, DRI 1 row", makeJpeg(1920, 1080, 1, 1, 0), 1920, 1080);
+    failures += checkParallel("4:2:2, no DRI", makeJpeg(640, 480, 1, 0, 0), 640, 480);
+    failures += checkStereo(&jst, "stereo 4:2:2, DRI half row", makeJpeg(1920, 1080, 1, 0, 60), 1920, 1080, JPEG_STEREO_SPLIT);
+    failures += checkStereo(&jst, "stereo 4:2:0, DRI 30 MCUs", makeJpeg(1920, 1080, 2, 0, 30), 1920, 1080, JPEG_STEREO_SPLIT);
+    failures += checkStereo(&jst, "stereo 4:2:2, DRI 1 row", makeJpeg(1920, 1080, 1, 1, 0), 1920, 1080, JPEG_STEREO_CROP);
+    failures += checkStereo(&jst, "stereo 4:2:0, split again", makeJpeg(2560, 720, 2, 0, 8), 2560, 720, JPEG_STEREO_SPLIT);
+    failures += checkStereo(&jst, "stereo 4:2:0, no DRI", makeJpeg(1280, 720, 2, 0, 0), 1280, 720, JPEG_STEREO_CROP);
+    failures += checkStereo(&jst, "stereo 4:2:0, no DRI, one core", makeJpeg(1280, 720, 2, 0, 0), 1280, 720, JPEG_STEREO_SERIAL);
+    jpegStereoFree(&jst);
+    failures += checkTruncated();
+
+    return failures == 0 ? 0 : 1;
+}
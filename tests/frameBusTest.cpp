@@ -0,0 +1,208 @@
+#include "../utils/frameBus.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define BUS_FRAMES 400
+#define BUS_SLOTS 4
+#define BUS_READERS 3
+#define BUS_FRAME_BASE (4 << 20)
+#define BUS_FRAME_STEP 1000
+
+struct busReaderResult {
+    unsigned long read;
+    unsigned long torn;
+    unsigned long out_Of_Order;
+    unsigned long skipped;
+    unsigned long missed;
+    int last;
+};
+
+/**
+  * @brief  Fill frame
+  * @note   Every byte carries the frame number, so any mix of two frames is visible wherever it happens
+  * @param  frame   vector, resized to a size that varies with the number
+  * @param  number  uint64_t
+  * @retval None
+**/
+static void fillFrame(vector<unsigned char> &frame, uint64_t number) {
+    frame.resize(BUS_FRAME_BASE + (size_t) (number % 7) * BUS_FRAME_STEP);
+    memset(frame.data(), (int) (number * 31 & 0xff), frame.size());
+    memcpy(frame.data(), &number, sizeof(number));
+    memcpy(frame.data() + frame.size() - sizeof(number), &number, sizeof(number));
+}
+
+/**
+  * @brief  Frame intact
+  * @param  f   struct frameBusFrame
+  * @retval true    If every byte belongs to the frame the header names
+**/
+static bool isIntact(const struct frameBusFrame &f) {
+    uint64_t first, last;
+
+    if (f.size != BUS_FRAME_BASE + (f.frame % 7) * BUS_FRAME_STEP || f.sequence != (uint32_t) f.frame || f.timestamp_Us != (int64_t) f.frame * 1000)
+        return false;
+    memcpy(&first, f.data, sizeof(first));
+    memcpy(&last, f.data + f.size - sizeof(last), sizeof(last));
+    if (first != f.frame || last != f.frame)
+        return false;
+    for (uint32_t i = sizeof(first); i < f.size - sizeof(last); ++i) {
+        if (f.data[i] != (unsigned char) (f.frame * 31))
+            return false;
+    }
+    return true;
+}
+
+/**
+  * @brief  Run reader
+  * @note   Waits for frames until the bus closes, checking each one and the gaps between them. Slow readers stall
+  *         now and then so the publisher laps them.
+  * @param  fr      struct frameBusReader
+  * @param  slow    bool
+  * @param  res     struct busReaderResult
+  * @retval None
+**/
+static void runReader(struct frameBusReader *fr, bool slow, struct busReaderResult *res) {
+    struct frameBusFrame f {};
+    uint64_t expected = 0;
+    int ret;
+
+    while ((ret = frameBusWait(fr, &f, 1000)) >= 0) {
+        if (ret == 0)
+            continue;
+        if (!isIntact(f))
+            res->torn++;
+        if (f.frame < expected)
+            res->out_Of_Order++;
+        else
+            res->skipped += f.frame - expected;
+        expected = f.frame + 1;
+        res->read++;
+        if (slow && res->read % 64 == 0)
+            this_thread::sleep_for(chrono::microseconds(500));
+    }
+    res->skipped += BUS_FRAMES - expected;
+    res->missed = fr->frames_Missed;
+    res->last = ret;
+}
+
+/**
+  * @brief  Check concurrent readers
+  * @note   One publisher, a fast and two slow readers on a small ring. No reader may accept a torn frame, frames
+  *         come in order, every frame is either read or counted as missed, and exactly the skipped ones are missed.
+  * @note   Frames are large enough that copies get preempted halfway even on a single core, so a reader that
+  *         skipped the seqlock check would accept torn frames here.
+  * @param  name    const char *, shm name
+  * @retval Number of failed checks
+**/
+static int checkReaders(const char *name) {
+    struct frameBusWriter fw {};
+    struct frameBusReader fr[BUS_READERS] {};
+    struct busReaderResult res[BUS_READERS] {};
+    vector<thread> threads;
+    vector<unsigned char> frame;
+    int failures = 0;
+
+    if (frameBusCreate(&fw, name, V4L2_PIX_FMT_MJPEG, 0, 0, BUS_FRAME_BASE + 6 * BUS_FRAME_STEP, BUS_SLOTS) < 0)
+        return 1;
+    for (int r = 0; r < BUS_READERS; ++r) {
+        if (frameBusAttach(&fr[r], name) < 0) {
+            frameBusDestroy(&fw);
+            return 1;
+        }
+        threads.emplace_back(runReader, &fr[r], r > 0, &res[r]);
+    }
+    for (uint64_t n = 0; n < BUS_FRAMES; ++n) {
+        fillFrame(frame, n);
+        const void *parts[2] = {frame.data(), frame.data() + 100};
+        size_t sizes[2] = {100, frame.size() - 100};
+        frameBusPublish(&fw, parts, sizes, 2, (uint32_t) n, (int64_t) n * 1000);
+        if (n % 256 == 0)
+            this_thread::sleep_for(chrono::microseconds(200));
+    }
+    frameBusDestroy(&fw);
+    for (auto &t : threads)
+        t.join();
+
+    for (int r = 0; r < BUS_READERS; ++r) {
+        if (res[r].torn > 0 || res[r].out_Of_Order > 0 || res[r].skipped != res[r].missed || res[r].read + res[r].missed != BUS_FRAMES ||
+            res[r].last != -1 || res[r].read == 0) {
+            printf("Error: Reader %d read %lu, %lu torn, %lu out of order, %lu skipped but %lu reported missed, last wait %d\n", r,
+                   res[r].read, res[r].torn, res[r].out_Of_Order, res[r].skipped, res[r].missed, res[r].last);
+            failures++;
+        }
+        frameBusDetach(&fr[r]);
+    }
+    if (res[1].missed + res[2].missed == 0) {
+        printf("Error: Slow readers were never lapped, the ring is not exercised\n");
+        failures++;
+    }
+    printf("%-40s %s\n", "concurrent readers, torn and missed", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check wait
+  * @note   A blocked reader has to time out on an idle bus, wake for a frame well before its timeout and return -1
+  *         as soon as the bus is destroyed.
+  * @param  name    const char *, shm name
+  * @retval Number of failed checks
+**/
+static int checkWait(const char *name) {
+    struct frameBusWriter fw {};
+    struct frameBusReader fr {};
+    struct frameBusFrame f {};
+    vector<unsigned char> frame;
+    atomic<int> ret{-2};
+    int failures = 0;
+
+    if (frameBusCreate(&fw, name, V4L2_PIX_FMT_MJPEG, 0, 0, BUS_FRAME_BASE + 6 * BUS_FRAME_STEP, BUS_SLOTS) < 0 || frameBusAttach(&fr, name) < 0)
+        return 1;
+
+    auto start = chrono::steady_clock::now();
+    if (frameBusWait(&fr, &f, 50) != 0 || chrono::steady_clock::now() - start < chrono::milliseconds(50)) {
+        printf("Error: Wait on an idle bus did not time out after 50 ms\n");
+        failures++;
+    }
+
+    for (int round = 0; round < 2; ++round) {
+        ret = -2;
+        thread reader([&] { ret = frameBusWait(&fr, &f, 5000); });
+        this_thread::sleep_for(chrono::milliseconds(20));
+        start = chrono::steady_clock::now();
+        if (round == 0) {
+            fillFrame(frame, 0);
+            const void *parts[1] = {frame.data()};
+            size_t sizes[1] = {frame.size()};
+            frameBusPublish(&fw, parts, sizes, 1, 0, 0);
+        } else {
+            frameBusDestroy(&fw);
+        }
+        reader.join();
+        auto waited = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+        if (ret != (round == 0 ? 1 : -1) || waited > 1000) {
+            printf("Error: Blocked reader returned %d after %lld ms on %s\n", ret.load(), (long long) waited, round == 0 ? "publish" : "destroy");
+            failures++;
+        }
+    }
+    frameBusDetach(&fr);
+    printf("%-40s %s\n", "wait wakes on publish and destroy", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    char name[32];
+    int failures = 0;
+
+    snprintf(name, sizeof(name), "/usbCamTest%d", (int) getpid());
+    failures += checkWait(name);
+    failures += checkReaders(name);
+
+    return failures == 0 ? 0 : 1;
+}
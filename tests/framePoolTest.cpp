@@ -0,0 +1,230 @@
+#include "../utils/framePool.h"
+#include "../utils/tripleBuffer.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define TEST_FRAME_SIZE 1000
+#define TEST_FRAMES 4
+#define TEST_FLOW_FRAMES 20000
+
+static_assert(!std::is_copy_constructible<videoFrame>::value, "videoFrame must not be copyable");
+static_assert(!std::is_copy_assignable<videoFrame>::value, "videoFrame must not be copy assignable");
+static_assert(std::is_nothrow_move_constructible<videoFrame>::value, "videoFrame must be movable");
+static_assert(std::is_nothrow_move_assignable<videoFrame>::value, "videoFrame must be move assignable");
+
+/**
+  * @brief  Check move-only ownership
+  * @note   A move hands over the slot and the metadata and leaves the source empty, moving onto a frame that
+  *         holds a slot gives that slot back. Nothing may ever count as in use twice.
+  * @retval Number of failed checks
+**/
+static int checkMoves() {
+    struct framePool fp {};
+    int failures = 0;
+
+    framePoolInit(&fp, TEST_FRAME_SIZE, TEST_FRAMES);
+    {
+        videoFrame a, b;
+        if (framePoolAcquire(&fp, a) < 0 || framePoolAcquire(&fp, b) < 0) {
+            printf("Error: Acquire failed on a fresh pool\n");
+            failures++;
+        }
+        if (a.capacity() < TEST_FRAME_SIZE || (uintptr_t) a.data() % FRAMEPOOL_ALIGN != 0 || a.data() == b.data()) {
+            printf("Error: Frames are %zu bytes at %p and %p\n", a.capacity(), (void *) a.data(), (void *) b.data());
+            failures++;
+        }
+
+        unsigned char *storage = a.data();
+        a.sequence = 42;
+        a.size = 100;
+        videoFrame c(std::move(a));
+        if (a || a.data() != nullptr || a.size != 0 || c.data() != storage || c.sequence != 42 || c.size != 100) {
+            printf("Error: Move construct left source %p, target %p sequence %u\n", (void *) a.data(), (void *) c.data(), c.sequence);
+            failures++;
+        }
+
+        // b's old slot has to come back when c is moved onto it
+        b = std::move(c);
+        if (c || b.data() != storage || fp.in_Use != 1) {
+            printf("Error: Move assign left %d frames in use, expected 1\n", fp.in_Use);
+            failures++;
+        }
+        b = std::move(b);
+        if (b.data() != storage || fp.in_Use != 1) {
+            printf("Error: Self move lost the slot\n");
+            failures++;
+        }
+
+        // acquiring into a frame that already holds a slot keeps it
+        if (framePoolAcquire(&fp, b) < 0 || b.data() != storage || fp.in_Use != 1) {
+            printf("Error: Reacquire changed the slot or took another one\n");
+            failures++;
+        }
+    }
+    if (fp.in_Use != 0 || framePoolFree(&fp) < 0) {
+        printf("Error: %d frames still out after scope exit\n", fp.in_Use);
+        failures++;
+    }
+    printf("%-40s %s\n", "move-only ownership", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check exhaustion
+  * @note   One acquire past the pool size fails without touching the frame, a reset makes room again and the pool
+  *         refuses to be freed while anything is out
+  * @retval Number of failed checks
+**/
+static int checkExhaustion() {
+    struct framePool fp {};
+    videoFrame frames[TEST_FRAMES + 1];
+    int failures = 0;
+
+    framePoolInit(&fp, TEST_FRAME_SIZE, TEST_FRAMES);
+    for (int i = 0; i < TEST_FRAMES; ++i) {
+        if (framePoolAcquire(&fp, frames[i]) < 0) {
+            printf("Error: Acquire %d of %d failed\n", i + 1, TEST_FRAMES);
+            failures++;
+        }
+    }
+    if (framePoolAcquire(&fp, frames[TEST_FRAMES]) == 0 || frames[TEST_FRAMES]) {
+        printf("Error: Acquire past %d frames succeeded\n", TEST_FRAMES);
+        failures++;
+    }
+    if (framePoolFree(&fp) == 0) {
+        printf("Error: Pool freed with frames out\n");
+        failures++;
+    }
+
+    unsigned char *storage = frames[1].data();
+    frames[1].reset();
+    if (framePoolAcquire(&fp, frames[TEST_FRAMES]) < 0 || frames[TEST_FRAMES].data() != storage) {
+        printf("Error: Reset slot was not handed out again\n");
+        failures++;
+    }
+    if (fp.in_Use != TEST_FRAMES || fp.max_In_Use != TEST_FRAMES) {
+        printf("Error: %d in use, %d at most, expected %d\n", fp.in_Use, fp.max_In_Use, TEST_FRAMES);
+        failures++;
+    }
+    for (videoFrame &frame : frames)
+        frame.reset();
+    if (framePoolFree(&fp) < 0)
+        failures++;
+    printf("%-40s %s\n", "pool exhaustion", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check cross-thread release
+  * @note   Frames acquired here are moved into other threads and dropped there, every slot has to come back
+  * @retval Number of failed checks
+**/
+static int checkCrossThread() {
+    struct framePool fp {};
+    std::vector<std::thread> threads;
+    int failures = 0;
+
+    framePoolInit(&fp, TEST_FRAME_SIZE, TEST_FRAMES);
+    for (int round = 0; round < 1000 && failures == 0; ++round) {
+        for (int i = 0; i < TEST_FRAMES; ++i) {
+            videoFrame frame;
+            if (framePoolAcquire(&fp, frame) < 0) {
+                printf("Error: Acquire failed in round %d, %d frames in use\n", round, fp.in_Use);
+                failures++;
+                break;
+            }
+            frame.data()[0] = (unsigned char) i;
+            threads.emplace_back([f = std::move(frame)]() mutable { f.reset(); });
+        }
+        for (std::thread &t : threads)
+            t.join();
+        threads.clear();
+        if (fp.in_Use != 0) {
+            printf("Error: %d frames in use after other threads reset them\n", fp.in_Use);
+            failures++;
+        }
+    }
+    if (framePoolFree(&fp) < 0)
+        failures++;
+    printf("%-40s %s\n", "release from another thread", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+/**
+  * @brief  Check frame flow
+  * @note   Same hand-off as the preview: a writer acquires a frame per capture and publishes it through a
+  *         tripleBuffer, the reader resets what it takes. Three frames are enough and the reader never sees a
+  *         frame that was given back or reused underneath it.
+  * @retval Number of failed checks
+**/
+static int checkFlow() {
+    struct framePool fp {};
+    tripleBuffer<videoFrame> buf;
+    std::atomic<bool> isDone{false};
+    std::atomic<int> acquireFailures{0};
+    int failures = 0, seen = 0;
+    unsigned int last = 0;
+
+    framePoolInit(&fp, TEST_FRAME_SIZE, 3);
+    std::thread writer([&]() {
+        for (unsigned int seq = 1; seq <= TEST_FLOW_FRAMES; ++seq) {
+            videoFrame frame;
+            if (framePoolAcquire(&fp, frame) < 0) {
+                acquireFailures++;
+                continue;
+            }
+            memset(frame.data(), seq & 0xff, TEST_FRAME_SIZE);
+            frame.sequence = seq;
+            buf.back() = std::move(frame);
+            buf.publish();
+            buf.back().reset();
+        }
+        isDone = true;
+    });
+    for (;;) {
+        bool wasDone = isDone;
+        if (!buf.acquire()) {
+            if (wasDone)
+                break;
+            std::this_thread::yield();
+            continue;
+        }
+        videoFrame &front = buf.front();
+        if (front.sequence <= last)
+            failures++;
+        for (int i = 0; i < TEST_FRAME_SIZE; i += 97) {
+            if (front.data()[i] != (front.sequence & 0xff)) {
+                failures++;
+                break;
+            }
+        }
+        last = front.sequence;
+        seen++;
+        front.reset();
+    }
+    writer.join();
+    if (failures > 0 || acquireFailures > 0 || fp.in_Use != 0 || fp.max_In_Use > 3 || seen == 0) {
+        printf("Error: %d bad frames, %d acquire failures, %d in use, %d at most, %d seen\n", failures, acquireFailures.load(), fp.in_Use, fp.max_In_Use, seen);
+        failures++;
+    }
+    if (framePoolFree(&fp) < 0)
+        failures++;
+    printf("%-40s %s\n", "frame flow through tripleBuffer", failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+
+    failures += checkMoves();
+    failures += checkExhaustion();
+    failures += checkCrossThread();
+    failures += checkFlow();
+
+    return failures == 0 ? 0 : 1;
+}
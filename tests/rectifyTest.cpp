@@ -0,0 +1,179 @@
+#include "../rectify/rectify.h"
+#include <cstdio>
+#include <cstdlib>
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/**
+  * @brief  Write synthetic calibration
+  * @note   Two slightly different cameras with distortion, a small rotation and a 60 mm baseline, stored the way
+  *         the calibration tool does at the given eye size. No rectification is stored, so rectifierInit() has to
+  *         run stereoRectify() itself.
+  * @param  path    const char *
+  * @param  eyeSize cv::Size
+  * @retval 0       If file written
+**/
+static int writeCalibration(const char *path, cv::Size eyeSize) {
+    double fx = eyeSize.width * 0.9;
+    cv::Mat M1 = (cv::Mat_<double>(3, 3) << fx, 0, eyeSize.width * 0.51, 0, fx * 1.001, eyeSize.height * 0.48, 0, 0, 1);
+    cv::Mat M2 = (cv::Mat_<double>(3, 3) << fx * 0.98, 0, eyeSize.width * 0.49, 0, fx * 0.982, eyeSize.height * 0.51, 0, 0, 1);
+    cv::Mat D1 = (cv::Mat_<double>(1, 5) << 0.02, -0.05, 0.001, 0.0015, 0.01);
+    cv::Mat D2 = (cv::Mat_<double>(1, 5) << 0.021, -0.066, -0.001, 0.0005, 0.025);
+    cv::Mat rvec = (cv::Mat_<double>(3, 1) << 0.002, -0.024, 0.0017), R;
+    cv::Mat T = (cv::Mat_<double>(3, 1) << -60.4, -0.22, 0.012);
+    cv::FileStorage fs(path, cv::FileStorage::WRITE);
+
+    if (!fs.isOpened())
+        return -1;
+    cv::Rodrigues(rvec, R);
+    fs << "M1" << M1 << "D1" << D1 << "M2" << M2 << "D2" << D2 << "R" << R << "T" << T << "imgSize" << eyeSize;
+    return 0;
+}
+
+/**
+  * @brief  Make synthetic side-by-side frame
+  * @note   Gradients across both eyes plus a little noise, so a swapped eye, a shifted band or a wrong pitch all show
+  *         up. No hard edges, so fixed-point and floating point interpolation stay within a level of each other.
+  * @param  width   int, both eyes
+  * @param  height  int
+  * @retval RGB24 frame
+**/
+static cv::Mat makeFrame(int width, int height) {
+    cv::Mat frame(height, width, CV_8UC3);
+    unsigned int seed = 3;
+
+    for (int y = 0; y < height; ++y) {
+        unsigned char *row = frame.ptr<unsigned char>(y);
+        for (int x = 0; x < width; ++x) {
+            seed = seed * 1103515245 + 12345;
+            int noise = (int) (seed >> 29);
+            row[x * 3 + 0] = (unsigned char) (x * 240 / width + noise);
+            row[x * 3 + 1] = (unsigned char) (y * 240 / height + noise);
+            row[x * 3 + 2] = (unsigned char) ((x + 2 * y) * 240 / (width + 2 * height) + noise);
+        }
+    }
+    return frame;
+}
+
+/**
+  * @brief  Reference remap
+  * @note   cv::remap() of each eye on its own with the same calibration, either with the fixed-point tables
+  *         rectifierApply() uses or with exact floating point ones
+  * @param  path    const char *, calibration
+  * @param  src     Side-by-side frame
+  * @param  mapType int, CV_16SC2 or CV_32FC1
+  * @retval Rectified side-by-side frame
+**/
+static cv::Mat referenceRemap(const char *path, const cv::Mat &src, int mapType) {
+    struct stereoCalibration sc;
+    cv::Size eyeSize(src.cols / 2, src.rows);
+    cv::Mat rect[2], proj[2], Q, dst(src.size(), CV_8UC3, cv::Scalar::all(0));
+
+    loadCalibration(&sc, path);
+    cv::stereoRectify(sc.K[0], sc.D[0], sc.K[1], sc.D[1], eyeSize, sc.R, sc.T, rect[0], rect[1], proj[0], proj[1], Q,
+                      cv::CALIB_ZERO_DISPARITY, 0, eyeSize);
+    for (int eye = 0; eye < 2; ++eye) {
+        cv::Mat map1, map2, out;
+        cv::initUndistortRectifyMap(sc.K[eye], sc.D[eye], rect[eye], proj[eye], eyeSize, mapType, map1, map2);
+        cv::remap(src(cv::Rect(eye * eyeSize.width, 0, eyeSize.width, eyeSize.height)), out, map1, map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+        out.copyTo(dst(cv::Rect(eye * eyeSize.width, 0, eyeSize.width, eyeSize.height)));
+    }
+    return dst;
+}
+
+/**
+  * @brief  Check rectification
+  * @note   rectifierApply() has to match cv::remap() of each eye with the same fixed-point tables exactly, whatever
+  *         the band split and pitches, and stay within FLOAT_TOLERANCE of a floating point remap
+  * @param  name        const char *
+  * @param  path        const char *, calibration or remap tables
+  * @param  calibPath   const char *, calibration the reference is built from
+  * @param  eyeSize     cv::Size
+  * @param  threads     int
+  * @retval Number of failed checks
+**/
+static int checkRectify(const char *name, const char *path, const char *calibPath, cv::Size eyeSize, int threads) {
+    const int FLOAT_TOLERANCE = 2;
+    struct stereoRectifier sr {};
+    int width = eyeSize.width * 2, failures = 0;
+    int srcPitch = width * 3 + 48, dstPitch = width * 3 + 96;
+    cv::Mat src = makeFrame(width, eyeSize.height);
+    vector<unsigned char> srcBuf((size_t) srcPitch * eyeSize.height), dstBuf((size_t) dstPitch * eyeSize.height, 0xaa);
+    cv::Mat srcView(eyeSize.height, width, CV_8UC3, srcBuf.data(), srcPitch);
+    cv::Mat dst(eyeSize.height, width, CV_8UC3, dstBuf.data(), dstPitch);
+
+    src.copyTo(srcView);
+    if (rectifierInit(&sr, path, width, eyeSize.height, threads) < 0 || rectifierApply(&sr, srcBuf.data(), srcPitch, dstBuf.data(), dstPitch) < 0) {
+        printf("Error: %s failed to rectify\n", name);
+        rectifierFree(&sr);
+        printf("%-40s %s\n", name, "FAILED");
+        return 1;
+    }
+    rectifierFree(&sr);
+
+    cv::Mat fixedRef = referenceRemap(calibPath, src, CV_16SC2), floatRef = referenceRemap(calibPath, src, CV_32FC1);
+    for (int eye = 0; eye < 2; ++eye) {
+        cv::Rect half(eye * eyeSize.width, 0, eyeSize.width, eyeSize.height);
+        double fixedDiff = cv::norm(dst(half), fixedRef(half), cv::NORM_INF);
+        double floatDiff = cv::norm(dst(half), floatRef(half), cv::NORM_INF);
+        if (fixedDiff != 0 || floatDiff > FLOAT_TOLERANCE) {
+            printf("Error: %s %s eye differs from cv::remap by %.0f (fixed point) and %.0f (floating point)\n", name,
+                   eye == 0 ? "left" : "right", fixedDiff, floatDiff);
+            failures++;
+        }
+    }
+    for (int y = 0; y < eyeSize.height && failures == 0; ++y) {
+        for (int x = width * 3; x < dstPitch; ++x) {
+            if (dstBuf[(size_t) y * dstPitch + x] != 0xaa) {
+                printf("Error: %s wrote into the row padding at row %d\n", name, y);
+                failures++;
+                break;
+            }
+        }
+    }
+    printf("%-40s %s\n", name, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    char dir[] = "/tmp/rectifyTestXXXXXX";
+    int failures = 0;
+
+    if (mkdtemp(dir) == nullptr)
+        return 1;
+    string calibPath = string(dir) + "/intrinsics.yml", lutPath = string(dir) + "/remap.lut";
+    cv::Size eyeSize(333, 250);
+    if (writeCalibration(calibPath.c_str(), eyeSize) < 0)
+        return 1;
+
+    failures += checkRectify("rectify 333x250, one thread", calibPath.c_str(), calibPath.c_str(), eyeSize, 1);
+    failures += checkRectify("rectify 333x250, 3 threads", calibPath.c_str(), calibPath.c_str(), eyeSize, 3);
+    failures += checkRectify("rectify 333x250, 64 threads", calibPath.c_str(), calibPath.c_str(), eyeSize, 64);
+
+    // the same tables through a mapped .lut file
+    struct stereoCalibration sc;
+    cv::Mat xy[2], frac[2];
+    if (loadCalibration(&sc, calibPath.c_str()) < 0 || computeRemap(&sc, eyeSize, xy, frac) < 0 ||
+        writeRemapLut(lutPath.c_str(), calibrationHash(&sc, eyeSize), xy, frac) < 0)
+        failures++;
+    failures += checkRectify("rectify 333x250, mapped tables", lutPath.c_str(), calibPath.c_str(), eyeSize, 3);
+
+    // calibrated at 332x250 and rectified at half that through scaled intrinsics, which come out exactly as if
+    // calibrated at 166x125
+    string fullPath = string(dir) + "/full.yml", halfPath = string(dir) + "/half.yml";
+    if (writeCalibration(fullPath.c_str(), cv::Size(332, 250)) < 0 || writeCalibration(halfPath.c_str(), cv::Size(166, 125)) < 0)
+        return 1;
+    failures += checkRectify("rectify 166x125, scaled calibration", fullPath.c_str(), halfPath.c_str(), cv::Size(166, 125), 2);
+
+    remove(lutPath.c_str());
+    remove(calibPath.c_str());
+    remove(fullPath.c_str());
+    remove(halfPath.c_str());
+    rmdir(dir);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+#include "../utils/yuyv.h"
+#include <cstdio>
+#include <cstring>
+#include <linux/videodev2.h>
+#include <vector>
+
+using namespace std;
+
+#define YUYV_TEST_HEIGHT 3
+#define YUYV_TEST_PAD 64
+#define YUYV_TEST_GUARD 0xa5
+
+/**
+  * @brief  Make random packed YUV
+  * @note   Every byte value shows up, so both clamps and every chroma sign are hit. Row padding is filled too.
+  * @param  pitch   int, bytes per row
+  * @param  height  int
+  * @param  seed    unsigned int
+  * @retval Packed bytes
+**/
+static vector<unsigned char> makeRandomYuv(int pitch, int height, unsigned int seed) {
+    vector<unsigned char> yuv((size_t) pitch * height);
+
+    for (auto &byte : yuv) {
+        seed = seed * 1103515245 + 12345;
+        byte = (unsigned char) (seed >> 23);
+    }
+    return yuv;
+}
+
+/**
+  * @brief  Check kernel
+  * @note   The kernel has to produce the same bytes as the scalar one for every width, and must not write past
+  *         width pixels into the row padding, which is where the AVX2 RGB24 stores overhang and the SSE2 and
+  *         scalar tails take over.
+  * @param  kernel  enum yuyvKernel
+  * @param  format  unsigned int, V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+  * @param  output  enum yuyvOutput
+  * @retval Number of failed checks
+**/
+static int checkKernel(int kernel, unsigned int format, int output) {
+    static const int WIDTHS[] = {2, 4, 6, 8, 14, 16, 18, 30, 32, 34, 48, 50, 64, 66, 98, 130, 1918, 1920};
+    int bpp = output == YUYV_OUT_BGRA ? 4 : 3, failures = 0;
+    char name[48];
+
+    snprintf(name, sizeof(name), "%s %s to %s", yuyvKernelName(kernel), format == V4L2_PIX_FMT_UYVY ? "UYVY" : "YUYV",
+             output == YUYV_OUT_BGRA ? "BGRA" : "RGB24");
+    if (!yuyvKernelAvailable(kernel)) {
+        printf("%-40s %s\n", name, "skipped");
+        return 0;
+    }
+    for (int width : WIDTHS) {
+        int srcPitch = width * 2 + YUYV_TEST_PAD, dstPitch = width * bpp + YUYV_TEST_PAD;
+        vector<unsigned char> src = makeRandomYuv(srcPitch, YUYV_TEST_HEIGHT, (unsigned int) width);
+        vector<unsigned char> ref((size_t) dstPitch * YUYV_TEST_HEIGHT, YUYV_TEST_GUARD), out(ref.size(), YUYV_TEST_GUARD);
+
+        if (yuyvConvert(src.data(), srcPitch, format, ref.data(), dstPitch, output, width, YUYV_TEST_HEIGHT, YUYV_KERNEL_SCALAR) < 0 ||
+            yuyvConvert(src.data(), srcPitch, format, out.data(), dstPitch, output, width, YUYV_TEST_HEIGHT, kernel) < 0) {
+            printf("Error: %s failed at width %d\n", name, width);
+            failures++;
+            continue;
+        }
+        for (int y = 0; y < YUYV_TEST_HEIGHT; ++y) {
+            const unsigned char *refRow = ref.data() + (size_t) y * dstPitch, *outRow = out.data() + (size_t) y * dstPitch;
+            int x = width * bpp;
+            while (x < dstPitch && refRow[x] == YUYV_TEST_GUARD)
+                x++;
+            if (x < dstPitch) {
+                printf("Error: %s width %d row %d, the scalar reference wrote past the row\n", name, width, y);
+                failures++;
+                break;
+            }
+            x = 0;
+            while (x < dstPitch && refRow[x] == outRow[x])
+                x++;
+            if (x == dstPitch)
+                continue;
+            if (x < width * bpp)
+                printf("Error: %s width %d row %d pixel %d differs from scalar\n", name, width, y, x / bpp);
+            else
+                printf("Error: %s width %d row %d wrote into the row padding at byte %d\n", name, width, y, x - width * bpp);
+            failures++;
+            break;
+        }
+    }
+    printf("%-40s %s\n", name, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main() {
+    int failures = 0;
+
+    for (int kernel : {YUYV_KERNEL_SCALAR, YUYV_KERNEL_SSE2, YUYV_KERNEL_AVX2}) {
+        for (unsigned int format : {V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_UYVY}) {
+            for (int output : {YUYV_OUT_RGB24, YUYV_OUT_BGRA})
+                failures += checkKernel(kernel, format, output);
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
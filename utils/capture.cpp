@@ -0,0 +1,170 @@
+#include "capture.h"
+#include <algorithm>
+#include <chrono>
+
+/**
+  * @brief  Hand frame to consumer
+  * @note   CAPTURE_LATEST keeps a single frame: a newer one replaces it and the old lease goes straight back to the
+  *         driver, so a slow consumer never holds more than one buffer waiting on top of the one it decodes.
+  * @note   CAPTURE_ALL queues into the ring and waits for the consumer when it is full.
+  * @param  cw      struct captureWorker
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+static void handFrame(struct captureWorker *cw, struct frameLease *lease) {
+    struct frameLease stale {};
+    bool pushed;
+
+    {
+        std::lock_guard<std::mutex> guard(cw->lock);
+        if (cw->mode == CAPTURE_LATEST) {
+            if (cw->has_Latest)
+                stale = cw->latest;
+            cw->latest = *lease;
+            cw->has_Latest = true;
+            pushed = true;
+        } else {
+            pushed = cw->ring.push(*lease);
+        }
+    }
+    while (!pushed && cw->is_Running.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+        std::lock_guard<std::mutex> guard(cw->lock);
+        pushed = cw->ring.push(*lease);
+    }
+    cw->ready.notify_one();
+
+    if (stale.mem != nullptr) {
+        cw->frames_Dropped.fetch_add(1, std::memory_order_relaxed);
+        releaseFrame(cw->vd, &stale);
+    }
+    if (!pushed) {
+        cw->frames_Dropped.fetch_add(1, std::memory_order_relaxed);
+        releaseFrame(cw->vd, lease);
+    }
+}
+
+/**
+  * @brief  Capture loop
+  * @note   Runs on the capture thread, leases frames and hands their descriptors to the consumer, see handFrame().
+  * @note   Failures back off exponentially up to CAPTURE_MAX_BACKOFF_MS, after CAPTURE_MAX_RETRY
+  *         failures in a row the thread gives up and sets has_Failed.
+  * @param  cw  struct captureWorker
+  * @retval None
+**/
+static void captureLoop(struct captureWorker *cw) {
+    struct frameLease lease {};
+    int failures = 0;
+    int ret;
+
+    while (cw->is_Running.load(std::memory_order_acquire)) {
+        ret = leaseFrame(cw->vd, &lease);
+        if (ret == 1)
+            ret = waitFrame(cw->vd, CAPTURE_WAIT_MS) < 0 ? -1 : 1;
+        if (ret < 0) {
+            if (++failures > CAPTURE_MAX_RETRY) {
+                printf("Error: Capture failed %d times in a row, giving up\n", failures);
+                std::lock_guard<std::mutex> guard(cw->lock);
+                cw->has_Failed = true;
+                cw->ready.notify_all();
+                break;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min(1 << failures, CAPTURE_MAX_BACKOFF_MS)));
+            continue;
+        }
+        if (ret == 1)
+            continue;
+        failures = 0;
+        cw->frames_Captured.fetch_add(1, std::memory_order_relaxed);
+        for (const auto &tap : cw->taps)
+            tap.fn(tap.ctx, &lease);
+        handFrame(cw, &lease);
+    }
+}
+
+/**
+  * @brief  Add capture tap
+  * @note   fn sees every captured frame on the capture thread before it enters the ring, even ones the preview drops.
+  * @note   Taps must copy what they need and return without blocking. Only legal while capture is stopped.
+  * @param  cw      struct captureWorker
+  * @param  fn      Tap callback
+  * @param  ctx     void *, passed back to fn
+  * @retval 0       If tap added
+**/
+int addCaptureTap(struct captureWorker *cw, void (*fn)(void *ctx, const struct frameLease *lease), void *ctx) {
+    if (cw->is_Running.load())
+        return -1;
+
+    cw->taps.push_back({fn, ctx});
+    return 0;
+}
+
+/**
+  * @brief  Start capture thread
+  * @note   The stream must already be playing. CAPTURE_ALL queues up to one frame per driver buffer, CAPTURE_LATEST only one.
+  * @param  cw      struct captureWorker
+  * @param  vd      struct videoDev
+  * @param  mode    CAPTURE_LATEST for preview, CAPTURE_ALL for recording
+  * @retval 0       If capture thread started
+**/
+int startCapture(struct captureWorker *cw, struct videoDev *vd, int mode) {
+    if (cw->is_Running.load())
+        return -1;
+
+    cw->vd = vd;
+    cw->mode = mode;
+    cw->ring.resize(mode == CAPTURE_ALL ? (vd->nb_Buffer > 0 ? vd->nb_Buffer : NB_BUFFER) : 1);
+    cw->has_Latest = false;
+    cw->frames_Captured = 0;
+    cw->frames_Dropped = 0;
+    cw->has_Failed = false;
+    cw->is_Running = true;
+    cw->thread = std::thread(captureLoop, cw);
+    return 0;
+}
+
+/**
+  * @brief  Stop capture thread
+  * @note   Joins the thread and hands every frame still waiting for the consumer back to the driver.
+  * @param  cw  struct captureWorker
+  * @retval 0   If capture thread stopped
+**/
+int stopCapture(struct captureWorker *cw) {
+    struct frameLease lease {};
+
+    if (!cw->is_Running.exchange(false))
+        return 0;
+    if (cw->thread.joinable())
+        cw->thread.join();
+
+    while (cw->ring.pop(lease))
+        releaseFrame(cw->vd, &lease);
+    if (cw->has_Latest) {
+        cw->has_Latest = false;
+        releaseFrame(cw->vd, &cw->latest);
+    }
+    return 0;
+}
+
+/**
+  * @brief  Pop frame
+  * @note   Sleeps until the capture thread hands over a frame, CAPTURE_LATEST returns the newest one captured.
+  * @note   The returned lease must be given back with releaseFrame().
+  * @param  cw          struct captureWorker
+  * @param  lease       struct frameLease
+  * @param  timeoutMs   int, 0 to return immediately
+  * @retval 0           If frame popped
+**/
+int popFrame(struct captureWorker *cw, struct frameLease *lease, int timeoutMs) {
+    std::unique_lock<std::mutex> guard(cw->lock);
+
+    auto waiting = [cw] { return cw->has_Latest || cw->ring.size() > 0 || cw->has_Failed.load(); };
+    if (!cw->ready.wait_for(guard, std::chrono::milliseconds(timeoutMs), waiting))
+        return -1;
+    if (cw->has_Latest) {
+        *lease = cw->latest;
+        cw->has_Latest = false;
+        return 0;
+    }
+    return cw->ring.pop(*lease) ? 0 : -1;
+}
@@ -0,0 +1,48 @@
+#ifndef USBCAM_CAPTURE_H
+#define USBCAM_CAPTURE_H
+
+#include "frameRing.h"
+#include "utils.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_WAIT_MS 100
+#define CAPTURE_MAX_RETRY 8
+#define CAPTURE_MAX_BACKOFF_MS 200
+
+enum captureMode {
+    CAPTURE_LATEST,
+    CAPTURE_ALL
+};
+
+struct captureTap {
+    void (*fn)(void *ctx, const struct frameLease *lease);
+    void *ctx;
+};
+
+struct captureWorker {
+    struct videoDev *vd;
+    int mode;
+    frameRing<struct frameLease> ring;
+    struct frameLease latest;
+    bool has_Latest;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::vector<struct captureTap> taps;
+    std::thread thread;
+    std::atomic<bool> is_Running{false};
+    std::atomic<bool> has_Failed{false};
+    std::atomic<unsigned long> frames_Captured{0};
+    std::atomic<unsigned long> frames_Dropped{0};
+};
+
+/* Taps run on the capture thread until stopCapture() returns, stop capture before freeing anything a tap feeds */
+int addCaptureTap(struct captureWorker *cw, void (*fn)(void *ctx, const struct frameLease *lease), void *ctx);
+int startCapture(struct captureWorker *cw, struct videoDev *vd, int mode);
+int stopCapture(struct captureWorker *cw);
+int popFrame(struct captureWorker *cw, struct frameLease *lease, int timeoutMs);
+
+#endif
@@ -0,0 +1,815 @@
+#include "decoder.h"
+#include <algorithm>
+#include <atomic>
+
+/**
+  * @brief  Initial jpeg stream decoder
+  * @note   The decompressor, its error manager and buffers live until jpegStreamFree().
+  * @param  js  struct jpegStream
+  * @retval 0   If decoder created
+**/
+int jpegStreamInit(struct jpegStream *js) {
+    if (js->is_Init)
+        return 0;
+
+    js->cinfo.err = jpeg_std_error(&js->jError.pub);
+    js->jError.pub.error_exit = errorExit;
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_destroy_decompress(&js->cinfo);
+        return -1;
+    }
+
+    jpeg_create_decompress(&js->cinfo);
+    if (js->scale_Denom <= 0)
+        js->scale_Denom = 1;
+    js->out_W = 0;
+    js->out_H = 0;
+    js->is_Init = 1;
+    return 0;
+}
+
+/**
+  * @brief  Free jpeg stream decoder
+  * @note   None
+  * @param  js  struct jpegStream
+  * @retval None
+**/
+void jpegStreamFree(struct jpegStream *js) {
+    if (!js->is_Init)
+        return;
+    jpeg_destroy_decompress(&js->cinfo);
+    std::vector<JSAMPROW>().swap(js->row_Ptrs);
+    std::vector<unsigned char>().swap(js->crop_Buf);
+    js->is_Init = 0;
+}
+
+/**
+  * @brief  Decode jpeg with a persistent decompressor
+  * @note   Only the source is reset per frame, tables and buffers are kept between frames.
+  * @note   Rows are written straight into rgbPtr, as many per jpeg_read_scanlines() call as libjpeg will return.
+  * @note   js->scale_Denom of 2, 4 or 8 decodes at reduced size in the DCT domain, see jpegScaledSize().
+  * @note   A corrupt frame aborts the current image but leaves the decoder usable.
+  * @param  js      struct jpegStream
+  * @param  jpgPtr  const unsigned char *
+  * @param  jpgLen  int
+  * @param  rgbPtr  unsigned char *
+  * @param  pitch   int, bytes between rows of rgbPtr, 0 for tightly packed
+  * @retval 0       If decode successful
+**/
+int jpegStreamDecode(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int pitch) {
+    struct jpeg_decompress_struct *cinfo = &js->cinfo;
+
+    if (!js->is_Init && jpegStreamInit(js) < 0)
+        return -1;
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+
+    jpeg_mem_src(cinfo, jpgPtr, jpgLen);
+    jpeg_read_header(cinfo, true);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = js->scale_Denom;
+    jpeg_start_decompress(cinfo);
+
+    size_t rowPitch = pitch > 0 ? (size_t) pitch : (size_t) cinfo->output_width * cinfo->output_components;
+    if (js->row_Ptrs.size() < cinfo->output_height)
+        js->row_Ptrs.resize(cinfo->output_height);
+    for (JDIMENSION i = 0; i < cinfo->output_height; ++i)
+        js->row_Ptrs[i] = rgbPtr + i * rowPitch;
+
+    JSAMPARRAY rows = js->row_Ptrs.data();
+    while (cinfo->output_scanline < cinfo->output_height)
+        jpeg_read_scanlines(cinfo, rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+
+    js->out_W = (int) cinfo->output_width;
+    js->out_H = (int) cinfo->output_height;
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+/**
+  * @brief  Decode jpeg to planar YUV 4:2:0
+  * @note   jpeg_read_raw_data() hands out the YCbCr planes before colour conversion and upsampling, rows go straight
+  *         into planes when their pitches cover libjpeg's block padding, otherwise through crop_Buf.
+  * @note   4:2:0 frames map 1:1, 4:2:2 frames keep every other chroma row. Other layouts return -1 so the
+  *         caller can fall back to RGB. Raw output is always full size, js->scale_Denom is ignored.
+  * @param  js      struct jpegStream
+  * @param  jpgPtr  const unsigned char *
+  * @param  jpgLen  int
+  * @param  planes  Y, Cb and Cr planes, I420 sized: W x H and ceil(W / 2) x ceil(H / 2)
+  * @param  pitches bytes between rows of each plane
+  * @retval 0       If decode successful
+**/
+int jpegStreamDecodeYUV(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, unsigned char *const planes[3], const int pitches[3]) {
+    struct jpeg_decompress_struct *cinfo = &js->cinfo;
+
+    if (!js->is_Init && jpegStreamInit(js) < 0)
+        return -1;
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+
+    jpeg_mem_src(cinfo, jpgPtr, jpgLen);
+    jpeg_read_header(cinfo, true);
+
+    jpeg_component_info *comp = cinfo->comp_info;
+    if (cinfo->num_components != 3 || cinfo->jpeg_color_space != JCS_YCbCr || comp[0].h_samp_factor != 2 || comp[0].v_samp_factor > 2 ||
+        comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 || comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+    cinfo->raw_data_out = true;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = 1;
+    jpeg_start_decompress(cinfo);
+
+    int width = (int) cinfo->output_width, height = (int) cinfo->output_height;
+    int chromaH = (height + 1) / 2;
+    int maxV = cinfo->max_v_samp_factor;
+    int lumaRows = maxV * DCTSIZE;
+    size_t rowBytes[3] = {(size_t) width, (size_t) (width + 1) / 2, (size_t) (width + 1) / 2};
+    size_t padded[3];
+    bool direct = true;
+    for (int c = 0; c < 3; ++c) {
+        padded[c] = (size_t) comp[c].width_in_blocks * DCTSIZE;
+        direct = direct && (size_t) pitches[c] >= padded[c];
+    }
+
+    // staging band for one iMCU row: lumaRows of Y, DCTSIZE rows each of Cb and Cr
+    size_t bandBytes = direct ? padded[0] : lumaRows * padded[0] + 2 * DCTSIZE * padded[1];
+    if (js->crop_Buf.size() < bandBytes)
+        js->crop_Buf.resize(bandBytes);
+    if (js->row_Ptrs.size() < (size_t) lumaRows + 2 * DCTSIZE)
+        js->row_Ptrs.resize(lumaRows + 2 * DCTSIZE);
+    unsigned char *scratch = js->crop_Buf.data();
+    JSAMPARRAY data[3] = {js->row_Ptrs.data(), js->row_Ptrs.data() + lumaRows, js->row_Ptrs.data() + lumaRows + DCTSIZE};
+    int rows[3] = {lumaRows, DCTSIZE, DCTSIZE};
+
+    while ((int) cinfo->output_scanline < height) {
+        int lumaStart = (int) cinfo->output_scanline;
+        int chromaStart = lumaStart / maxV;
+        unsigned char *stage = scratch;
+
+        for (int c = 0; c < 3; ++c) {
+            for (int i = 0; i < rows[c]; ++i) {
+                int row = c == 0 ? lumaStart + i : chromaStart + i;
+                int dst = c == 0 || maxV == 2 ? row : (row % 2 == 0 ? row / 2 : -1);
+                bool keep = dst >= 0 && dst < (c == 0 ? height : chromaH);
+                if (!direct) {
+                    data[c][i] = stage;
+                    stage += padded[c];
+                } else {
+                    data[c][i] = keep ? planes[c] + (size_t) dst * pitches[c] : scratch;
+                }
+            }
+        }
+
+        jpeg_read_raw_data(cinfo, data, lumaRows);
+
+        if (!direct) {
+            for (int c = 0; c < 3; ++c) {
+                for (int i = 0; i < rows[c]; ++i) {
+                    int row = c == 0 ? lumaStart + i : chromaStart + i;
+                    int dst = c == 0 || maxV == 2 ? row : (row % 2 == 0 ? row / 2 : -1);
+                    if (dst >= 0 && dst < (c == 0 ? height : chromaH))
+                        memcpy(planes[c] + (size_t) dst * pitches[c], data[c][i], rowBytes[c]);
+                }
+            }
+        }
+    }
+
+    js->out_W = width;
+    js->out_H = height;
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+/**
+  * @brief  Decode one vertical strip of a jpeg
+  * @note   Uses jpeg_crop_scanline() so IDCT and colour conversion only run for columns [W * part / parts, W * (part + 1) / parts).
+  * @note   When libjpeg has to widen the crop to an iMCU boundary the rows go through crop_Buf, otherwise straight into dstPtr.
+  * @param  js      struct jpegStream
+  * @param  jpgPtr  const unsigned char *
+  * @param  jpgLen  int
+  * @param  part    int, strip index
+  * @param  parts   int, number of equal strips, 2 for a side-by-side stereo pair
+  * @param  dstPtr  unsigned char *
+  * @param  pitch   int, bytes between rows of dstPtr, 0 for tightly packed
+  * @retval 0       If decode successful
+**/
+int jpegStreamDecodeCrop(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, int part, int parts, unsigned char *dstPtr, int pitch) {
+    struct jpeg_decompress_struct *cinfo = &js->cinfo;
+
+    if (!js->is_Init && jpegStreamInit(js) < 0)
+        return -1;
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+
+    jpeg_mem_src(cinfo, jpgPtr, jpgLen);
+    jpeg_read_header(cinfo, true);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = js->scale_Denom;
+    jpeg_start_decompress(cinfo);
+
+    JDIMENSION cropX = cinfo->output_width * part / parts;
+    JDIMENSION cropW = cinfo->output_width * (part + 1) / parts - cropX;
+    JDIMENSION xOffset = cropX, width = cropW;
+    jpeg_crop_scanline(cinfo, &xOffset, &width);
+
+    int comps = cinfo->output_components;
+    size_t cropBytes = (size_t) cropW * comps;
+    size_t rowPitch = pitch > 0 ? (size_t) pitch : cropBytes;
+    if (js->row_Ptrs.size() < cinfo->output_height)
+        js->row_Ptrs.resize(cinfo->output_height);
+    JSAMPARRAY rows = js->row_Ptrs.data();
+
+    if (xOffset == cropX && width == cropW) {
+        for (JDIMENSION i = 0; i < cinfo->output_height; ++i)
+            rows[i] = dstPtr + i * rowPitch;
+        while (cinfo->output_scanline < cinfo->output_height)
+            jpeg_read_scanlines(cinfo, rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+    } else {
+        size_t skip = (size_t) (cropX - xOffset) * comps;
+        size_t widthBytes = (size_t) width * comps;
+        int batch = cinfo->rec_outbuf_height;
+        if (js->crop_Buf.size() < widthBytes * batch)
+            js->crop_Buf.resize(widthBytes * batch);
+        for (int i = 0; i < batch; ++i)
+            rows[i] = js->crop_Buf.data() + i * widthBytes;
+        while (cinfo->output_scanline < cinfo->output_height) {
+            JDIMENSION first = cinfo->output_scanline;
+            JDIMENSION got = jpeg_read_scanlines(cinfo, rows, batch);
+            for (JDIMENSION i = 0; i < got; ++i)
+                memcpy(dstPtr + (first + i) * rowPitch, rows[i] + skip, cropBytes);
+        }
+    }
+
+    js->out_W = (int) cropW;
+    js->out_H = (int) cinfo->output_height;
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+struct jpegLayout {
+    size_t header_Len;
+    size_t sof_Height_Pos;
+    int width;
+    int height;
+    int mcu_W;
+    int mcu_H;
+    int components;
+    int max_V;
+    int restart_Interval;
+};
+
+static const unsigned char RST_MARKERS[8][2] = {{0xff, 0xd0}, {0xff, 0xd1}, {0xff, 0xd2}, {0xff, 0xd3},
+                                                {0xff, 0xd4}, {0xff, 0xd5}, {0xff, 0xd6}, {0xff, 0xd7}};
+static const unsigned char EOI_MARKER[2] = {0xff, 0xd9};
+
+/**
+  * @brief  Parse jpeg layout
+  * @note   Walks the marker segments up to the first SOS, only single-scan sequential frames are accepted.
+  * @param  p       const unsigned char *
+  * @param  len     size_t
+  * @param  layout  struct jpegLayout
+  * @retval 0       If the frame can be split on restart markers
+**/
+static int parseJpegLayout(const unsigned char *p, size_t len, struct jpegLayout *layout) {
+    size_t pos = 2;
+    int sofComps = 0;
+    int maxH = 1, maxV = 1;
+
+    memset(layout, 0, sizeof(struct jpegLayout));
+    if (len < 4 || p[0] != 0xff || p[1] != 0xd8)
+        return -1;
+
+    while (pos + 4 <= len) {
+        if (p[pos] != 0xff)
+            return -1;
+        unsigned char marker = p[pos + 1];
+        if (marker == 0xff) {
+            pos++;
+            continue;
+        }
+        size_t segLen = (p[pos + 2] << 8) | p[pos + 3];
+        if (segLen < 2 || pos + 2 + segLen > len)
+            return -1;
+        const unsigned char *seg = p + pos + 4;
+
+        switch (marker) {
+            case 0xc0:
+            case 0xc1:
+                if (segLen < 8)
+                    return -1;
+                layout->sof_Height_Pos = pos + 5;
+                layout->height = (seg[1] << 8) | seg[2];
+                layout->width = (seg[3] << 8) | seg[4];
+                sofComps = seg[5];
+                if (segLen < 8 + 3 * (size_t) sofComps)
+                    return -1;
+                for (int i = 0; i < sofComps; ++i) {
+                    maxH = std::max(maxH, seg[7 + i * 3] >> 4);
+                    maxV = std::max(maxV, seg[7 + i * 3] & 0x0f);
+                }
+                break;
+            case 0xc2:
+            case 0xc3:
+            case 0xc5:
+            case 0xc6:
+            case 0xc7:
+            case 0xc9:
+            case 0xca:
+            case 0xcb:
+            case 0xcd:
+            case 0xce:
+            case 0xcf:
+                // progressive, lossless, hierarchical and arithmetic frames are not split
+                return -1;
+            case 0xdd:
+                if (segLen < 4)
+                    return -1;
+                layout->restart_Interval = (seg[0] << 8) | seg[1];
+                break;
+            case 0xda:
+                if (segLen < 3 || layout->width == 0 || layout->height == 0 || seg[0] != sofComps)
+                    return -1;
+                layout->header_Len = pos + 2 + segLen;
+                layout->mcu_W = maxH * DCTSIZE;
+                layout->mcu_H = maxV * DCTSIZE;
+                layout->components = sofComps == 1 ? 1 : 3;
+                layout->max_V = maxV;
+                return layout->restart_Interval > 0 ? 0 : -1;
+        }
+        pos += 2 + segLen;
+    }
+    return -1;
+}
+
+/**
+  * @brief  Find restart segments
+  * @note   Records where the entropy data of every restart interval starts and ends.
+  * @param  p       const unsigned char *
+  * @param  len     size_t
+  * @param  start   size_t, first entropy coded byte
+  * @param  starts  std::vector<size_t>
+  * @param  ends    std::vector<size_t>, position of the marker that ends each segment
+  * @retval None
+**/
+static void findRestartSegments(const unsigned char *p, size_t len, size_t start, std::vector<size_t> &starts, std::vector<size_t> &ends) {
+    size_t pos = start;
+
+    starts.clear();
+    ends.clear();
+    starts.push_back(start);
+    while (pos + 1 < len) {
+        auto ff = (const unsigned char *) memchr(p + pos, 0xff, len - pos - 1);
+        if (ff == nullptr)
+            break;
+        pos = ff - p;
+        unsigned char next = p[pos + 1];
+        if (next == 0x00 || next == 0xff) {
+            pos += next == 0x00 ? 2 : 1;
+        } else if (next >= 0xd0 && next <= 0xd7) {
+            ends.push_back(pos);
+            starts.push_back(pos + 2);
+            pos += 2;
+        } else {
+            ends.push_back(pos);
+            return;
+        }
+    }
+    ends.push_back(len);
+}
+
+/**
+  * @brief  Chunk source init
+  * @note   Nothing to do, jpegSliceDecode() resets the source before every frame.
+  * @param  cinfo   j_decompress_ptr
+  * @retval None
+**/
+static void chunkInitSource(j_decompress_ptr cinfo) {
+    (void) cinfo;
+}
+
+/**
+  * @brief  Chunk source fill
+  * @note   Hands libjpeg the next chunk as is, running out yields an EOI like jpeg_mem_src() does.
+  * @param  cinfo   j_decompress_ptr
+  * @retval Always true
+**/
+static boolean chunkFillInput(j_decompress_ptr cinfo) {
+    auto src = (struct jpegChunkSource *) cinfo->src;
+
+    while (src->next < src->count && src->chunks[src->next].len == 0)
+        src->next++;
+    if (src->next >= src->count) {
+        src->pub.next_input_byte = EOI_MARKER;
+        src->pub.bytes_in_buffer = sizeof(EOI_MARKER);
+        return true;
+    }
+    src->pub.next_input_byte = src->chunks[src->next].ptr;
+    src->pub.bytes_in_buffer = src->chunks[src->next].len;
+    src->next++;
+    return true;
+}
+
+/**
+  * @brief  Chunk source skip
+  * @param  cinfo       j_decompress_ptr
+  * @param  numBytes    long
+  * @retval None
+**/
+static void chunkSkipInput(j_decompress_ptr cinfo, long numBytes) {
+    struct jpeg_source_mgr *src = cinfo->src;
+
+    if (numBytes <= 0)
+        return;
+    while (numBytes > (long) src->bytes_in_buffer) {
+        numBytes -= (long) src->bytes_in_buffer;
+        chunkFillInput(cinfo);
+    }
+    src->next_input_byte += numBytes;
+    src->bytes_in_buffer -= numBytes;
+}
+
+/**
+  * @brief  Chunk source term
+  * @param  cinfo   j_decompress_ptr
+  * @retval None
+**/
+static void chunkTermSource(j_decompress_ptr cinfo) {
+    (void) cinfo;
+}
+
+/**
+  * @brief  Start slice chunks
+  * @note   The original header up to the SOF size, the slice's own height and width, then the rest of the header.
+  * @param  slice   struct jpegSlice
+  * @param  jpgPtr  const unsigned char *
+  * @param  layout  struct jpegLayout
+  * @param  width   int
+  * @param  height  int
+  * @retval None
+**/
+static void sliceHeader(struct jpegSlice *slice, const unsigned char *jpgPtr, const struct jpegLayout *layout, int width, int height) {
+    slice->sof_Size[0] = (unsigned char) (height >> 8);
+    slice->sof_Size[1] = (unsigned char) (height & 0xff);
+    slice->sof_Size[2] = (unsigned char) (width >> 8);
+    slice->sof_Size[3] = (unsigned char) (width & 0xff);
+    slice->chunks.clear();
+    slice->chunks.push_back({jpgPtr, layout->sof_Height_Pos});
+    slice->chunks.push_back({slice->sof_Size, sizeof(slice->sof_Size)});
+    slice->chunks.push_back({jpgPtr + layout->sof_Height_Pos + 4, layout->header_Len - layout->sof_Height_Pos - 4});
+}
+
+/**
+  * @brief  Decode jpeg slice
+  * @note   Reads slice->chunks, which point into the original frame, so no slice jpeg is ever assembled.
+  * @note   Output rows [skipRows, skipRows + keepRows) go to dstPtr, the context rows around them into crop_Buf.
+  * @note   The previous source manager is put back afterwards, jpeg_mem_src() refuses to reuse any other.
+  * @param  js          struct jpegStream
+  * @param  slice       struct jpegSlice
+  * @param  dstPtr      unsigned char *
+  * @param  pitch       size_t, bytes between rows of dstPtr
+  * @param  skipRows    int, leading output rows to drop
+  * @param  keepRows    int
+  * @retval 0           If decode successful
+**/
+static int jpegSliceDecode(struct jpegStream *js, struct jpegSlice *slice, unsigned char *dstPtr, size_t pitch, int skipRows, int keepRows) {
+    struct jpeg_decompress_struct *cinfo = &js->cinfo;
+    struct jpeg_source_mgr *memSrc = cinfo->src;
+
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_abort_decompress(cinfo);
+        cinfo->src = memSrc;
+        return -1;
+    }
+
+    slice->src.pub.init_source = chunkInitSource;
+    slice->src.pub.fill_input_buffer = chunkFillInput;
+    slice->src.pub.skip_input_data = chunkSkipInput;
+    slice->src.pub.resync_to_restart = jpeg_resync_to_restart;
+    slice->src.pub.term_source = chunkTermSource;
+    slice->src.pub.next_input_byte = nullptr;
+    slice->src.pub.bytes_in_buffer = 0;
+    slice->src.chunks = slice->chunks.data();
+    slice->src.count = slice->chunks.size();
+    slice->src.next = 0;
+    cinfo->src = &slice->src.pub;
+
+    jpeg_read_header(cinfo, true);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = js->scale_Denom;
+    jpeg_start_decompress(cinfo);
+
+    size_t rowBytes = (size_t) cinfo->output_width * cinfo->output_components;
+    if (js->crop_Buf.size() < rowBytes)
+        js->crop_Buf.resize(rowBytes);
+    if (js->row_Ptrs.size() < cinfo->output_height)
+        js->row_Ptrs.resize(cinfo->output_height);
+    for (int i = 0; i < (int) cinfo->output_height; ++i)
+        js->row_Ptrs[i] = i >= skipRows && i < skipRows + keepRows ? dstPtr + (size_t) (i - skipRows) * pitch : js->crop_Buf.data();
+
+    JSAMPARRAY rows = js->row_Ptrs.data();
+    while (cinfo->output_scanline < cinfo->output_height)
+        jpeg_read_scanlines(cinfo, rows + cinfo->output_scanline, cinfo->output_height - cinfo->output_scanline);
+
+    js->out_W = (int) cinfo->output_width;
+    js->out_H = keepRows;
+    jpeg_finish_decompress(cinfo);
+    cinfo->src = memSrc;
+    return 0;
+}
+
+/**
+  * @brief  Initial parallel jpeg decoder
+  * @note   One persistent jpegStream per slice, threads extra workers plus the caller.
+  * @param  jp      struct jpegParallel
+  * @param  threads int, 0 for one per core
+  * @retval 0       If decoder created
+**/
+int jpegParallelInit(struct jpegParallel *jp, int threads) {
+    if (jp->is_Init)
+        return 0;
+    if (threads <= 0)
+        threads = (int) std::max(1u, std::thread::hardware_concurrency());
+
+    jp->max_Slices = threads;
+    jp->streams.resize(threads);
+    jp->slices.resize(threads);
+    for (auto &js : jp->streams) {
+        if (jpegStreamInit(&js) < 0)
+            return -1;
+    }
+    if (jpegStreamInit(&jp->fallback) < 0)
+        return -1;
+    threadPoolInit(&jp->pool, threads - 1);
+    jp->is_Init = 1;
+    return 0;
+}
+
+/**
+  * @brief  Free parallel jpeg decoder
+  * @note   None
+  * @param  jp  struct jpegParallel
+  * @retval None
+**/
+void jpegParallelFree(struct jpegParallel *jp) {
+    if (!jp->is_Init)
+        return;
+    threadPoolFree(&jp->pool);
+    for (auto &js : jp->streams)
+        jpegStreamFree(&js);
+    jpegStreamFree(&jp->fallback);
+    jp->is_Init = 0;
+}
+
+/**
+  * @brief  Decode jpeg in parallel slices
+  * @note   Frames with DRI restart markers are cut into bands of whole MCU rows at restart boundaries,
+  *         each band is decoded on the pool as a standalone jpeg read in place from jpgPtr, see jpegSliceDecode(),
+  *         into its own rows of rgbPtr. Output is identical to jpegStreamDecode(), including 4:2:0 band seams.
+  * @note   Frames without restart markers fall back to the single threaded jpegStreamDecode().
+  * @note   jp->scale_Denom applies to every slice, MCU heights stay divisible by it up to 1/8.
+  * @param  jp      struct jpegParallel
+  * @param  jpgPtr  const unsigned char *
+  * @param  jpgLen  int
+  * @param  rgbPtr  unsigned char *
+  * @param  pitch   int, bytes between rows of rgbPtr, 0 for tightly packed
+  * @retval 0       If decode successful
+**/
+int jpegParallelDecode(struct jpegParallel *jp, const unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int pitch) {
+    struct jpegLayout layout {};
+    size_t len = (size_t) jpgLen;
+
+    if (!jp->is_Init && jpegParallelInit(jp, 0) < 0)
+        return -1;
+    int scale = jp->scale_Denom > 0 ? jp->scale_Denom : 1;
+    jp->fallback.scale_Denom = scale;
+    for (auto &js : jp->streams)
+        js.scale_Denom = scale;
+    if (jp->max_Slices < 2 || parseJpegLayout(jpgPtr, len, &layout) < 0)
+        return jpegStreamDecode(&jp->fallback, jpgPtr, jpgLen, rgbPtr, pitch);
+
+    int mcusPerRow = (layout.width + layout.mcu_W - 1) / layout.mcu_W;
+    int mcuRows = (layout.height + layout.mcu_H - 1) / layout.mcu_H;
+    int segments = (mcusPerRow * mcuRows + layout.restart_Interval - 1) / layout.restart_Interval;
+
+    findRestartSegments(jpgPtr, len, layout.header_Len, jp->seg_Starts, jp->seg_Ends);
+    if ((int) jp->seg_Starts.size() != segments)
+        return jpegStreamDecode(&jp->fallback, jpgPtr, jpgLen, rgbPtr, pitch);
+
+    // vertically subsampled chroma is upsampled from the neighbouring MCU rows, so every band also decodes
+    // one MCU row either side and drops it, those rows have to open restart segments as well
+    int context = layout.max_V > 1 ? 1 : 0;
+    auto opensSegment = [&](int row) {
+        return row <= 0 || row >= mcuRows || (long) row * mcusPerRow % layout.restart_Interval == 0;
+    };
+    auto rowSegment = [&](int row) {
+        return row >= mcuRows ? segments : (int) ((long) row * mcusPerRow / layout.restart_Interval);
+    };
+
+    int count = 1;
+    jp->slices[0].first_Row = 0;
+    for (int row = 1; row < mcuRows && count < jp->max_Slices; ++row) {
+        if (row < (long) count * mcuRows / jp->max_Slices || !opensSegment(row) || !opensSegment(row - context) || !opensSegment(row + context))
+            continue;
+        jp->slices[count++].first_Row = row;
+    }
+    if (count < 2)
+        return jpegStreamDecode(&jp->fallback, jpgPtr, jpgLen, rgbPtr, pitch);
+
+    size_t rowPitch = pitch > 0 ? (size_t) pitch : (size_t) jpegScaledSize(layout.width, scale) * layout.components;
+    int rowsPerMcu = layout.mcu_H / scale;
+    std::atomic<int> failed{0};
+
+    threadPoolRun(&jp->pool, count, [&](int i) {
+        struct jpegSlice &slice = jp->slices[i];
+        int endRow = i + 1 < count ? jp->slices[i + 1].first_Row : mcuRows;
+        int top = i > 0 ? context : 0, bottom = i + 1 < count ? context : 0;
+        int firstSeg = rowSegment(slice.first_Row - top), lastSeg = rowSegment(endRow + bottom);
+        int height = std::min((endRow + bottom) * layout.mcu_H, layout.height) - (slice.first_Row - top) * layout.mcu_H;
+        int keep = jpegScaledSize(std::min(endRow * layout.mcu_H, layout.height) - slice.first_Row * layout.mcu_H, scale);
+
+        // original header with this band's height patched in, then its segments with renumbered RSTn markers
+        sliceHeader(&slice, jpgPtr, &layout, layout.width, height);
+        for (int seg = firstSeg; seg < lastSeg; ++seg) {
+            slice.chunks.push_back({jpgPtr + jp->seg_Starts[seg], jp->seg_Ends[seg] - jp->seg_Starts[seg]});
+            slice.chunks.push_back({seg + 1 < lastSeg ? RST_MARKERS[(seg - firstSeg) % 8] : EOI_MARKER, 2});
+        }
+
+        unsigned char *dst = rgbPtr + (size_t) slice.first_Row * rowsPerMcu * rowPitch;
+        if (jpegSliceDecode(&jp->streams[i], &slice, dst, rowPitch, top * rowsPerMcu, keep) < 0)
+            failed = 1;
+    });
+
+    return failed ? -1 : 0;
+}
+
+/**
+  * @brief  Initial stereo jpeg decoder
+  * @note   One jpegStream per eye, the right eye runs on a pool thread.
+  * @note   With a single core, frames that cannot be split on restart segments are decoded in one pass instead
+  *         of cropped twice, see jpegStereoDecode().
+  * @param  jst struct jpegStereo
+  * @retval 0   If decoder created
+**/
+int jpegStereoInit(struct jpegStereo *jst) {
+    if (jst->is_Init)
+        return 0;
+    if (jpegStreamInit(&jst->halves[0]) < 0 || jpegStreamInit(&jst->halves[1]) < 0)
+        return -1;
+    threadPoolInit(&jst->pool, 1);
+    jst->is_Concurrent = std::thread::hardware_concurrency() > 1;
+    if (!jst->is_Concurrent)
+        printf("Stereo decode: single core, eyes of frames without usable restart markers are decoded in one pass\n");
+    jst->last_Path = JPEG_STEREO_SERIAL;
+    jst->is_Init = 1;
+    return 0;
+}
+
+/**
+  * @brief  Free stereo jpeg decoder
+  * @note   None
+  * @param  jst struct jpegStereo
+  * @retval None
+**/
+void jpegStereoFree(struct jpegStereo *jst) {
+    if (!jst->is_Init)
+        return;
+    threadPoolFree(&jst->pool);
+    jpegStreamFree(&jst->halves[0]);
+    jpegStreamFree(&jst->halves[1]);
+    jst->is_Init = 0;
+}
+
+/**
+  * @brief  Decode side-by-side stereo jpeg in one pass
+  * @note   Fallback for frames the eyes cannot be split from, every row goes through crop_Buf and is copied out per eye.
+  * @param  js          struct jpegStream
+  * @param  jpgPtr      const unsigned char *
+  * @param  jpgLen      int
+  * @param  leftPtr     unsigned char *
+  * @param  rightPtr    unsigned char *
+  * @param  pitch       int, bytes between rows of each eye, 0 for tightly packed
+  * @retval 0           If both eyes decoded
+**/
+static int jpegStereoDecodeSerial(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, unsigned char *leftPtr, unsigned char *rightPtr, int pitch) {
+    struct jpeg_decompress_struct *cinfo = &js->cinfo;
+
+    if (setjmp(js->jError.setJumpBuf)) {
+        jpeg_abort_decompress(cinfo);
+        return -1;
+    }
+
+    jpeg_mem_src(cinfo, jpgPtr, jpgLen);
+    jpeg_read_header(cinfo, true);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = js->scale_Denom;
+    jpeg_start_decompress(cinfo);
+
+    int comps = cinfo->output_components;
+    size_t leftBytes = (size_t) (cinfo->output_width / 2) * comps;
+    size_t rightBytes = (size_t) cinfo->output_width * comps - leftBytes;
+    size_t rowBytes = leftBytes + rightBytes;
+    int batch = cinfo->rec_outbuf_height;
+    if (js->crop_Buf.size() < rowBytes * batch)
+        js->crop_Buf.resize(rowBytes * batch);
+    if (js->row_Ptrs.size() < (size_t) batch)
+        js->row_Ptrs.resize(batch);
+    JSAMPARRAY rows = js->row_Ptrs.data();
+    for (int i = 0; i < batch; ++i)
+        rows[i] = js->crop_Buf.data() + i * rowBytes;
+
+    while (cinfo->output_scanline < cinfo->output_height) {
+        JDIMENSION first = cinfo->output_scanline;
+        JDIMENSION got = jpeg_read_scanlines(cinfo, rows, batch);
+        for (JDIMENSION i = 0; i < got; ++i) {
+            memcpy(leftPtr + (first + i) * (pitch > 0 ? (size_t) pitch : leftBytes), rows[i], leftBytes);
+            memcpy(rightPtr + (first + i) * (pitch > 0 ? (size_t) pitch : rightBytes), rows[i] + leftBytes, rightBytes);
+        }
+    }
+
+    js->out_W = (int) cinfo->output_width;
+    js->out_H = (int) cinfo->output_height;
+    jpeg_finish_decompress(cinfo);
+    return 0;
+}
+
+/**
+  * @brief  Decode side-by-side stereo jpeg
+  * @note   When every restart interval lies within one eye, i.e. the DRI interval divides half an MCU row, each eye
+  *         is decoded on its own thread as a standalone half-width jpeg made of only its own restart segments, so
+  *         the entropy decoding is split between the threads instead of done twice.
+  * @note   Other frames are decoded with jpegStreamDecodeCrop() on both threads at once. Each thread entropy decodes
+  *         the whole frame but only runs IDCT and colour conversion for its own eye. Without a second core that
+  *         only doubles the work, so those frames are decoded once on the calling thread, see jpegStereoDecodeSerial().
+  * @note   Split and cropped eyes are edge-extended at the centre seam, not upsampled across it. jst->last_Path
+  *         records which of the three paths the last frame took.
+  * @param  jst         struct jpegStereo
+  * @param  jpgPtr      const unsigned char *
+  * @param  jpgLen      int
+  * @param  leftPtr     unsigned char *
+  * @param  rightPtr    unsigned char *
+  * @param  pitch       int, bytes between rows of each eye, 0 for tightly packed
+  * @retval 0           If both eyes decoded
+**/
+int jpegStereoDecode(struct jpegStereo *jst, const unsigned char *jpgPtr, int jpgLen, unsigned char *leftPtr, unsigned char *rightPtr, int pitch) {
+    struct jpegLayout layout {};
+    std::atomic<int> failed{0};
+
+    if (!jst->is_Init && jpegStereoInit(jst) < 0)
+        return -1;
+    int scale = jst->scale_Denom > 0 ? jst->scale_Denom : 1;
+    jst->halves[0].scale_Denom = scale;
+    jst->halves[1].scale_Denom = scale;
+    auto decodeUnsplit = [&]() {
+        if (!jst->is_Concurrent) {
+            jst->last_Path = JPEG_STEREO_SERIAL;
+            return jpegStereoDecodeSerial(&jst->halves[0], jpgPtr, jpgLen, leftPtr, rightPtr, pitch);
+        }
+        jst->last_Path = JPEG_STEREO_CROP;
+        threadPoolRun(&jst->pool, 2, [&](int eye) {
+            if (jpegStreamDecodeCrop(&jst->halves[eye], jpgPtr, jpgLen, eye, 2, eye == 0 ? leftPtr : rightPtr, pitch) < 0)
+                failed = 1;
+        });
+        return failed ? -1 : 0;
+    };
+    if (parseJpegLayout(jpgPtr, (size_t) jpgLen, &layout) < 0)
+        return decodeUnsplit();
+
+    int mcusPerRow = (layout.width + layout.mcu_W - 1) / layout.mcu_W;
+    int mcuRows = (layout.height + layout.mcu_H - 1) / layout.mcu_H;
+    int segments = (mcusPerRow * mcuRows + layout.restart_Interval - 1) / layout.restart_Interval;
+    int eyeMcus = mcusPerRow / 2;
+    if (layout.width % (2 * layout.mcu_W) != 0 || eyeMcus % layout.restart_Interval != 0)
+        return decodeUnsplit();
+    findRestartSegments(jpgPtr, (size_t) jpgLen, layout.header_Len, jst->seg_Starts, jst->seg_Ends);
+    if ((int) jst->seg_Starts.size() != segments)
+        return decodeUnsplit();
+
+    jst->last_Path = JPEG_STEREO_SPLIT;
+    int eyeSegs = eyeMcus / layout.restart_Interval;
+    size_t rowPitch = pitch > 0 ? (size_t) pitch : (size_t) jpegScaledSize(layout.width / 2, scale) * layout.components;
+    threadPoolRun(&jst->pool, 2, [&](int eye) {
+        struct jpegSlice &slice = jst->eyes[eye];
+        int n = 0;
+
+        sliceHeader(&slice, jpgPtr, &layout, layout.width / 2, layout.height);
+        for (int row = 0; row < mcuRows; ++row) {
+            for (int seg = (2 * row + eye) * eyeSegs; seg < (2 * row + eye + 1) * eyeSegs; ++seg, ++n) {
+                if (n > 0)
+                    slice.chunks.push_back({RST_MARKERS[(n - 1) % 8], 2});
+                slice.chunks.push_back({jpgPtr + jst->seg_Starts[seg], jst->seg_Ends[seg] - jst->seg_Starts[seg]});
+            }
+        }
+        slice.chunks.push_back({EOI_MARKER, 2});
+        if (jpegSliceDecode(&jst->halves[eye], &slice, eye == 0 ? leftPtr : rightPtr, rowPitch, 0, jpegScaledSize(layout.height, scale)) < 0)
+            failed = 1;
+    });
+    return failed ? -1 : 0;
+}
@@ -0,0 +1,80 @@
+#ifndef USBCAM_DECODER_H
+#define USBCAM_DECODER_H
+
+#include "threadPool.h"
+#include "utils.h"
+#include <vector>
+
+struct jpegStream {
+    struct jpeg_decompress_struct cinfo;
+    struct errorMessage jError;
+    std::vector<JSAMPROW> row_Ptrs;
+    std::vector<unsigned char> crop_Buf;
+    int scale_Denom;
+    int out_W;
+    int out_H;
+    int is_Init;
+};
+
+struct jpegChunk {
+    const unsigned char *ptr;
+    size_t len;
+};
+
+struct jpegChunkSource {
+    struct jpeg_source_mgr pub;
+    const struct jpegChunk *chunks;
+    size_t count;
+    size_t next;
+};
+
+struct jpegSlice {
+    std::vector<struct jpegChunk> chunks;
+    struct jpegChunkSource src;
+    unsigned char sof_Size[4];
+    int first_Row;
+};
+
+#define JPEG_STEREO_SERIAL 0
+#define JPEG_STEREO_SPLIT 1
+#define JPEG_STEREO_CROP 2
+
+struct jpegStereo {
+    struct threadPool pool;
+    struct jpegStream halves[2];
+    struct jpegSlice eyes[2];
+    std::vector<size_t> seg_Starts;
+    std::vector<size_t> seg_Ends;
+    int scale_Denom;
+    int is_Concurrent;
+    int last_Path;
+    int is_Init;
+};
+
+struct jpegParallel {
+    struct threadPool pool;
+    std::vector<struct jpegStream> streams;
+    std::vector<struct jpegSlice> slices;
+    std::vector<size_t> seg_Starts;
+    std::vector<size_t> seg_Ends;
+    struct jpegStream fallback;
+    int scale_Denom;
+    int max_Slices;
+    int is_Init;
+};
+
+int jpegStreamInit(struct jpegStream *js);
+void jpegStreamFree(struct jpegStream *js);
+int jpegStreamDecode(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int pitch);
+int jpegStreamDecodeYUV(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, unsigned char *const planes[3], const int pitches[3]);
+int jpegStreamDecodeCrop(struct jpegStream *js, const unsigned char *jpgPtr, int jpgLen, int part, int parts, unsigned char *dstPtr, int pitch);
+
+int jpegStereoInit(struct jpegStereo *jst);
+void jpegStereoFree(struct jpegStereo *jst);
+int jpegStereoDecode(struct jpegStereo *jst, const unsigned char *jpgPtr, int jpgLen, unsigned char *leftPtr, unsigned char *rightPtr, int pitch);
+
+int jpegParallelInit(struct jpegParallel *jp, int threads);
+void jpegParallelFree(struct jpegParallel *jp);
+int jpegParallelDecode(struct jpegParallel *jp, const unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int pitch);
+
+#endif
@@ -0,0 +1,506 @@
+#include "dmabufShare.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+  * @brief  Send message with fds
+  * @note   SOCK_SEQPACKET keeps every message whole, the fds ride along as SCM_RIGHTS
+  * @param  fd      int, connected socket
+  * @param  msg     const void *
+  * @param  size    size_t
+  * @param  fds     const int *, nullptr to send no fds
+  * @param  count   int
+  * @retval 0       If message sent
+**/
+static int sendMessage(int fd, const void *msg, size_t size, const int *fds, int count) {
+    char control[CMSG_SPACE(sizeof(int) * DMABUF_MAX_FDS)] = {};
+    struct iovec iov = {(void *) msg, size};
+    struct msghdr hdr {};
+
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (count > 0) {
+        hdr.msg_control = control;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+    return sendmsg(fd, &hdr, MSG_DONTWAIT | MSG_NOSIGNAL) == (ssize_t) size ? 0 : -1;
+}
+
+/**
+  * @brief  Locate plane
+  * @note   Maps a lease plane pointer back to the exported memory plane it lives in, split NV12 planes share one
+  * @param  vd      struct videoDev
+  * @param  index   int, buffer index
+  * @param  ptr     const void *
+  * @param  offset  uint32_t *, byte offset inside the memory plane
+  * @retval Memory plane index, -1 if ptr is not inside the buffer
+**/
+static int locatePlane(struct videoDev *vd, int index, const void *ptr, uint32_t *offset) {
+    for (int p = 0; p < vd->mem_Planes; ++p) {
+        const unsigned char *base = (const unsigned char *) vd->mem[index * MAX_PLANES + p];
+        if ((const unsigned char *) ptr >= base && (const unsigned char *) ptr < base + vd->mem_Len[index * MAX_PLANES + p]) {
+            *offset = (uint32_t) ((const unsigned char *) ptr - base);
+            return p;
+        }
+    }
+    return -1;
+}
+
+/**
+  * @brief  Give back peer reference
+  * @param  ds      struct dmabufServer
+  * @param  index   int, buffer index
+  * @retval None
+**/
+static void releaseIndex(struct dmabufServer *ds, int index) {
+    struct frameLease lease {};
+
+    lease.index = index;
+    releaseFrame(ds->vd, &lease);
+}
+
+/**
+  * @brief  Drop peer
+  * @note   Every buffer the peer still holds goes back to the driver, so a crashed consumer never starves capture
+  * @param  ds      struct dmabufServer
+  * @param  i       size_t, peer slot
+  * @retval None
+**/
+static void dropPeer(struct dmabufServer *ds, size_t i) {
+    struct dmabufPeer &peer = ds->peers[i];
+
+    for (int index = 0; index < (int) peer.held.size(); ++index)
+        while (peer.held[index]-- > 0)
+            releaseIndex(ds, index);
+    close(peer.fd);
+    ds->peers.erase(ds->peers.begin() + i);
+    ds->peer_Count.store((int) ds->peers.size(), std::memory_order_release);
+    printf("DMABUF consumer left, %zu connected\n", ds->peers.size());
+}
+
+/**
+  * @brief  Accept peer
+  * @note   The HELLO message carries the frame layout and every exported fd, buffer-major
+  * @param  ds  struct dmabufServer
+  * @retval None
+**/
+static void acceptPeer(struct dmabufServer *ds) {
+    struct dmabufHelloMsg hello {};
+    int fd = accept4(ds->listen_Fd, nullptr, nullptr, SOCK_CLOEXEC);
+
+    if (fd < 0)
+        return;
+    if (ds->peers.size() >= DMABUF_MAX_CLIENTS) {
+        printf("Error: DMABUF consumer refused, %d already connected\n", DMABUF_MAX_CLIENTS);
+        close(fd);
+        return;
+    }
+
+    hello.type = DMABUF_MSG_HELLO;
+    hello.buffers = ds->vd->nb_Buffer;
+    hello.mem_Planes = ds->vd->mem_Planes;
+    hello.width = ds->vd->raw_W;
+    hello.height = ds->vd->raw_H;
+    hello.pixel_Format = ds->vd->raw_Format;
+    for (int p = 0; p < MAX_PLANES; ++p)
+        hello.pitch[p] = ds->vd->plane_Pitch[p];
+    if (sendMessage(fd, &hello, sizeof(hello), ds->buf_Fds.data(), (int) ds->buf_Fds.size()) < 0) {
+        printf("Error: Unable to send DMABUF fds: %s\n", strerror(errno));
+        close(fd);
+        return;
+    }
+
+    ds->peers.push_back({fd, 0, std::vector<int>(ds->vd->nb_Buffer, 0)});
+    ds->peer_Count.store((int) ds->peers.size(), std::memory_order_release);
+    printf("DMABUF consumer joined, %zu connected\n", ds->peers.size());
+}
+
+/**
+  * @brief  Read peer messages
+  * @param  ds      struct dmabufServer
+  * @param  i       size_t, peer slot
+  * @retval 0       If peer is still connected, -1 if it was dropped
+**/
+static int readPeer(struct dmabufServer *ds, size_t i) {
+    struct dmabufPeer &peer = ds->peers[i];
+    struct dmabufReleaseMsg msg {};
+    ssize_t len;
+
+    while ((len = recv(peer.fd, &msg, sizeof(msg), MSG_DONTWAIT)) > 0) {
+        if (len != sizeof(msg) || msg.type != DMABUF_MSG_RELEASE || msg.index < 0 || msg.index >= (int) peer.held.size() ||
+            peer.held[msg.index] == 0) {
+            printf("Error: Bad DMABUF release from consumer, dropping it\n");
+            dropPeer(ds, i);
+            return -1;
+        }
+        peer.held[msg.index]--;
+        peer.held_Count--;
+        releaseIndex(ds, msg.index);
+    }
+    if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        dropPeer(ds, i);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Share frame
+  * @note   Each peer below DMABUF_CLIENT_HELD gets its own reference, a peer whose socket is full simply misses the frame.
+  * @param  ds      struct dmabufServer
+  * @param  lease   struct frameLease, the server reference taken by the tap, given back here
+  * @retval None
+**/
+static void shareFrame(struct dmabufServer *ds, struct frameLease *lease) {
+    struct dmabufFrameMsg msg {};
+    int sent = 0;
+
+    msg.type = DMABUF_MSG_FRAME;
+    msg.index = lease->index;
+    msg.sequence = lease->sequence;
+    msg.timestamp_Us = (int64_t) lease->timestamp.tv_sec * 1000000 + lease->timestamp.tv_usec;
+    msg.num_Planes = lease->num_Planes;
+    for (int p = 0; p < lease->num_Planes; ++p) {
+        msg.mem_Plane[p] = locatePlane(ds->vd, lease->index, lease->planes[p], &msg.offset[p]);
+        msg.bytes[p] = lease->plane_Bytes[p];
+    }
+
+    for (size_t i = 0; i < ds->peers.size(); ++i) {
+        struct dmabufPeer &peer = ds->peers[i];
+        if (peer.held_Count >= DMABUF_CLIENT_HELD || retainFrame(ds->vd, lease) < 0)
+            continue;
+        if (sendMessage(peer.fd, &msg, sizeof(msg), nullptr, 0) < 0) {
+            releaseIndex(ds, lease->index);
+            continue;
+        }
+        peer.held[lease->index]++;
+        peer.held_Count++;
+        sent++;
+    }
+    if (sent > 0)
+        ds->frames_Shared.fetch_add(1, std::memory_order_relaxed);
+    else
+        ds->frames_Skipped.fetch_add(1, std::memory_order_relaxed);
+    releaseFrame(ds->vd, lease);
+}
+
+/**
+  * @brief  Server loop
+  * @note   Runs on the server thread, owns the peer list. Frames are picked up every DMABUF_IDLE_MS at the latest.
+  * @param  ds  struct dmabufServer
+  * @retval None
+**/
+static void serverLoop(struct dmabufServer *ds) {
+    std::vector<struct pollfd> fds;
+    struct frameLease lease {};
+
+    while (ds->is_Running.load(std::memory_order_acquire)) {
+        fds.assign(1, {ds->listen_Fd, POLLIN, 0});
+        for (const auto &peer : ds->peers)
+            fds.push_back({peer.fd, POLLIN, 0});
+
+        if (poll(fds.data(), fds.size(), DMABUF_IDLE_MS) > 0) {
+            // walk backwards, dropped peers are erased in place
+            for (size_t i = fds.size() - 1; i > 0; --i)
+                if (fds[i].revents != 0)
+                    readPeer(ds, i - 1);
+            if (fds[0].revents & POLLIN)
+                acceptPeer(ds);
+        }
+        while (ds->pending.pop(lease))
+            shareFrame(ds, &lease);
+    }
+
+    while (ds->pending.pop(lease))
+        releaseFrame(ds->vd, &lease);
+    while (!ds->peers.empty())
+        dropPeer(ds, ds->peers.size() - 1);
+}
+
+/**
+  * @brief  Start DMABUF server
+  * @note   Exports every capture buffer with VIDIOC_EXPBUF and serves the fds on a SOCK_SEQPACKET Unix socket.
+  * @note   Only a V4L2 device opened with openVideoDevice() has buffers to export.
+  * @param  ds          struct dmabufServer
+  * @param  vd          struct videoDev
+  * @param  socketPath  const char *, e.g. "/tmp/usbCam.sock", replaced if it exists
+  * @retval 0           If server started
+**/
+int dmabufServerInit(struct dmabufServer *ds, struct videoDev *vd, const char *socketPath) {
+    struct sockaddr_un addr {};
+
+    if (ds->is_Running.load())
+        return -1;
+    if ((vd->backend != nullptr && vd->backend != &v4l2Backend) || vd->mem == nullptr || vd->mem_Type != V4L2_MEMORY_MMAP) {
+        printf("Error: DMABUF sharing needs an open V4L2 device with MMAP buffers\n");
+        return -1;
+    }
+    if (vd->nb_Buffer * vd->mem_Planes > DMABUF_MAX_FDS || strlen(socketPath) >= sizeof(addr.sun_path)) {
+        printf("Error: DMABUF sharing supports %d buffer planes and %zu byte socket paths\n", DMABUF_MAX_FDS, sizeof(addr.sun_path) - 1);
+        return -1;
+    }
+
+    ds->vd = vd;
+    ds->buf_Fds.clear();
+    for (int i = 0; i < vd->nb_Buffer; ++i) {
+        for (int p = 0; p < vd->mem_Planes; ++p) {
+            struct v4l2_exportbuffer expBuf {};
+            expBuf.type = vd->buf_Type;
+            expBuf.index = i;
+            expBuf.plane = p;
+            expBuf.flags = O_RDONLY | O_CLOEXEC;
+            if (ioctl(vd->fd, VIDIOC_EXPBUF, &expBuf) < 0) {
+                printf("Error: Unable to export buffer %d plane %d: %s\n", i, p, strerror(errno));
+                goto Fail;
+            }
+            ds->buf_Fds.push_back(expBuf.fd);
+        }
+    }
+
+    ds->listen_Fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (ds->listen_Fd < 0)
+        goto Fail;
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+    snprintf(ds->socket_Path, sizeof(ds->socket_Path), "%s", socketPath);
+    unlink(socketPath);
+    if (bind(ds->listen_Fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(ds->listen_Fd, DMABUF_MAX_CLIENTS) < 0) {
+        printf("Error: Unable to listen on %s: %s\n", socketPath, strerror(errno));
+        close(ds->listen_Fd);
+        goto Fail;
+    }
+
+    ds->pending.resize(vd->nb_Buffer);
+    ds->peers.clear();
+    ds->peer_Count = 0;
+    ds->frames_Shared = 0;
+    ds->frames_Skipped = 0;
+    ds->is_Running = true;
+    ds->thread = std::thread(serverLoop, ds);
+    printf("Sharing %d buffers over DMABUF on %s\n", vd->nb_Buffer, socketPath);
+    return 0;
+
+Fail:
+    for (int fd : ds->buf_Fds)
+        close(fd);
+    ds->buf_Fds.clear();
+    return -1;
+}
+
+/**
+  * @brief  Stop DMABUF server
+  * @note   Disconnects every consumer and gives back their buffers.
+  * @note   Consumers keep their mappings, the memory lives until they unmap it.
+  * @param  ds  struct dmabufServer
+  * @retval 0   If server stopped
+**/
+int dmabufServerFree(struct dmabufServer *ds) {
+    if (!ds->is_Running.exchange(false))
+        return 0;
+    if (ds->thread.joinable())
+        ds->thread.join();
+
+    close(ds->listen_Fd);
+    unlink(ds->socket_Path);
+    for (int fd : ds->buf_Fds)
+        close(fd);
+    ds->buf_Fds.clear();
+    printf("DMABUF shared %lu frames, skipped %lu\n", ds->frames_Shared.load(), ds->frames_Skipped.load());
+    return 0;
+}
+
+/**
+  * @brief  DMABUF capture tap
+  * @note   Takes a reference for the server thread, unless nobody listens or consumers would leave fewer than
+  *         DMABUF_RESERVE buffers for capture
+  * @param  ctx     void *, struct dmabufServer
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+void dmabufServerTap(void *ctx, const struct frameLease *lease) {
+    auto *ds = (struct dmabufServer *) ctx;
+
+    if (ds->peer_Count.load(std::memory_order_acquire) == 0)
+        return;
+    if (ds->vd->buffers_Held.load(std::memory_order_relaxed) > ds->vd->nb_Buffer - DMABUF_RESERVE || retainFrame(ds->vd, lease) < 0) {
+        ds->frames_Skipped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (!ds->pending.push(*lease)) {
+        struct frameLease copy = *lease;
+        releaseFrame(ds->vd, &copy);
+        ds->frames_Skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/**
+  * @brief  Connect to DMABUF server
+  * @note   Receives the exported fds and maps them read-only, frames are then read in place
+  * @param  dc          struct dmabufClient
+  * @param  socketPath  const char *
+  * @retval 0           If connected
+**/
+int dmabufClientConnect(struct dmabufClient *dc, const char *socketPath) {
+    char control[CMSG_SPACE(sizeof(int) * DMABUF_MAX_FDS)];
+    struct dmabufHelloMsg hello {};
+    struct iovec iov = {&hello, sizeof(hello)};
+    struct sockaddr_un addr {};
+    struct msghdr hdr {};
+    int count = 0;
+
+    dc->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (dc->fd < 0)
+        return -1;
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socketPath);
+    if (connect(dc->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        printf("Error: Unable to connect to %s: %s\n", socketPath, strerror(errno));
+        close(dc->fd);
+        return -1;
+    }
+
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    if (recvmsg(dc->fd, &hdr, MSG_CMSG_CLOEXEC) != sizeof(hello) || hello.type != DMABUF_MSG_HELLO) {
+        printf("Error: No DMABUF hello from %s\n", socketPath);
+        close(dc->fd);
+        return -1;
+    }
+    dc->buf_Fds.clear();
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        dc->buf_Fds.resize(count);
+        memcpy(dc->buf_Fds.data(), CMSG_DATA(cmsg), sizeof(int) * count);
+    }
+
+    dc->buffers = hello.buffers;
+    dc->mem_Planes = hello.mem_Planes;
+    dc->width = hello.width;
+    dc->height = hello.height;
+    dc->pixel_Format = hello.pixel_Format;
+    for (int p = 0; p < MAX_PLANES; ++p)
+        dc->pitch[p] = hello.pitch[p];
+    dc->maps.assign(count, nullptr);
+    dc->map_Len.assign(count, 0);
+    if ((hdr.msg_flags & MSG_CTRUNC) || count != dc->buffers * dc->mem_Planes) {
+        printf("Error: Expected %d DMABUF fds, got %d\n", dc->buffers * dc->mem_Planes, count);
+        dmabufClientClose(dc);
+        return -1;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        off_t size = lseek(dc->buf_Fds[i], 0, SEEK_END);
+        void *map = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, dc->buf_Fds[i], 0) : MAP_FAILED;
+        if (map == MAP_FAILED) {
+            printf("Error: Unable to map DMABUF %d\n", i);
+            dmabufClientClose(dc);
+            return -1;
+        }
+        dc->maps[i] = map;
+        dc->map_Len[i] = size;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Next shared frame
+  * @note   The frame is read in place until dmabufClientRelease(), the capture side cannot reuse it before that.
+  * @param  dc          struct dmabufClient
+  * @param  frame       struct dmabufFrame
+  * @param  timeoutMs   int, -1 to wait forever
+  * @retval 1           If a frame was received, 0 on timeout, -1 if the server went away
+**/
+int dmabufClientNext(struct dmabufClient *dc, struct dmabufFrame *frame, int timeoutMs) {
+    struct pollfd pfd = {dc->fd, POLLIN, 0};
+    struct dmabufFrameMsg msg {};
+    int ret;
+
+    ret = poll(&pfd, 1, timeoutMs);
+    if (ret <= 0)
+        return ret < 0 && errno != EINTR ? -1 : 0;
+    if (recv(dc->fd, &msg, sizeof(msg), 0) != sizeof(msg) || msg.type != DMABUF_MSG_FRAME)
+        return -1;
+    if (msg.index < 0 || msg.index >= dc->buffers || msg.num_Planes < 1 || msg.num_Planes > MAX_PLANES)
+        return -1;
+
+    frame->index = msg.index;
+    frame->sequence = msg.sequence;
+    frame->timestamp_Us = msg.timestamp_Us;
+    frame->num_Planes = msg.num_Planes;
+    frame->num_Sync = 0;
+    for (int p = 0; p < msg.num_Planes; ++p) {
+        if (msg.mem_Plane[p] < 0 || msg.mem_Plane[p] >= dc->mem_Planes)
+            return -1;
+        int i = msg.index * dc->mem_Planes + msg.mem_Plane[p];
+        if ((size_t) msg.offset[p] + msg.bytes[p] > dc->map_Len[i])
+            return -1;
+        frame->planes[p] = (unsigned char *) dc->maps[i] + msg.offset[p];
+        frame->plane_Bytes[p] = (int) msg.bytes[p];
+        if (p == 0 || msg.mem_Plane[p] != msg.mem_Plane[p - 1])
+            frame->sync_Fds[frame->num_Sync++] = dc->buf_Fds[i];
+    }
+
+    // keeps the cpu view coherent on non-coherent devices, a no-op where the buffer is cache coherent
+    for (int s = 0; s < frame->num_Sync; ++s) {
+        struct dma_buf_sync sync = {DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ};
+        ioctl(frame->sync_Fds[s], DMA_BUF_IOCTL_SYNC, &sync);
+    }
+    return 1;
+}
+
+/**
+  * @brief  Release shared frame
+  * @note   Hands the buffer back to the capture side, frame memory is invalid afterwards
+  * @param  dc      struct dmabufClient
+  * @param  frame   struct dmabufFrame
+  * @retval 0       If frame released
+**/
+int dmabufClientRelease(struct dmabufClient *dc, struct dmabufFrame *frame) {
+    struct dmabufReleaseMsg msg = {DMABUF_MSG_RELEASE, frame->index, frame->sequence};
+
+    if (frame->index < 0)
+        return 0;
+    for (int s = 0; s < frame->num_Sync; ++s) {
+        struct dma_buf_sync sync = {DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ};
+        ioctl(frame->sync_Fds[s], DMA_BUF_IOCTL_SYNC, &sync);
+    }
+    frame->index = -1;
+    return send(dc->fd, &msg, sizeof(msg), MSG_NOSIGNAL) == sizeof(msg) ? 0 : -1;
+}
+
+/**
+  * @brief  Disconnect from DMABUF server
+  * @note   Frames still held are released by the server when the socket closes
+  * @param  dc  struct dmabufClient
+  * @retval 0   If disconnected
+**/
+int dmabufClientClose(struct dmabufClient *dc) {
+    for (size_t i = 0; i < dc->maps.size(); ++i)
+        if (dc->maps[i] != nullptr)
+            munmap(dc->maps[i], dc->map_Len[i]);
+    for (int fd : dc->buf_Fds)
+        close(fd);
+    dc->maps.clear();
+    dc->map_Len.clear();
+    dc->buf_Fds.clear();
+    if (dc->fd >= 0)
+        close(dc->fd);
+    dc->fd = -1;
+    return 0;
+}
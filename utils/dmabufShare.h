@@ -0,0 +1,101 @@
+#ifndef USBCAM_DMABUF_SHARE_H
+#define USBCAM_DMABUF_SHARE_H
+
+#include "frameRing.h"
+#include "utils.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#define DMABUF_MAX_FDS 64
+#define DMABUF_MAX_CLIENTS 8
+#define DMABUF_CLIENT_HELD 2
+#define DMABUF_RESERVE 2
+#define DMABUF_IDLE_MS 2
+
+#define DMABUF_MSG_HELLO 1
+#define DMABUF_MSG_FRAME 2
+#define DMABUF_MSG_RELEASE 3
+
+struct dmabufHelloMsg {
+    uint32_t type;
+    int32_t buffers;
+    int32_t mem_Planes;
+    int32_t width;
+    int32_t height;
+    uint32_t pixel_Format;
+    int32_t pitch[MAX_PLANES];
+};
+
+struct dmabufFrameMsg {
+    uint32_t type;
+    int32_t index;
+    uint32_t sequence;
+    int32_t num_Planes;
+    int64_t timestamp_Us;
+    int32_t mem_Plane[MAX_PLANES];
+    uint32_t offset[MAX_PLANES];
+    uint32_t bytes[MAX_PLANES];
+};
+
+struct dmabufReleaseMsg {
+    uint32_t type;
+    int32_t index;
+    uint32_t sequence;
+};
+
+struct dmabufPeer {
+    int fd;
+    int held_Count;
+    std::vector<int> held;
+};
+
+struct dmabufServer {
+    struct videoDev *vd;
+    std::vector<int> buf_Fds;
+    int listen_Fd;
+    char socket_Path[108];
+    std::vector<struct dmabufPeer> peers;
+    frameRing<struct frameLease> pending;
+    std::thread thread;
+    std::atomic<bool> is_Running{false};
+    std::atomic<int> peer_Count{0};
+    std::atomic<unsigned long> frames_Shared{0};
+    std::atomic<unsigned long> frames_Skipped{0};
+};
+
+struct dmabufClient {
+    int fd;
+    int buffers;
+    int mem_Planes;
+    int width;
+    int height;
+    unsigned int pixel_Format;
+    int pitch[MAX_PLANES];
+    std::vector<int> buf_Fds;
+    std::vector<void *> maps;
+    std::vector<size_t> map_Len;
+};
+
+struct dmabufFrame {
+    int index;
+    unsigned int sequence;
+    int64_t timestamp_Us;
+    int num_Planes;
+    void *planes[MAX_PLANES];
+    int plane_Bytes[MAX_PLANES];
+    int sync_Fds[MAX_PLANES];
+    int num_Sync;
+};
+
+int dmabufServerInit(struct dmabufServer *ds, struct videoDev *vd, const char *socketPath);
+int dmabufServerFree(struct dmabufServer *ds);
+void dmabufServerTap(void *ctx, const struct frameLease *lease);
+
+int dmabufClientConnect(struct dmabufClient *dc, const char *socketPath);
+int dmabufClientNext(struct dmabufClient *dc, struct dmabufFrame *frame, int timeoutMs);
+int dmabufClientRelease(struct dmabufClient *dc, struct dmabufFrame *frame);
+int dmabufClientClose(struct dmabufClient *dc);
+
+#endif
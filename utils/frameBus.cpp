@@ -0,0 +1,338 @@
+#include "frameBus.h"
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FRAMEBUS_PAGE 4096
+
+/**
+  * @brief  Wake frame bus readers
+  * @note   Bumps header->wake and wakes every reader blocked on it in frameBusWait(), in any process. Readers map
+  *         the bus read-only and cannot register as waiters, so this is one syscall per frame whether anyone waits or not.
+  * @param  header  struct frameBusHeader
+  * @retval None
+**/
+static void wakeReaders(struct frameBusHeader *header) {
+    header->wake.fetch_add(1, std::memory_order_release);
+    syscall(SYS_futex, &header->wake, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+/**
+  * @brief  Create frame bus
+  * @note   Shared memory is laid out as header, slot descriptors, then slots of slotSize bytes each, all in /dev/shm/<name>.
+  * @note   An existing bus of the same name is replaced, readers still attached to it see it closed.
+  * @param  fw          struct frameBusWriter
+  * @param  name        const char *, shm_open name, e.g. "/usbCam"
+  * @param  pixelFormat unsigned int, V4L2_PIX_FMT_* of the published frames
+  * @param  width       int
+  * @param  height      int
+  * @param  slotSize    size_t, largest frame in bytes
+  * @param  slots       int, frames kept for slow readers, 0 for FRAMEBUS_SLOTS
+  * @retval 0           If bus created
+**/
+int frameBusCreate(struct frameBusWriter *fw, const char *name, unsigned int pixelFormat, int width, int height, size_t slotSize, int slots) {
+    size_t dataOffset;
+    void *map;
+    int fd;
+
+    if (slots <= 0)
+        slots = FRAMEBUS_SLOTS;
+    slotSize = (slotSize + FRAMEBUS_PAGE - 1) & ~(size_t) (FRAMEBUS_PAGE - 1);
+    dataOffset = (sizeof(struct frameBusHeader) + sizeof(struct frameBusSlot) * slots + FRAMEBUS_PAGE - 1) & ~(size_t) (FRAMEBUS_PAGE - 1);
+
+    shm_unlink(name);
+    fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("Error: Unable to create frame bus %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, (off_t) (dataOffset + slotSize * slots)) < 0) {
+        printf("Error: Unable to size frame bus %s: %s\n", name, strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    map = mmap(nullptr, dataOffset + slotSize * slots, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Error: Unable to map frame bus %s\n", name);
+        shm_unlink(name);
+        return -1;
+    }
+
+    snprintf(fw->name, sizeof(fw->name), "%s", name);
+    fw->map = map;
+    fw->map_Size = dataOffset + slotSize * slots;
+    fw->header = new (map) frameBusHeader();
+    fw->slots = (struct frameBusSlot *) ((unsigned char *) map + sizeof(struct frameBusHeader));
+    fw->data = (unsigned char *) map + dataOffset;
+    for (int i = 0; i < slots; ++i) {
+        new (&fw->slots[i]) frameBusSlot();
+        fw->slots[i].frame = UINT64_MAX;
+    }
+    fw->next = 0;
+    fw->frames_Too_Big = 0;
+
+    fw->header->version = FRAMEBUS_VERSION;
+    fw->header->slot_Count = slots;
+    fw->header->pixel_Format = pixelFormat;
+    fw->header->width = width;
+    fw->header->height = height;
+    fw->header->slot_Size = slotSize;
+    fw->header->data_Offset = dataOffset;
+    fw->header->is_Open.store(1, std::memory_order_relaxed);
+    // readers check the magic before anything else, make it the last thing they can see
+    std::atomic_thread_fence(std::memory_order_release);
+    fw->header->magic = FRAMEBUS_MAGIC;
+    printf("Frame bus %s: %d slots of %zu bytes\n", name, slots, slotSize);
+    return 0;
+}
+
+/**
+  * @brief  Destroy frame bus
+  * @note   Attached readers keep their mapping, they drain what is left and then see the bus closed
+  * @param  fw  struct frameBusWriter
+  * @retval 0   If bus destroyed
+**/
+int frameBusDestroy(struct frameBusWriter *fw) {
+    if (fw->map == nullptr)
+        return 0;
+
+    fw->header->is_Open.store(0, std::memory_order_release);
+    wakeReaders(fw->header);
+    munmap(fw->map, fw->map_Size);
+    shm_unlink(fw->name);
+    if (fw->frames_Too_Big > 0)
+        printf("Frame bus %s skipped %lu frames larger than a slot\n", fw->name, fw->frames_Too_Big.load());
+    fw->map = nullptr;
+    return 0;
+}
+
+/**
+  * @brief  Publish frame
+  * @note   Seqlock write: the slot sequence is odd while the slot is rewritten, readers that overlap it retry.
+  * @note   Never waits on readers, the oldest slot is always overwritten. Single publisher only.
+  * @note   Wakes readers blocked in frameBusWait() once the frame is visible.
+  * @param  fw          struct frameBusWriter
+  * @param  parts       const void *const [], frame bytes, gathered into the slot in order
+  * @param  sizes       const size_t []
+  * @param  count       int, number of parts
+  * @param  sequence    uint32_t
+  * @param  timestampUs int64_t
+  * @retval 0           If frame published, -1 if it does not fit a slot
+**/
+int frameBusPublish(struct frameBusWriter *fw, const void *const parts[], const size_t sizes[], int count, uint32_t sequence, int64_t timestampUs) {
+    struct frameBusHeader *header = fw->header;
+    size_t total = 0;
+
+    if (fw->map == nullptr)
+        return -1;
+    for (int i = 0; i < count; ++i)
+        total += sizes[i];
+    if (total > header->slot_Size) {
+        fw->frames_Too_Big.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    uint64_t index = fw->next % header->slot_Count;
+    struct frameBusSlot *slot = &fw->slots[index];
+    unsigned char *dst = fw->data + index * header->slot_Size;
+    uint64_t seq = slot->seq.load(std::memory_order_relaxed);
+
+    slot->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot->frame = fw->next;
+    slot->size = (uint32_t) total;
+    slot->sequence = sequence;
+    slot->timestamp_Us = timestampUs;
+    for (int i = 0; i < count; ++i) {
+        memcpy(dst, parts[i], sizes[i]);
+        dst += sizes[i];
+    }
+    slot->seq.store(seq + 2, std::memory_order_release);
+
+    header->head.store(++fw->next, std::memory_order_release);
+    wakeReaders(header);
+    return 0;
+}
+
+/**
+  * @brief  Publish lease
+  * @note   Separate memory planes are published back to back, split single-plane NV12 as it was captured
+  * @param  fw      struct frameBusWriter
+  * @param  lease   struct frameLease
+  * @retval 0       If frame published
+**/
+int frameBusPublishLease(struct frameBusWriter *fw, const struct frameLease *lease) {
+    const void *parts[MAX_PLANES] = {lease->mem};
+    size_t sizes[MAX_PLANES] = {(size_t) lease->bytes_Used};
+    int count = 1;
+    int64_t timestampUs = (int64_t) lease->timestamp.tv_sec * 1000000 + lease->timestamp.tv_usec;
+
+    // planes that start right after their predecessor live in one buffer, bytes_Used already covers them
+    for (int p = 1; p < lease->num_Planes; ++p) {
+        if ((const unsigned char *) lease->planes[p] < (const unsigned char *) lease->mem + lease->bytes_Used &&
+            lease->planes[p] >= lease->mem)
+            continue;
+        parts[count] = lease->planes[p];
+        sizes[count++] = lease->plane_Bytes[p];
+    }
+    return frameBusPublish(fw, parts, sizes, count, lease->sequence, timestampUs);
+}
+
+/**
+  * @brief  Frame bus capture tap
+  * @note   Publishes every captured frame untouched, the copy into shared memory happens on the capture thread
+  * @param  ctx     void *, struct frameBusWriter
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+void frameBusTap(void *ctx, const struct frameLease *lease) {
+    frameBusPublishLease((struct frameBusWriter *) ctx, lease);
+}
+
+/**
+  * @brief  Attach to frame bus
+  * @note   Maps the bus read-only, reading starts with the next frame published
+  * @param  fr      struct frameBusReader
+  * @param  name    const char *
+  * @retval 0       If attached
+**/
+int frameBusAttach(struct frameBusReader *fr, const char *name) {
+    struct stat st {};
+    const struct frameBusHeader *header;
+    void *map;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        printf("Error: Unable to open frame bus %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct frameBusHeader)) {
+        close(fd);
+        return -1;
+    }
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    header = (const struct frameBusHeader *) map;
+    bool valid = header->magic == FRAMEBUS_MAGIC;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!valid || header->version != FRAMEBUS_VERSION || header->slot_Count == 0 ||
+        header->data_Offset + header->slot_Size * header->slot_Count > (uint64_t) st.st_size) {
+        printf("Error: %s is not a frame bus this version can read\n", name);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    fr->map = map;
+    fr->map_Size = st.st_size;
+    fr->header = header;
+    fr->slots = (const struct frameBusSlot *) ((const unsigned char *) map + sizeof(struct frameBusHeader));
+    fr->data = (const unsigned char *) map + header->data_Offset;
+    fr->next = header->head.load(std::memory_order_acquire);
+    fr->buf.resize(header->slot_Size);
+    fr->frames_Read = 0;
+    fr->frames_Missed = 0;
+    fr->retries = 0;
+    return 0;
+}
+
+/**
+  * @brief  Detach from frame bus
+  * @param  fr  struct frameBusReader
+  * @retval 0   If detached
+**/
+int frameBusDetach(struct frameBusReader *fr) {
+    if (fr->map == nullptr)
+        return 0;
+    munmap((void *) fr->map, fr->map_Size);
+    fr->map = nullptr;
+    return 0;
+}
+
+/**
+  * @brief  Read frame
+  * @note   Copies the next frame into the reader's own buffer under the slot seqlock, no syscalls and no writes to the bus.
+  * @note   A reader that fell a whole ring behind skips to the oldest frame still intact and counts the rest as missed.
+  * @param  fr      struct frameBusReader
+  * @param  frame   struct frameBusFrame, data stays valid until the next read
+  * @retval 1       If a frame was read, 0 if none is pending, -1 if the bus was closed
+**/
+int frameBusRead(struct frameBusReader *fr, struct frameBusFrame *frame) {
+    const struct frameBusHeader *header = fr->header;
+    uint64_t count = header->slot_Count;
+    uint64_t head = header->head.load(std::memory_order_acquire);
+
+    while (fr->next < head) {
+        // the publisher may already be rewriting slot head % count, stay one slot clear of it
+        if (head - fr->next >= count) {
+            fr->frames_Missed += head - count + 1 - fr->next;
+            fr->next = head - count + 1;
+        }
+
+        uint64_t index = fr->next % count;
+        const struct frameBusSlot *slot = &fr->slots[index];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if ((seq & 1) == 0) {
+            uint64_t number = slot->frame;
+            uint32_t size = slot->size;
+            uint32_t sequence = slot->sequence;
+            int64_t timestampUs = slot->timestamp_Us;
+            if (size <= header->slot_Size)
+                memcpy(fr->buf.data(), fr->data + index * header->slot_Size, size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot->seq.load(std::memory_order_relaxed) == seq && number == fr->next && size <= header->slot_Size) {
+                frame->data = fr->buf.data();
+                frame->size = size;
+                frame->sequence = sequence;
+                frame->timestamp_Us = timestampUs;
+                frame->frame = number;
+                fr->next++;
+                fr->frames_Read++;
+                return 1;
+            }
+        }
+        // overwritten under us, the publisher has lapped this slot
+        fr->retries++;
+        head = header->head.load(std::memory_order_acquire);
+    }
+    return header->is_Open.load(std::memory_order_acquire) ? 0 : -1;
+}
+
+/**
+  * @brief  Wait for frame
+  * @note   Blocks on a futex on header->wake between reads. The word is sampled before each read, so a frame
+  *         published in between changes it and the wait returns at once instead of missing the wakeup.
+  * @param  fr          struct frameBusReader
+  * @param  frame       struct frameBusFrame
+  * @param  timeoutMs   int
+  * @retval 1           If a frame was read, 0 on timeout, -1 if the bus was closed
+**/
+int frameBusWait(struct frameBusReader *fr, struct frameBusFrame *frame, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    int ret;
+
+    while (true) {
+        uint32_t wake = fr->header->wake.load(std::memory_order_acquire);
+        if ((ret = frameBusRead(fr, frame)) != 0)
+            break;
+        auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0)
+            break;
+        struct timespec timeout = {(time_t) (left / 1000000000), (long) (left % 1000000000)};
+        syscall(SYS_futex, &fr->header->wake, FUTEX_WAIT, wake, &timeout, nullptr, 0);
+    }
+    return ret;
+}
@@ -0,0 +1,81 @@
+#ifndef USBCAM_FRAME_BUS_H
+#define USBCAM_FRAME_BUS_H
+
+#include "utils.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#define FRAMEBUS_MAGIC 0x53554246
+#define FRAMEBUS_VERSION 2
+#define FRAMEBUS_SLOTS 8
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "frame bus atomics must be address free");
+static_assert(sizeof(std::atomic<uint32_t>) == 4 && std::atomic<uint32_t>::is_always_lock_free, "futex word must be a plain 32-bit int");
+
+struct frameBusHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot_Count;
+    uint32_t pixel_Format;
+    int32_t width;
+    int32_t height;
+    uint64_t slot_Size;
+    uint64_t data_Offset;
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> is_Open;
+    std::atomic<uint32_t> wake;
+};
+
+struct alignas(64) frameBusSlot {
+    std::atomic<uint64_t> seq;
+    uint64_t frame;
+    uint32_t size;
+    uint32_t sequence;
+    int64_t timestamp_Us;
+};
+
+struct frameBusFrame {
+    const unsigned char *data;
+    uint32_t size;
+    uint32_t sequence;
+    int64_t timestamp_Us;
+    uint64_t frame;
+};
+
+struct frameBusWriter {
+    char name[64];
+    void *map;
+    size_t map_Size;
+    struct frameBusHeader *header;
+    struct frameBusSlot *slots;
+    unsigned char *data;
+    uint64_t next;
+    std::atomic<unsigned long> frames_Too_Big{0};
+};
+
+struct frameBusReader {
+    const void *map;
+    size_t map_Size;
+    const struct frameBusHeader *header;
+    const struct frameBusSlot *slots;
+    const unsigned char *data;
+    uint64_t next;
+    std::vector<unsigned char> buf;
+    unsigned long frames_Read;
+    unsigned long frames_Missed;
+    unsigned long retries;
+};
+
+int frameBusCreate(struct frameBusWriter *fw, const char *name, unsigned int pixelFormat, int width, int height, size_t slotSize, int slots);
+int frameBusDestroy(struct frameBusWriter *fw);
+int frameBusPublish(struct frameBusWriter *fw, const void *const parts[], const size_t sizes[], int count, uint32_t sequence, int64_t timestampUs);
+int frameBusPublishLease(struct frameBusWriter *fw, const struct frameLease *lease);
+void frameBusTap(void *ctx, const struct frameLease *lease);
+
+int frameBusAttach(struct frameBusReader *fr, const char *name);
+int frameBusDetach(struct frameBusReader *fr);
+int frameBusRead(struct frameBusReader *fr, struct frameBusFrame *frame);
+int frameBusWait(struct frameBusReader *fr, struct frameBusFrame *frame, int timeoutMs);
+
+#endif
@@ -0,0 +1,121 @@
+#include "framePool.h"
+#include <cstdio>
+
+/**
+  * @brief  Move frame
+  * @note   Takes over the other frame's slot and metadata, our own slot goes back to its pool first
+  * @param  other   videoFrame &&, left empty
+  * @retval *this
+**/
+videoFrame &videoFrame::operator=(videoFrame &&other) noexcept {
+    if (this == &other)
+        return *this;
+    reset();
+    pixel_Format = other.pixel_Format;
+    width = other.width;
+    height = other.height;
+    pitch = other.pitch;
+    size = other.size;
+    sequence = other.sequence;
+    timestamp_Us = other.timestamp_Us;
+    pool = other.pool;
+    slot = other.slot;
+    storage = other.storage;
+    other.pool = nullptr;
+    other.slot = -1;
+    other.storage = nullptr;
+    other.size = 0;
+    return *this;
+}
+
+/**
+  * @brief  Reset frame
+  * @note   Returns the slot to its pool, the frame is empty afterwards. Safe from any thread.
+  * @retval None
+**/
+void videoFrame::reset() {
+    if (pool == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> guard(pool->lock);
+    pool->free_Slots.push_back(slot);
+    pool->in_Use--;
+    pool = nullptr;
+    slot = -1;
+    storage = nullptr;
+    size = 0;
+}
+
+/**
+  * @brief  Frame capacity
+  * @retval Bytes the frame can hold, 0 if it is empty
+**/
+size_t videoFrame::capacity() const {
+    return pool != nullptr ? pool->slot_Size : 0;
+}
+
+/**
+  * @brief  Init frame pool
+  * @note   All storage is allocated here, acquiring and resetting frames never allocates
+  * @param  fp          struct framePool
+  * @param  frameSize   size_t, bytes per frame
+  * @param  frames      int, frames that can be out at the same time
+  * @retval 0           If pool initialised
+**/
+int framePoolInit(struct framePool *fp, size_t frameSize, int frames) {
+    if (frames <= 0 || frameSize == 0)
+        return -1;
+
+    fp->slot_Size = (frameSize + FRAMEPOOL_ALIGN - 1) & ~(size_t) (FRAMEPOOL_ALIGN - 1);
+    fp->arena.assign(fp->slot_Size * frames + FRAMEPOOL_ALIGN, 0);
+    fp->base = fp->arena.data() + (FRAMEPOOL_ALIGN - (uintptr_t) fp->arena.data() % FRAMEPOOL_ALIGN) % FRAMEPOOL_ALIGN;
+    fp->free_Slots.clear();
+    for (int i = frames - 1; i >= 0; --i)
+        fp->free_Slots.push_back(i);
+    fp->in_Use = 0;
+    fp->max_In_Use = 0;
+    return 0;
+}
+
+/**
+  * @brief  Free frame pool
+  * @note   Every frame has to be reset first
+  * @param  fp  struct framePool
+  * @retval 0   If pool freed
+**/
+int framePoolFree(struct framePool *fp) {
+    std::lock_guard<std::mutex> guard(fp->lock);
+
+    if (fp->in_Use > 0) {
+        printf("Error: Frame pool freed with %d frames still out\n", fp->in_Use);
+        return -1;
+    }
+    fp->arena.clear();
+    fp->arena.shrink_to_fit();
+    fp->free_Slots.clear();
+    return 0;
+}
+
+/**
+  * @brief  Acquire frame
+  * @note   Hands out a free slot, a frame that already holds one keeps it. Metadata is left as it was.
+  * @param  fp      struct framePool
+  * @param  frame   videoFrame
+  * @retval 0       If frame holds a slot, -1 if the pool is exhausted
+**/
+int framePoolAcquire(struct framePool *fp, videoFrame &frame) {
+    if (frame.pool == fp)
+        return 0;
+    frame.reset();
+
+    std::lock_guard<std::mutex> guard(fp->lock);
+    if (fp->free_Slots.empty())
+        return -1;
+    frame.slot = fp->free_Slots.back();
+    fp->free_Slots.pop_back();
+    frame.pool = fp;
+    frame.storage = fp->base + (size_t) frame.slot * fp->slot_Size;
+    if (++fp->in_Use > fp->max_In_Use)
+        fp->max_In_Use = fp->in_Use;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#ifndef USBCAM_FRAME_POOL_H
+#define USBCAM_FRAME_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#define FRAMEPOOL_ALIGN 64
+
+struct framePool;
+
+/**
+  * @brief  Pooled video frame
+  * @note   Owns one slot of a framePool plus the metadata describing what is in it. Move-only, so a slot never has
+  *         two owners. The decode thread acquires one per capture and moves it through rectification into the
+  *         preview tripleBuffer, the render thread resets it once shown. Capture hands out frameLeases on the
+  *         driver's buffers instead so it never copies.
+  * @note   The slot goes back to its pool on reset() or destruction, the pool has to outlive every frame taken from it.
+**/
+class videoFrame {
+public:
+    videoFrame() = default;
+    videoFrame(const videoFrame &) = delete;
+    videoFrame &operator=(const videoFrame &) = delete;
+    videoFrame(videoFrame &&other) noexcept { *this = static_cast<videoFrame &&>(other); }
+    videoFrame &operator=(videoFrame &&other) noexcept;
+    ~videoFrame() { reset(); }
+
+    void reset();
+    unsigned char *data() const { return storage; }
+    size_t capacity() const;
+    explicit operator bool() const { return storage != nullptr; }
+
+    unsigned int pixel_Format = 0;
+    int width = 0;
+    int height = 0;
+    int pitch = 0;
+    size_t size = 0;
+    unsigned int sequence = 0;
+    int64_t timestamp_Us = 0;
+
+private:
+    friend int framePoolAcquire(struct framePool *fp, videoFrame &frame);
+
+    struct framePool *pool = nullptr;
+    int slot = -1;
+    unsigned char *storage = nullptr;
+};
+
+struct framePool {
+    std::vector<unsigned char> arena;
+    unsigned char *base;
+    size_t slot_Size;
+    std::mutex lock;
+    std::vector<int> free_Slots;
+    int in_Use;
+    int max_In_Use;
+};
+
+int framePoolInit(struct framePool *fp, size_t frameSize, int frames);
+int framePoolFree(struct framePool *fp);
+int framePoolAcquire(struct framePool *fp, videoFrame &frame);
+
+#endif
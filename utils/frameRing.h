@@ -0,0 +1,71 @@
+#ifndef USBCAM_FRAME_RING_H
+#define USBCAM_FRAME_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+  * @brief  Bounded lock-free single-producer/single-consumer ring
+  * @note   Exactly one thread may push() and exactly one other thread may pop().
+  * @note   Capacity is rounded up to a power of two, resize() is only legal while both sides are idle.
+**/
+template<typename T>
+class frameRing {
+public:
+    explicit frameRing(size_t capacity = 0) { resize(capacity); }
+
+    frameRing(const frameRing &) = delete;
+    frameRing &operator=(const frameRing &) = delete;
+
+    void resize(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        slots.assign(size, T{});
+        mask = size - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+      * @brief  Push item
+      * @note   Producer side only
+      * @param  item    const T &
+      * @retval true    If item pushed, false if ring is full
+    **/
+    bool push(const T &item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) > mask)
+            return false;
+        slots[h & mask] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+      * @brief  Pop item
+      * @note   Consumer side only
+      * @param  item    T &
+      * @retval true    If item popped, false if ring is empty
+    **/
+    bool pop(T &item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire))
+            return false;
+        item = slots[t & mask];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+    size_t capacity() const { return mask + 1; }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef USBCAM_MJPEG_FILE_H
+#define USBCAM_MJPEG_FILE_H
+
+#include <cstdint>
+
+#define MJPEG_FILE_MAGIC 0x4a4d4355  /* "UCMJ" */
+#define MJPEG_FRAME_MAGIC 0x4d524655 /* "UFRM" */
+#define MJPEG_FILE_VERSION 1
+
+/**
+  * @brief  Recorded MJPEG container
+  * @note   mjpegFileHeader, then per frame an mjpegFrameHeader followed by the untouched JPEG bytes,
+  *         then an mjpegIndexEntry per frame at index_Offset. All fields are little endian.
+  * @note   index_Offset and frame_Count stay 0 until the recording is closed, readers then walk the frame headers.
+**/
+struct mjpegFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixel_Format;
+    uint32_t frame_Count;
+    uint64_t index_Offset;
+};
+
+struct mjpegFrameHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t sequence;
+    uint32_t reserved;
+    int64_t timestamp_Us;
+};
+
+struct mjpegIndexEntry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t sequence;
+    int64_t timestamp_Us;
+};
+
+static_assert(sizeof(struct mjpegFileHeader) == 32, "mjpegFileHeader layout");
+static_assert(sizeof(struct mjpegFrameHeader) == 24, "mjpegFrameHeader layout");
+static_assert(sizeof(struct mjpegIndexEntry) == 24, "mjpegIndexEntry layout");
+
+#endif
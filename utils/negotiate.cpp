@@ -0,0 +1,342 @@
+#include "negotiate.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+/**
+  * @brief  Score frame size
+  * @note   Lower is better, exact match first, then the smallest size covering the request, then the largest below it
+  * @param  w       unsigned int, candidate width
+  * @param  h       unsigned int, candidate height
+  * @param  wantW   unsigned int
+  * @param  wantH   unsigned int
+  * @retval Score
+**/
+static long long sizeScore(unsigned int w, unsigned int h, unsigned int wantW, unsigned int wantH) {
+    long long area = (long long) w * h, wantArea = (long long) wantW * wantH;
+
+    if (w == wantW && h == wantH)
+        return 0;
+    if (w >= wantW && h >= wantH)
+        return 1 + area - wantArea;
+    return (1LL << 40) + wantArea - area;
+}
+
+/**
+  * @brief  Score frame interval
+  * @note   Lower is better, the slowest rate reaching wantFps first, then the fastest rate below it
+  * @param  interval    struct v4l2_fract, seconds per frame
+  * @param  wantFps     int, 0 for as fast as possible
+  * @retval Score
+**/
+static long long intervalScore(struct v4l2_fract interval, int wantFps) {
+    if (interval.numerator == 0 || interval.denominator == 0)
+        return LLONG_MAX;
+    // millihertz keeps fractional rates like 30000/1001 apart
+    long long mHz = (long long) interval.denominator * 1000 / interval.numerator;
+    if (wantFps <= 0)
+        return -mHz;
+    if (mHz >= wantFps * 1000LL)
+        return mHz - wantFps * 1000LL;
+    return (1LL << 40) + wantFps * 1000LL - mHz;
+}
+
+/**
+  * @brief  Best interval of a frame size
+  * @note   VIDIOC_ENUM_FRAMEINTERVALS, stepwise ranges are probed at wantFps and at both ends
+  * @param  vd          struct videoDev
+  * @param  w           unsigned int
+  * @param  h           unsigned int
+  * @param  wantFps     int
+  * @param  best        struct v4l2_fract, set to the best interval
+  * @retval 0           If the size has at least one interval
+**/
+static int bestInterval(struct videoDev *vd, unsigned int w, unsigned int h, int wantFps, struct v4l2_fract *best) {
+    struct v4l2_frmivalenum ival {};
+    long long bestScore = LLONG_MAX;
+
+    ival.pixel_format = vd->raw_Format;
+    ival.width = w;
+    ival.height = h;
+    for (ival.index = 0; ioctl(vd->fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ival.index++) {
+        struct v4l2_fract candidates[3];
+        int count = 0;
+
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            candidates[count++] = ival.discrete;
+        } else {
+            candidates[count++] = ival.stepwise.min;
+            candidates[count++] = ival.stepwise.max;
+            if (wantFps > 0) {
+                struct v4l2_fract want {1, (unsigned int) wantFps};
+                // min and max are intervals, the fastest rate is the smallest interval
+                if ((unsigned long long) want.numerator * ival.stepwise.min.denominator >= (unsigned long long) ival.stepwise.min.numerator * want.denominator &&
+                    (unsigned long long) want.numerator * ival.stepwise.max.denominator <= (unsigned long long) ival.stepwise.max.numerator * want.denominator)
+                    candidates[count++] = want;
+            }
+        }
+        for (int i = 0; i < count; ++i) {
+            long long score = intervalScore(candidates[i], wantFps);
+            if (score < bestScore) {
+                bestScore = score;
+                *best = candidates[i];
+            }
+        }
+        if (ival.type != V4L2_FRMIVAL_TYPE_DISCRETE)
+            break;
+    }
+    return bestScore == LLONG_MAX ? -1 : 0;
+}
+
+/**
+  * @brief  Enumerate formats
+  * @note   Walks VIDIOC_ENUM_FRAMESIZES for vd->raw_Format and every interval of each size
+  * @param  vd      struct videoDev
+  * @param  choice  struct formatChoice, set to the best match for raw_W x raw_H at raw_Fps
+  * @retval 0       If the device lists any frame size for the format
+**/
+static int enumerateFormats(struct videoDev *vd, struct formatChoice *choice) {
+    struct v4l2_frmsizeenum size {};
+    long long bestSize = LLONG_MAX, bestRate = LLONG_MAX;
+    unsigned int wantW = vd->raw_W, wantH = vd->raw_H;
+
+    size.pixel_format = vd->raw_Format;
+    for (size.index = 0; ioctl(vd->fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++) {
+        unsigned int w, h;
+
+        if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            w = size.discrete.width;
+            h = size.discrete.height;
+        } else {
+            // clamp the request into the range and snap it to the step
+            const struct v4l2_frmsize_stepwise &sw = size.stepwise;
+            w = std::min(std::max(wantW, sw.min_width), sw.max_width);
+            h = std::min(std::max(wantH, sw.min_height), sw.max_height);
+            if (sw.step_width > 0)
+                w = sw.min_width + (w - sw.min_width) / sw.step_width * sw.step_width;
+            if (sw.step_height > 0)
+                h = sw.min_height + (h - sw.min_height) / sw.step_height * sw.step_height;
+        }
+
+        struct v4l2_fract interval {0, 0};
+        long long sizeRank = sizeScore(w, h, wantW, wantH);
+        long long rateRank = LLONG_MAX;
+        if (bestInterval(vd, w, h, vd->raw_Fps, &interval) == 0)
+            rateRank = intervalScore(interval, vd->raw_Fps);
+        printf("  %ux%u @ %u/%u s\n", w, h, interval.numerator, interval.denominator);
+
+        // resolution decides, the frame rate breaks ties between equally good sizes
+        if (sizeRank < bestSize || (sizeRank == bestSize && rateRank < bestRate)) {
+            bestSize = sizeRank;
+            bestRate = rateRank;
+            *choice = {w, h, (unsigned int) vd->raw_Format, interval};
+        }
+        if (size.type != V4L2_FRMSIZE_TYPE_DISCRETE)
+            break;
+    }
+    return bestSize == LLONG_MAX ? -1 : 0;
+}
+
+/**
+  * @brief  Cache file path
+  * @note   $XDG_CACHE_HOME or ~/.cache, one file per driver and bus position
+  * @param  vd      struct videoDev
+  * @param  path    char *
+  * @param  len     size_t
+  * @retval 0       If a cache directory is available
+**/
+static int cachePath(struct videoDev *vd, char *path, size_t len) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    char dir[200];
+
+    if (base != nullptr && base[0] != '\0')
+        snprintf(dir, sizeof(dir), "%s/usbCam", base);
+    else if ((base = getenv("HOME")) != nullptr)
+        snprintf(dir, sizeof(dir), "%s/.cache/usbCam", base);
+    else
+        return -1;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    int n = snprintf(path, len, "%s/%s-%s.fmt", dir, (const char *) vd->cap.driver, (const char *) vd->cap.bus_info);
+    for (size_t i = strlen(dir) + 1; i < (size_t) n && i < len; ++i) {
+        if (path[i] == '/' || path[i] == ' ' || path[i] == ':')
+            path[i] = '_';
+    }
+    return 0;
+}
+
+/**
+  * @brief  Card name
+  * @note   vd->cap.card with spaces replaced, so it reads back as one word
+  * @param  vd      struct videoDev
+  * @param  card    char *
+  * @param  len     size_t
+  * @retval None
+**/
+static void cardName(struct videoDev *vd, char *card, size_t len) {
+    snprintf(card, len, "%s", (const char *) vd->cap.card);
+    for (char *c = card; *c; ++c) {
+        if (*c == ' ')
+            *c = '_';
+    }
+}
+
+/**
+  * @brief  Load cached choice
+  * @note   Only a cache entry for the same card and the same request is used
+  * @param  vd      struct videoDev
+  * @param  choice  struct formatChoice
+  * @retval 0       If a cached choice was found
+**/
+static int loadCachedChoice(struct videoDev *vd, struct formatChoice *choice) {
+    char path[320], card[64];
+    unsigned int version, wantW, wantH, wantFormat;
+    int wantFps;
+    FILE *file;
+
+    if (cachePath(vd, path, sizeof(path)) < 0 || (file = fopen(path, "r")) == nullptr)
+        return -1;
+    int ret = fscanf(file, "%u %63s %u %u %u %d %u %u %u %u %u", &version, card, &wantW, &wantH, &wantFormat, &wantFps,
+                     &choice->width, &choice->height, &choice->pixel_Format, &choice->interval.numerator, &choice->interval.denominator);
+    fclose(file);
+
+    char ourCard[64];
+    cardName(vd, ourCard, sizeof(ourCard));
+    if (ret != 11 || version != NEGOTIATE_CACHE_VERSION || strcmp(card, ourCard) != 0 || wantW != (unsigned int) vd->raw_W ||
+        wantH != (unsigned int) vd->raw_H || wantFormat != (unsigned int) vd->raw_Format || wantFps != vd->raw_Fps)
+        return -1;
+    return 0;
+}
+
+/**
+  * @brief  Save cached choice
+  * @note   Failing to write the cache is not an error
+  * @param  vd      struct videoDev
+  * @param  want    struct formatChoice, what was asked for
+  * @param  choice  struct formatChoice, what was granted
+  * @retval None
+**/
+static void saveCachedChoice(struct videoDev *vd, const struct formatChoice *want, const struct formatChoice *choice) {
+    char path[320], card[64];
+    FILE *file;
+
+    if (cachePath(vd, path, sizeof(path)) < 0 || (file = fopen(path, "w")) == nullptr)
+        return;
+    cardName(vd, card, sizeof(card));
+    fprintf(file, "%u %s %u %u %u %d %u %u %u %u %u\n", NEGOTIATE_CACHE_VERSION, card, want->width, want->height, want->pixel_Format,
+            (int) want->interval.denominator, choice->width, choice->height, choice->pixel_Format, choice->interval.numerator,
+            choice->interval.denominator);
+    fclose(file);
+}
+
+/**
+  * @brief  Apply choice
+  * @note   VIDIOC_S_FMT then VIDIOC_S_PARM on vd->buf_Type, writes what the driver granted back into vd
+  * @param  vd      struct videoDev
+  * @param  choice  struct formatChoice, updated to the granted format
+  * @retval 0       If the format was accepted
+**/
+static int applyChoice(struct videoDev *vd, struct formatChoice *choice) {
+    struct v4l2_streamparm parm {};
+    int mplane = vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+
+    memset(&vd->fmt, 0, sizeof(struct v4l2_format));
+    vd->fmt.type = vd->buf_Type;
+    if (mplane) {
+        vd->fmt.fmt.pix_mp.width = choice->width;
+        vd->fmt.fmt.pix_mp.height = choice->height;
+        vd->fmt.fmt.pix_mp.pixelformat = choice->pixel_Format;
+        vd->fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+    } else {
+        vd->fmt.fmt.pix.width = choice->width;
+        vd->fmt.fmt.pix.height = choice->height;
+        vd->fmt.fmt.pix.pixelformat = choice->pixel_Format;
+        vd->fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    }
+    if (ioctl(vd->fd, VIDIOC_S_FMT, &vd->fmt) < 0) {
+        printf("Error: Unable to set format\n");
+        return -1;
+    }
+
+    memset(vd->plane_Pitch, 0, sizeof(vd->plane_Pitch));
+    if (mplane) {
+        const struct v4l2_pix_format_mplane &mp = vd->fmt.fmt.pix_mp;
+        choice->width = mp.width;
+        choice->height = mp.height;
+        choice->pixel_Format = mp.pixelformat;
+        vd->raw_Size = 0;
+        for (int p = 0; p < mp.num_planes && p < MAX_PLANES; ++p) {
+            vd->plane_Pitch[p] = (int) mp.plane_fmt[p].bytesperline;
+            vd->raw_Size += (int) mp.plane_fmt[p].sizeimage;
+        }
+    } else {
+        choice->width = vd->fmt.fmt.pix.width;
+        choice->height = vd->fmt.fmt.pix.height;
+        choice->pixel_Format = vd->fmt.fmt.pix.pixelformat;
+        vd->raw_Size = (int) vd->fmt.fmt.pix.sizeimage;
+        // semi-planar CbCr rows are as wide as the luma rows
+        vd->plane_Pitch[0] = vd->plane_Pitch[1] = (int) vd->fmt.fmt.pix.bytesperline;
+    }
+
+    parm.type = vd->buf_Type;
+    if (choice->interval.numerator != 0 && choice->interval.denominator != 0) {
+        parm.parm.capture.timeperframe = choice->interval;
+        if (ioctl(vd->fd, VIDIOC_S_PARM, &parm) < 0)
+            printf("Warning: Unable to set frame interval %u/%u\n", choice->interval.numerator, choice->interval.denominator);
+    }
+    if (ioctl(vd->fd, VIDIOC_G_PARM, &parm) == 0 && parm.parm.capture.timeperframe.denominator != 0)
+        choice->interval = parm.parm.capture.timeperframe;
+
+    vd->raw_W = (int) choice->width;
+    vd->raw_H = (int) choice->height;
+    vd->raw_Format = (int) choice->pixel_Format;
+    vd->raw_Interval = choice->interval;
+    if (choice->interval.numerator != 0)
+        vd->raw_Fps = (int) ((choice->interval.denominator + choice->interval.numerator / 2) / choice->interval.numerator);
+    return 0;
+}
+
+/**
+  * @brief  Negotiate format
+  * @note   Picks the frame size and interval closest to raw_W x raw_H at raw_Fps (0 for the fastest),
+  *         sets them and writes the granted values back into raw_W, raw_H, raw_Format, raw_Size, raw_Interval and raw_Fps.
+  * @note   The choice is cached per device, a cache hit skips the enumeration. A cached choice the driver no longer
+  *         grants as is falls back to a full enumeration.
+  * @param  vd  struct videoDev
+  * @retval 0   If a format was set
+**/
+int negotiateFormat(struct videoDev *vd) {
+    struct formatChoice want {(unsigned int) vd->raw_W, (unsigned int) vd->raw_H, (unsigned int) vd->raw_Format, {1, (unsigned int) vd->raw_Fps}};
+    struct formatChoice choice {};
+
+    if (loadCachedChoice(vd, &choice) == 0) {
+        struct formatChoice cached = choice;
+        if (applyChoice(vd, &choice) == 0 && choice.width == cached.width && choice.height == cached.height &&
+            choice.pixel_Format == cached.pixel_Format) {
+            printf("Format %dx%d @ %d fps (cached)\n", vd->raw_W, vd->raw_H, vd->raw_Fps);
+            return 0;
+        }
+        vd->raw_W = (int) want.width;
+        vd->raw_H = (int) want.height;
+        vd->raw_Format = (int) want.pixel_Format;
+        vd->raw_Fps = (int) want.interval.denominator;
+    }
+
+    printf("Frame sizes:\n");
+    if (enumerateFormats(vd, &choice) < 0) {
+        // drivers without ENUM_FRAMESIZES take the request as is
+        choice = want;
+        if (vd->raw_Fps <= 0)
+            choice.interval = {0, 0};
+    }
+    if (applyChoice(vd, &choice) < 0)
+        return -1;
+    if (choice.width != want.width || choice.height != want.height)
+        printf("Requested %ux%u, granted %dx%d\n", want.width, want.height, vd->raw_W, vd->raw_H);
+    printf("Format %dx%d @ %d fps\n", vd->raw_W, vd->raw_H, vd->raw_Fps);
+    saveCachedChoice(vd, &want, &choice);
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef USBCAM_NEGOTIATE_H
+#define USBCAM_NEGOTIATE_H
+
+#include "utils.h"
+
+#define NEGOTIATE_CACHE_VERSION 1
+
+struct formatChoice {
+    unsigned int width;
+    unsigned int height;
+    unsigned int pixel_Format;
+    struct v4l2_fract interval;
+};
+
+int negotiateFormat(struct videoDev *vd);
+
+#endif
@@ -0,0 +1,223 @@
+#include "preTrigger.h"
+#include <chrono>
+#include <climits>
+
+#define NO_ROOM ((size_t) -1)
+
+/**
+  * @brief  Place frame
+  * @note   Frames are kept contiguous in the arena, oldest at frames[tail], next free byte at write_Pos. Call with lock held.
+  * @param  pt      struct preTrigger
+  * @param  size    size_t
+  * @retval Arena offset for the frame, NO_ROOM if older frames have to go first
+**/
+static size_t placeFrame(struct preTrigger *pt, size_t size) {
+    if (pt->head == pt->tail)
+        return 0;
+
+    size_t oldest = pt->frames[pt->tail % pt->frames.size()].offset;
+    if (oldest < pt->write_Pos) {
+        if (pt->write_Pos + size <= pt->arena.size())
+            return pt->write_Pos;
+        return size <= oldest ? 0 : NO_ROOM;
+    }
+    return pt->write_Pos + size <= oldest ? pt->write_Pos : NO_ROOM;
+}
+
+/**
+  * @brief  Start clip
+  * @note   Opens the next clip file and pins everything buffered so far
+  * @param  pt  struct preTrigger
+  * @retval 0   If clip started
+**/
+static int startClip(struct preTrigger *pt) {
+    char fileName[160];
+
+    snprintf(fileName, sizeof(fileName), pt->path_Format, pt->clip_Count++);
+    if (mjpegWriterOpen(&pt->writer, fileName, pt->width, pt->height) < 0)
+        return -1;
+
+    std::lock_guard<std::mutex> guard(pt->lock);
+    pt->flush_Next = pt->tail;
+    pt->flush_Until_Us = pt->head == pt->tail ? -1 : pt->frames[(pt->head - 1) % pt->frames.size()].timestamp_Us + pt->post_Us;
+    pt->is_Flushing = 1;
+    printf("Clip %s triggered, %zu frames buffered\n", fileName, pt->head - pt->tail);
+    return 0;
+}
+
+/**
+  * @brief  Finish clip
+  * @note   Writes the clip index and unpins the ring
+  * @param  pt  struct preTrigger
+  * @retval None
+**/
+static void finishClip(struct preTrigger *pt) {
+    size_t frames = pt->writer.index.size();
+
+    if (mjpegWriterClose(&pt->writer) < 0)
+        printf("Error: Clip write failed\n");
+    else
+        printf("Clip %d written, %zu frames\n", pt->clip_Count - 1, frames);
+
+    std::lock_guard<std::mutex> guard(pt->lock);
+    pt->is_Flushing = 0;
+}
+
+/**
+  * @brief  Flush loop
+  * @note   Runs on the flush thread, writes the pinned frames of a triggered clip until flush_Until_Us has been reached.
+  * @note   Another trigger while flushing extends the clip.
+  * @param  pt  struct preTrigger
+  * @retval None
+**/
+static void flushLoop(struct preTrigger *pt) {
+    struct preTriggerFrame frame {};
+    bool ready;
+
+    while (true) {
+        if (!pt->is_Flushing) {
+            if (!pt->is_Running.load(std::memory_order_acquire))
+                break;
+            if (pt->trigger_Pending.exchange(0) == 0 || startClip(pt) < 0)
+                std::this_thread::sleep_for(std::chrono::microseconds(PRETRIGGER_IDLE_US));
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> guard(pt->lock);
+            if (pt->trigger_Pending.exchange(0) != 0 && pt->head != pt->tail)
+                pt->flush_Until_Us = pt->frames[(pt->head - 1) % pt->frames.size()].timestamp_Us + pt->post_Us;
+            ready = pt->flush_Next != pt->head;
+            if (ready)
+                frame = pt->frames[pt->flush_Next % pt->frames.size()];
+        }
+        if (!ready) {
+            if (!pt->is_Running.load(std::memory_order_acquire))
+                finishClip(pt);
+            else
+                std::this_thread::sleep_for(std::chrono::microseconds(PRETRIGGER_IDLE_US));
+            continue;
+        }
+
+        // pinned frames are never overwritten, the data can be read without the lock
+        int ret = mjpegWriterAppend(&pt->writer, pt->arena.data() + frame.offset, frame.size, frame.sequence, frame.timestamp_Us);
+        {
+            std::lock_guard<std::mutex> guard(pt->lock);
+            pt->flush_Next++;
+            if (pt->flush_Until_Us < 0)
+                pt->flush_Until_Us = frame.timestamp_Us + pt->post_Us;
+        }
+        if (ret < 0 || frame.timestamp_Us >= pt->flush_Until_Us)
+            finishClip(pt);
+    }
+}
+
+/**
+  * @brief  Start pre-trigger ring
+  * @note   All memory is allocated here, the ring never grows afterwards.
+  * @param  pt          struct preTrigger
+  * @param  pathFormat  const char *, printf format taking the clip number, e.g. "../image/clip_%d.ucmj"
+  * @param  width       int
+  * @param  height      int
+  * @param  bytes       size_t, compressed bytes kept before a trigger
+  * @param  seconds     int, capture time kept before a trigger, 0 to only bound by bytes
+  * @param  postSeconds int, capture time written after a trigger
+  * @retval 0           If pre-trigger ring started
+**/
+int preTriggerInit(struct preTrigger *pt, const char *pathFormat, int width, int height, size_t bytes, int seconds, int postSeconds) {
+    if (pt->is_Running.load() || bytes < PRETRIGGER_MIN_FRAME)
+        return -1;
+
+    snprintf(pt->path_Format, sizeof(pt->path_Format), "%s", pathFormat);
+    pt->arena.assign(bytes, 0);
+    pt->frames.assign(bytes / PRETRIGGER_MIN_FRAME + (size_t) seconds * PRETRIGGER_MAX_FPS, {});
+    pt->head = pt->tail = pt->write_Pos = 0;
+    pt->window_Us = seconds > 0 ? (int64_t) seconds * 1000000 : INT64_MAX;
+    pt->post_Us = (int64_t) postSeconds * 1000000;
+    pt->is_Flushing = 0;
+    pt->clip_Count = 0;
+    pt->width = width;
+    pt->height = height;
+    pt->trigger_Pending = 0;
+    pt->frames_Dropped = 0;
+    pt->is_Running = true;
+    pt->thread = std::thread(flushLoop, pt);
+    return 0;
+}
+
+/**
+  * @brief  Stop pre-trigger ring
+  * @note   A clip being flushed is finished with the frames already buffered.
+  * @param  pt  struct preTrigger
+  * @retval 0   If pre-trigger ring stopped
+**/
+int preTriggerFree(struct preTrigger *pt) {
+    if (!pt->is_Running.exchange(false))
+        return 0;
+    if (pt->thread.joinable())
+        pt->thread.join();
+    if (pt->frames_Dropped > 0)
+        printf("Pre-trigger ring dropped %lu frames while flushing\n", pt->frames_Dropped.load());
+    return 0;
+}
+
+/**
+  * @brief  Push frame
+  * @note   Evicts the oldest frames that fall out of the byte or time window, except frames pinned by a running flush.
+  * @note   When pinned frames fill the arena the new frame is dropped. Never waits on disk, single producer only.
+  * @param  pt      struct preTrigger
+  * @param  lease   struct frameLease
+  * @retval 0       If frame buffered
+**/
+int preTriggerPush(struct preTrigger *pt, const struct frameLease *lease) {
+    int64_t timestampUs = (int64_t) lease->timestamp.tv_sec * 1000000 + lease->timestamp.tv_usec;
+    size_t size = lease->bytes_Used;
+    size_t count = pt->frames.size();
+    size_t pos;
+
+    if (!pt->is_Running.load(std::memory_order_acquire) || size > pt->arena.size())
+        return -1;
+    {
+        std::lock_guard<std::mutex> guard(pt->lock);
+        size_t pinned = pt->is_Flushing ? pt->flush_Next : pt->head;
+        while (pt->tail < pinned && timestampUs - pt->frames[pt->tail % count].timestamp_Us > pt->window_Us)
+            pt->tail++;
+        while ((pos = placeFrame(pt, size)) == NO_ROOM || pt->head - pt->tail == count) {
+            if (pt->tail == pinned) {
+                pt->frames_Dropped.fetch_add(1, std::memory_order_relaxed);
+                return -1;
+            }
+            pt->tail++;
+        }
+    }
+
+    // [pos, pos + size) belongs to no buffered frame, fill it outside the lock
+    memcpy(pt->arena.data() + pos, lease->mem, size);
+
+    std::lock_guard<std::mutex> guard(pt->lock);
+    pt->frames[pt->head % count] = {pos, (uint32_t) size, lease->sequence, timestampUs};
+    pt->write_Pos = pos + size;
+    pt->head++;
+    return 0;
+}
+
+/**
+  * @brief  Fire trigger
+  * @note   Only stores an atomic flag, safe to call from any thread and from a signal handler
+  * @param  pt  struct preTrigger
+  * @retval None
+**/
+void preTriggerFire(struct preTrigger *pt) {
+    pt->trigger_Pending.store(1, std::memory_order_release);
+}
+
+/**
+  * @brief  Pre-trigger capture tap
+  * @note   For addCaptureTap(), ctx is the struct preTrigger
+  * @param  ctx     void *
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+void preTriggerTap(void *ctx, const struct frameLease *lease) {
+    preTriggerPush((struct preTrigger *) ctx, lease);
+}
@@ -0,0 +1,52 @@
+#ifndef USBCAM_PRE_TRIGGER_H
+#define USBCAM_PRE_TRIGGER_H
+
+#include "recorder.h"
+#include "utils.h"
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PRETRIGGER_MAX_FPS 120
+#define PRETRIGGER_MIN_FRAME (16 << 10)
+#define PRETRIGGER_IDLE_US 2000
+
+struct preTriggerFrame {
+    size_t offset;
+    uint32_t size;
+    uint32_t sequence;
+    int64_t timestamp_Us;
+};
+
+struct preTrigger {
+    std::vector<unsigned char> arena;
+    std::vector<struct preTriggerFrame> frames;
+    size_t head;
+    size_t tail;
+    size_t write_Pos;
+    int64_t window_Us;
+    int64_t post_Us;
+    std::mutex lock;
+    size_t flush_Next;
+    int64_t flush_Until_Us;
+    int is_Flushing;
+    struct mjpegWriter writer;
+    char path_Format[128];
+    int clip_Count;
+    int width;
+    int height;
+    std::thread thread;
+    std::atomic<bool> is_Running{false};
+    std::atomic<int> trigger_Pending{0};
+    std::atomic<unsigned long> frames_Dropped{0};
+};
+
+int preTriggerInit(struct preTrigger *pt, const char *pathFormat, int width, int height, size_t bytes, int seconds, int postSeconds);
+int preTriggerFree(struct preTrigger *pt);
+int preTriggerPush(struct preTrigger *pt, const struct frameLease *lease);
+void preTriggerFire(struct preTrigger *pt);
+void preTriggerTap(void *ctx, const struct frameLease *lease);
+
+#endif
@@ -0,0 +1,170 @@
+#include "recorder.h"
+
+/**
+  * @brief  Open container
+  * @note   Writes a header without index, so a file cut short by a crash is still replayable.
+  * @param  mw      struct mjpegWriter
+  * @param  path    const char *
+  * @param  width   int
+  * @param  height  int
+  * @retval 0       If container opened
+**/
+int mjpegWriterOpen(struct mjpegWriter *mw, const char *path, int width, int height) {
+    mw->file = fopen(path, "wb");
+    if (mw->file == nullptr) {
+        printf("Error: Unable to create recording %s\n", path);
+        return -1;
+    }
+    setvbuf(mw->file, nullptr, _IOFBF, RECORDER_IO_BUFFER);
+    mw->header = {MJPEG_FILE_MAGIC, MJPEG_FILE_VERSION, (uint32_t) width, (uint32_t) height, V4L2_PIX_FMT_MJPEG, 0, 0};
+    if (fwrite(&mw->header, sizeof(mw->header), 1, mw->file) != 1) {
+        fclose(mw->file);
+        mw->file = nullptr;
+        return -1;
+    }
+    mw->index.clear();
+    mw->offset = sizeof(mw->header);
+    return 0;
+}
+
+/**
+  * @brief  Append frame
+  * @note   Frame header plus the untouched jpeg, the index entry is kept until close
+  * @param  mw          struct mjpegWriter
+  * @param  jpg         const void *
+  * @param  size        uint32_t
+  * @param  sequence    uint32_t
+  * @param  timestampUs int64_t, capture time
+  * @retval 0           If frame written
+**/
+int mjpegWriterAppend(struct mjpegWriter *mw, const void *jpg, uint32_t size, uint32_t sequence, int64_t timestampUs) {
+    struct mjpegFrameHeader frh {MJPEG_FRAME_MAGIC, size, sequence, 0, timestampUs};
+
+    if (fwrite(&frh, sizeof(frh), 1, mw->file) != 1 || fwrite(jpg, 1, size, mw->file) != size)
+        return -1;
+    mw->offset += sizeof(frh);
+    mw->index.push_back({mw->offset, size, sequence, timestampUs});
+    mw->offset += size;
+    return 0;
+}
+
+/**
+  * @brief  Close container
+  * @note   Appends the index and patches frame count and index offset into the header
+  * @param  mw  struct mjpegWriter
+  * @retval 0   If container closed
+**/
+int mjpegWriterClose(struct mjpegWriter *mw) {
+    int ret = 0;
+
+    if (mw->file == nullptr)
+        return 0;
+    mw->header.frame_Count = (uint32_t) mw->index.size();
+    mw->header.index_Offset = mw->offset;
+    if (fwrite(mw->index.data(), sizeof(struct mjpegIndexEntry), mw->index.size(), mw->file) != mw->index.size() ||
+        fseek(mw->file, 0, SEEK_SET) < 0 || fwrite(&mw->header, sizeof(mw->header), 1, mw->file) != 1)
+        ret = -1;
+    if (fclose(mw->file) != 0)
+        ret = -1;
+    mw->file = nullptr;
+    return ret;
+}
+
+/**
+  * @brief  Write recorded frame
+  * @note   Runs on the writer thread. Keeps accepting frames after a write error so capture never stalls,
+  *         they are then counted as dropped.
+  * @param  ctx     void *, struct mjpegRecorder
+  * @param  slot    struct tapSlot
+  * @retval 0       If frame written
+**/
+static int recorderWrite(void *ctx, const struct tapSlot *slot) {
+    auto rec = (struct mjpegRecorder *) ctx;
+
+    if (!rec->has_Failed.load(std::memory_order_relaxed) &&
+        mjpegWriterAppend(&rec->writer, slot->data.data(), (uint32_t) slot->size, slot->sequence, slot->timestamp_Us) < 0) {
+        printf("Error: Recording write failed, dropping further frames\n");
+        rec->has_Failed = true;
+    }
+    if (rec->has_Failed.load(std::memory_order_relaxed)) {
+        rec->frames_Dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    rec->frames_Written.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+/**
+  * @brief  Open recording
+  * @note   Frames are written by a background thread, see mjpegWriterOpen() for the file layout.
+  * @param  rec     struct mjpegRecorder
+  * @param  path    const char *
+  * @param  width   int
+  * @param  height  int
+  * @param  slots       int, frames that may wait for the disk before capture starts dropping, 0 for RECORDER_SLOTS
+  * @param  frameSize   size_t, the driver's worst case frame, every slot is allocated to it here so the capture
+  *                     thread never allocates
+  * @retval 0           If recording opened
+**/
+int recorderOpen(struct mjpegRecorder *rec, const char *path, int width, int height, int slots, size_t frameSize) {
+    if (rec->queue.is_Running.load())
+        return -1;
+
+    if (mjpegWriterOpen(&rec->writer, path, width, height) < 0)
+        return -1;
+    rec->frames_Written = 0;
+    rec->frames_Dropped = 0;
+    rec->has_Failed = false;
+    if (tapWriterStart(&rec->queue, slots > 0 ? slots : RECORDER_SLOTS, frameSize, recorderWrite, rec) < 0) {
+        mjpegWriterClose(&rec->writer);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Close recording
+  * @note   Waits for every queued frame, then appends the index and patches the header.
+  * @param  rec struct mjpegRecorder
+  * @retval 0   If recording closed
+**/
+int recorderClose(struct mjpegRecorder *rec) {
+    int ret = 0;
+
+    if (!rec->queue.is_Running.load())
+        return 0;
+    tapWriterStop(&rec->queue);
+    if (mjpegWriterClose(&rec->writer) < 0 || rec->has_Failed)
+        ret = -1;
+    printf("Recorded %lu frames, dropped %lu\n", rec->frames_Written.load(), rec->frames_Dropped.load());
+    return ret;
+}
+
+/**
+  * @brief  Push frame
+  * @note   Copies the compressed frame into a free slot, never blocks. Without a free slot the frame is dropped.
+  * @note   Single producer, call from one thread only.
+  * @param  rec     struct mjpegRecorder
+  * @param  lease   struct frameLease
+  * @retval 0       If frame queued
+**/
+int recorderPush(struct mjpegRecorder *rec, const struct frameLease *lease) {
+    if (!rec->queue.is_Running.load(std::memory_order_acquire))
+        return -1;
+    if (tapWriterPush(&rec->queue, lease, 0) < 0) {
+        rec->frames_Dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+  * @brief  Recorder capture tap
+  * @note   For addCaptureTap(), ctx is the struct mjpegRecorder
+  * @param  ctx     void *
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+void recorderTap(void *ctx, const struct frameLease *lease) {
+    recorderPush((struct mjpegRecorder *) ctx, lease);
+}
@@ -0,0 +1,38 @@
+#ifndef USBCAM_RECORDER_H
+#define USBCAM_RECORDER_H
+
+#include "mjpegFile.h"
+#include "tapWriter.h"
+#include "utils.h"
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#define RECORDER_SLOTS 32
+#define RECORDER_IO_BUFFER (1 << 20)
+
+struct mjpegWriter {
+    FILE *file;
+    struct mjpegFileHeader header;
+    std::vector<struct mjpegIndexEntry> index;
+    uint64_t offset;
+};
+
+struct mjpegRecorder {
+    struct mjpegWriter writer;
+    struct tapWriter queue;
+    std::atomic<bool> has_Failed{false};
+    std::atomic<unsigned long> frames_Written{0};
+    std::atomic<unsigned long> frames_Dropped{0};
+};
+
+int mjpegWriterOpen(struct mjpegWriter *mw, const char *path, int width, int height);
+int mjpegWriterAppend(struct mjpegWriter *mw, const void *jpg, uint32_t size, uint32_t sequence, int64_t timestampUs);
+int mjpegWriterClose(struct mjpegWriter *mw);
+
+int recorderOpen(struct mjpegRecorder *rec, const char *path, int width, int height, int slots, size_t frameSize);
+int recorderClose(struct mjpegRecorder *rec);
+int recorderPush(struct mjpegRecorder *rec, const struct frameLease *lease);
+void recorderTap(void *ctx, const struct frameLease *lease);
+
+#endif
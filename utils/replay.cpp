@@ -0,0 +1,384 @@
+#include "replay.h"
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+  * @brief  Monotonic clock
+  * @note   None
+  * @param  None
+  * @retval Microseconds
+**/
+static int64_t monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+  * @brief  Find end of jpeg
+  * @note   Walks marker segments up to SOS, then the entropy data up to EOI
+  * @param  p       const unsigned char *, pointing at SOI
+  * @param  len     size_t, bytes available
+  * @retval Length of the jpeg including EOI, 0 if it is truncated
+**/
+static size_t jpegLength(const unsigned char *p, size_t len) {
+    size_t pos = 2;
+
+    while (pos + 4 <= len) {
+        if (p[pos] != 0xFF)
+            return 0;
+        unsigned char marker = p[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        if (marker == 0xD9)
+            return pos + 2;
+        size_t segLen = (p[pos + 2] << 8) | p[pos + 3];
+        pos += 2 + segLen;
+        if (marker != 0xDA)
+            continue;
+        for (; pos + 1 < len; pos++) {
+            if (p[pos] != 0xFF || p[pos + 1] == 0x00 || (p[pos + 1] >= 0xD0 && p[pos + 1] <= 0xD7))
+                continue;
+            if (p[pos + 1] == 0xD9)
+                return pos + 2;
+            if (p[pos + 1] != 0xFF)
+                break;
+        }
+    }
+    return 0;
+}
+
+/**
+  * @brief  Read jpeg size
+  * @note   Takes width and height from the first SOFn segment
+  * @param  p       const unsigned char *, pointing at SOI
+  * @param  len     size_t
+  * @param  w       int *
+  * @param  h       int *
+  * @retval 0       If a SOF segment was found
+**/
+static int jpegFrameSize(const unsigned char *p, size_t len, int *w, int *h) {
+    size_t pos = 2;
+
+    while (pos + 9 <= len && p[pos] == 0xFF) {
+        unsigned char marker = p[pos + 1];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            *h = (p[pos + 5] << 8) | p[pos + 6];
+            *w = (p[pos + 7] << 8) | p[pos + 8];
+            return 0;
+        }
+        if (marker == 0xDA)
+            break;
+        pos += 2 + ((p[pos + 2] << 8) | p[pos + 3]);
+    }
+    return -1;
+}
+
+/**
+  * @brief  Index container
+  * @note   Uses the trailing index when the recording was closed, otherwise walks the frame headers
+  * @param  rs      struct replayState
+  * @param  fh      const struct mjpegFileHeader *
+  * @retval 0       If at least one frame was found
+**/
+static int indexContainer(struct replayState *rs, const struct mjpegFileHeader *fh) {
+    if (fh->index_Offset != 0 && fh->index_Offset + (uint64_t) fh->frame_Count * sizeof(struct mjpegIndexEntry) <= rs->map_Size) {
+        struct mjpegIndexEntry entry;
+        for (uint32_t i = 0; i < fh->frame_Count; ++i) {
+            // entries follow odd sized jpegs, copy them out instead of casting
+            memcpy(&entry, rs->map + fh->index_Offset + i * sizeof(entry), sizeof(entry));
+            if (entry.offset + entry.size <= fh->index_Offset)
+                rs->frames.push_back(entry);
+        }
+        return rs->frames.empty() ? -1 : 0;
+    }
+
+    struct mjpegFrameHeader frh;
+    size_t pos = sizeof(struct mjpegFileHeader);
+    while (pos + sizeof(frh) <= rs->map_Size) {
+        memcpy(&frh, rs->map + pos, sizeof(frh));
+        pos += sizeof(frh);
+        if (frh.magic != MJPEG_FRAME_MAGIC || pos + frh.size > rs->map_Size)
+            break;
+        rs->frames.push_back({pos, frh.size, frh.sequence, frh.timestamp_Us});
+        pos += frh.size;
+    }
+    return rs->frames.empty() ? -1 : 0;
+}
+
+/**
+  * @brief  Index raw mjpeg
+  * @note   Splits concatenated jpegs at SOI/EOI and synthesizes REPLAY_RAW_FPS timestamps
+  * @param  rs      struct replayState
+  * @retval 0       If at least one frame was found
+**/
+static int indexRaw(struct replayState *rs) {
+    size_t pos = 0;
+    unsigned int sequence = 0;
+
+    while (pos + 4 <= rs->map_Size) {
+        if (rs->map[pos] != 0xFF || rs->map[pos + 1] != 0xD8) {
+            pos++;
+            continue;
+        }
+        size_t len = jpegLength(rs->map + pos, rs->map_Size - pos);
+        if (len == 0)
+            break;
+        rs->frames.push_back({pos, (uint32_t) len, sequence, (int64_t) sequence * 1000000 / REPLAY_RAW_FPS});
+        sequence++;
+        pos += len;
+    }
+    return rs->frames.empty() ? -1 : 0;
+}
+
+/**
+  * @brief  Due time of the next frame
+  * @note   Recorded timestamps relative to the first frame, shifted by play start and completed loops
+  * @param  rs      struct replayState
+  * @retval Microseconds on the monotonic clock
+**/
+static int64_t nextDueUs(struct replayState *rs) {
+    return rs->start_Us + rs->loop_Us + rs->frames[rs->next].timestamp_Us - rs->frames[0].timestamp_Us;
+}
+
+/**
+  * @brief  Open replay file
+  * @note   mmaps the path replayOpen() stored in the replay state read-only and builds the frame table, vd->fd stays -1
+  * @param  vd  struct videoDev
+  * @retval 0   If replay file opened
+**/
+static int replayOpenFile(struct videoDev *vd) {
+    struct replayState *rs = (struct replayState *) vd->backend_Data;
+    struct stat st {};
+
+    vd->fd = -1;
+    vd->epoll_Fd = -1;
+    if (rs == nullptr) {
+        printf("Error: Replay files are opened with replayOpen()\n");
+        return -1;
+    }
+    vd->backend_Data = nullptr;
+    int fd = open(rs->path.c_str(), O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0 || st.st_size < 4) {
+        printf("Replay file %s can not be opened\n", rs->path.c_str());
+        if (fd >= 0)
+            close(fd);
+        delete rs;
+        return -1;
+    }
+    rs->map_Size = st.st_size;
+    rs->map = (unsigned char *) mmap(nullptr, rs->map_Size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (rs->map == MAP_FAILED) {
+        printf("Replay mmap failed: %s\n", strerror(errno));
+        delete rs;
+        return -1;
+    }
+    madvise(rs->map, rs->map_Size, MADV_SEQUENTIAL);
+
+    const struct mjpegFileHeader *fh = (const struct mjpegFileHeader *) rs->map;
+    int ret, w = 0, h = 0;
+    if (rs->map_Size >= sizeof(*fh) && fh->magic == MJPEG_FILE_MAGIC) {
+        ret = indexContainer(rs, fh);
+        w = fh->width;
+        h = fh->height;
+    } else {
+        ret = indexRaw(rs);
+    }
+    if (ret < 0) {
+        printf("Replay file %s holds no frames\n", rs->path.c_str());
+        munmap(rs->map, rs->map_Size);
+        delete rs;
+        return -1;
+    }
+    if (w == 0 || h == 0)
+        jpegFrameSize(rs->map + rs->frames[0].offset, rs->frames[0].size, &w, &h);
+
+    size_t last = rs->frames.size() - 1;
+    rs->period_Us = last > 0 ? (rs->frames[last].timestamp_Us - rs->frames[0].timestamp_Us) / (int64_t) last : 1000000 / REPLAY_RAW_FPS;
+    vd->raw_W = w;
+    vd->raw_H = h;
+    vd->raw_Format = V4L2_PIX_FMT_MJPEG;
+    vd->backend_Data = rs;
+    printf("Replay %s: %zu frames, %dx%d\n", rs->path.c_str(), rs->frames.size(), w, h);
+    return 0;
+}
+
+/**
+  * @brief  Close replay file
+  * @note   None
+  * @param  vd  struct videoDev
+  * @retval 0   If replay file closed
+**/
+static int replayClose(struct videoDev *vd) {
+    struct replayState *rs = (struct replayState *) vd->backend_Data;
+
+    if (rs == nullptr)
+        return 0;
+    vd->is_Streaming = 0;
+    munmap(rs->map, rs->map_Size);
+    delete rs;
+    vd->backend_Data = nullptr;
+    return 0;
+}
+
+/**
+  * @brief  Start replay
+  * @note   Rewinds to the first frame and starts the pacing clock
+  * @param  vd  struct videoDev
+  * @retval 0   If replay started
+**/
+static int replayPlay(struct videoDev *vd) {
+    struct replayState *rs = (struct replayState *) vd->backend_Data;
+
+    if (rs == nullptr)
+        return -1;
+    rs->next = 0;
+    rs->loop_Us = 0;
+    rs->start_Us = monotonicUs();
+    vd->is_Streaming = 1;
+    return 0;
+}
+
+/**
+  * @brief  Stop replay
+  * @note   None
+  * @param  vd  struct videoDev
+  * @retval 0   If replay stopped
+**/
+static int replayStop(struct videoDev *vd) {
+    vd->is_Streaming = 0;
+    return 0;
+}
+
+/**
+  * @brief  Wait replay frame
+  * @note   Sleeps until the next frame is due in REPLAY_REALTIME mode, otherwise always ready
+  * @param  vd          struct videoDev
+  * @param  timeoutMs   int, -1 to wait forever
+  * @retval 1           If a frame is ready, 0 on timeout, -1 when replay finished
+**/
+static int replayWait(struct videoDev *vd, int timeoutMs) {
+    struct replayState *rs = (struct replayState *) vd->backend_Data;
+
+    if (rs == nullptr || !vd->is_Streaming)
+        return -1;
+    if (rs->next >= rs->frames.size())
+        return (vd->backend_Flags & REPLAY_LOOP) ? 1 : -1;
+    if (!(vd->backend_Flags & REPLAY_REALTIME))
+        return 1;
+
+    int64_t waitUs = nextDueUs(rs) - monotonicUs();
+    if (waitUs <= 0)
+        return 1;
+    if (timeoutMs >= 0 && waitUs > (int64_t) timeoutMs * 1000) {
+        usleep(timeoutMs * 1000);
+        return 0;
+    }
+    usleep(waitUs);
+    return 1;
+}
+
+/**
+  * @brief  Lease replay frame
+  * @note   Points straight into the read-only mapping, the frame must not be written to
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame leased, 1 if the next frame is not due yet, -1 when replay finished
+**/
+static int replayLease(struct videoDev *vd, struct frameLease *lease) {
+    struct replayState *rs = (struct replayState *) vd->backend_Data;
+
+    if (rs == nullptr || !vd->is_Streaming)
+        return -1;
+    if (rs->next >= rs->frames.size()) {
+        if (!(vd->backend_Flags & REPLAY_LOOP)) {
+            printf("Replay finished\n");
+            return -1;
+        }
+        rs->loop_Us += rs->frames.back().timestamp_Us - rs->frames[0].timestamp_Us + rs->period_Us;
+        rs->next = 0;
+    }
+    if ((vd->backend_Flags & REPLAY_REALTIME) && nextDueUs(rs) > monotonicUs())
+        return 1;
+
+    const struct mjpegIndexEntry &frame = rs->frames[rs->next];
+    int64_t timestampUs = frame.timestamp_Us + rs->loop_Us;
+    lease->mem = rs->map + frame.offset;
+    lease->bytes_Used = (int) frame.size;
+    lease->num_Planes = 1;
+    lease->planes[0] = lease->mem;
+    lease->plane_Bytes[0] = lease->bytes_Used;
+    lease->index = (int) rs->next;
+    lease->sequence = frame.sequence;
+    lease->timestamp.tv_sec = timestampUs / 1000000;
+    lease->timestamp.tv_usec = timestampUs % 1000000;
+    rs->next++;
+    return 0;
+}
+
+/**
+  * @brief  Release replay frame
+  * @note   Frames live in the mapping until close, nothing to give back
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame released
+**/
+static int replayRelease(struct videoDev *vd, struct frameLease *lease) {
+    (void) vd;
+    lease->mem = nullptr;
+    lease->bytes_Used = 0;
+    lease->index = -1;
+    return 0;
+}
+
+/**
+  * @brief  Retain replay frame
+  * @note   Frames live in the mapping until close, nothing to count
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame retained
+**/
+static int replayRetain(struct videoDev *vd, const struct frameLease *lease) {
+    (void) vd;
+    return lease->index < 0 ? -1 : 0;
+}
+
+const struct captureBackend replayBackend = {
+        "replay",
+        replayOpenFile,
+        replayClose,
+        replayPlay,
+        replayStop,
+        replayWait,
+        replayLease,
+        replayRelease,
+        replayRetain,
+};
+
+/**
+  * @brief  Open replay
+  * @note   Selects the replay backend for vd and opens path, recorded container or raw concatenated mjpeg.
+  *         vd->dev_Name only gets the file name for display, the full path is kept in the replay state.
+  * @param  vd      struct videoDev
+  * @param  path    const char *
+  * @param  flags   REPLAY_REALTIME and/or REPLAY_LOOP, 0 replays as fast as possible
+  * @retval 0       If replay file opened
+**/
+int replayOpen(struct videoDev *vd, const char *path, int flags) {
+    struct replayState *rs = new replayState{};
+    const char *name = strrchr(path, '/');
+
+    rs->path = path;
+    snprintf(vd->dev_Name, sizeof(vd->dev_Name), "%s", name != nullptr ? name + 1 : path);
+    vd->backend = &replayBackend;
+    vd->backend_Flags = flags;
+    vd->backend_Data = rs;
+    return openVideoDevice(vd);
+}
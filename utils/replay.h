@@ -0,0 +1,30 @@
+#ifndef USBCAM_REPLAY_H
+#define USBCAM_REPLAY_H
+
+#include "mjpegFile.h"
+#include "utils.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define REPLAY_REALTIME 1
+#define REPLAY_LOOP 2
+#define REPLAY_RAW_FPS 30
+
+struct replayState {
+    std::string path;
+    unsigned char *map;
+    size_t map_Size;
+    std::vector<struct mjpegIndexEntry> frames;
+    size_t next;
+    int64_t start_Us;
+    int64_t loop_Us;
+    int64_t period_Us;
+};
+
+extern const struct captureBackend replayBackend;
+
+int replayOpen(struct videoDev *vd, const char *path, int flags);
+
+#endif
@@ -0,0 +1,111 @@
+#include "snapshot.h"
+#include <chrono>
+
+/**
+  * @brief  Write snapshot
+  * @note   Writes exactly the captured bytes of the frame, multi-planar frames plane after plane, and reports how long it took
+  * @note   Runs on the writer thread, slot->tag is the snapshot number
+  * @param  ctx     void *, struct snapshotWriter
+  * @param  slot    struct tapSlot
+  * @retval 0       If snapshot written
+**/
+static int writeSnapshot(void *ctx, const struct tapSlot *slot) {
+    auto sw = (struct snapshotWriter *) ctx;
+    auto start = std::chrono::steady_clock::now();
+    char fileName[160];
+    FILE *imgFile;
+    int ret = 0;
+
+    snprintf(fileName, sizeof(fileName), sw->path_Format, slot->tag);
+    imgFile = fopen(fileName, "wb");
+    if (imgFile == nullptr) {
+        printf("Error: Unable to create snapshot %s\n", fileName);
+        sw->written.fetch_add(1, std::memory_order_release);
+        return -1;
+    }
+    if (fwrite(slot->data.data(), 1, slot->size, imgFile) != slot->size)
+        ret = -1;
+    if (fclose(imgFile) != 0)
+        ret = -1;
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if (ret < 0)
+        printf("Error: Snapshot %s failed after %.2f ms\n", fileName, ms);
+    else
+        printf("Snapshot %s: frame %u, %zu bytes in %.2f ms\n", fileName, slot->sequence, slot->size, ms);
+    sw->written.fetch_add(1, std::memory_order_release);
+    return ret;
+}
+
+/**
+  * @brief  Start snapshot writer
+  * @note   None
+  * @param  sw          struct snapshotWriter
+  * @param  pathFormat  const char *, printf format taking the snapshot number, e.g. "../image/img_%d.jpg"
+  * @param  inFlight    int, snapshots requested but not yet on disk, 0 for SNAPSHOT_IN_FLIGHT
+  * @param  frameSize   size_t, largest frame, all planes, every slot is allocated to it here
+  * @retval 0           If snapshot writer started
+**/
+int snapshotInit(struct snapshotWriter *sw, const char *pathFormat, int inFlight, size_t frameSize) {
+    if (sw->queue.is_Running.load())
+        return -1;
+
+    if (inFlight <= 0)
+        inFlight = SNAPSHOT_IN_FLIGHT;
+    snprintf(sw->path_Format, sizeof(sw->path_Format), "%s", pathFormat);
+    sw->max_In_Flight = inFlight;
+    return tapWriterStart(&sw->queue, inFlight, frameSize, writeSnapshot, sw);
+}
+
+/**
+  * @brief  Stop snapshot writer
+  * @note   Finishes every snapshot already taken, requests without a frame yet are dropped
+  * @param  sw  struct snapshotWriter
+  * @retval 0   If snapshot writer stopped
+**/
+int snapshotFree(struct snapshotWriter *sw) {
+    return tapWriterStop(&sw->queue);
+}
+
+/**
+  * @brief  Request snapshot
+  * @note   The next captured frame is saved, callable from any one thread
+  * @param  sw  struct snapshotWriter
+  * @retval Snapshot number, -1 if max_In_Flight snapshots are still pending
+**/
+int snapshotRequest(struct snapshotWriter *sw) {
+    int requested = sw->requested.load(std::memory_order_relaxed);
+
+    if (!sw->queue.is_Running.load() || requested - sw->written.load(std::memory_order_acquire) >= sw->max_In_Flight)
+        return -1;
+    sw->requested.store(requested + 1, std::memory_order_release);
+    return requested;
+}
+
+/**
+  * @brief  Push frame
+  * @note   Copies the frame into a free slot when a snapshot is pending, never blocks or allocates
+  * @note   Single producer, call from one thread only.
+  * @param  sw      struct snapshotWriter
+  * @param  lease   struct frameLease
+  * @retval 0       If a snapshot was taken
+**/
+int snapshotPush(struct snapshotWriter *sw, const struct frameLease *lease) {
+    int taken = sw->taken.load(std::memory_order_relaxed);
+
+    if (taken == sw->requested.load(std::memory_order_acquire) || tapWriterPush(&sw->queue, lease, taken) < 0)
+        return -1;
+    sw->taken.store(taken + 1, std::memory_order_relaxed);
+    return 0;
+}
+
+/**
+  * @brief  Snapshot capture tap
+  * @note   For addCaptureTap(), ctx is the struct snapshotWriter
+  * @param  ctx     void *
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+void snapshotTap(void *ctx, const struct frameLease *lease) {
+    snapshotPush((struct snapshotWriter *) ctx, lease);
+}
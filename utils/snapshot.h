@@ -0,0 +1,25 @@
+#ifndef USBCAM_SNAPSHOT_H
+#define USBCAM_SNAPSHOT_H
+
+#include "tapWriter.h"
+#include "utils.h"
+#include <atomic>
+
+#define SNAPSHOT_IN_FLIGHT 4
+
+struct snapshotWriter {
+    char path_Format[128];
+    struct tapWriter queue;
+    std::atomic<int> requested{0};
+    std::atomic<int> taken{0};
+    std::atomic<int> written{0};
+    int max_In_Flight;
+};
+
+int snapshotInit(struct snapshotWriter *sw, const char *pathFormat, int inFlight, size_t frameSize);
+int snapshotFree(struct snapshotWriter *sw);
+int snapshotRequest(struct snapshotWriter *sw);
+int snapshotPush(struct snapshotWriter *sw, const struct frameLease *lease);
+void snapshotTap(void *ctx, const struct frameLease *lease);
+
+#endif
@@ -0,0 +1,120 @@
+#include "tapWriter.h"
+
+/**
+  * @brief  Tap writer loop
+  * @note   Runs on the writer thread, hands full slots to tw->write and gives them back to the capture side.
+  * @note   Sleeps on tw->wake while nothing is queued, drains what is still queued after tapWriterStop() before it returns.
+  * @param  tw  struct tapWriter
+  * @retval None
+**/
+static void tapWriterLoop(struct tapWriter *tw) {
+    int slot;
+
+    while (true) {
+        if (!tw->full_Slots.pop(slot)) {
+            std::unique_lock<std::mutex> guard(tw->lock);
+            if (!tw->is_Running.load(std::memory_order_acquire) && tw->full_Slots.size() == 0)
+                break;
+            tw->wake.wait(guard, [tw] { return tw->full_Slots.size() > 0 || !tw->is_Running.load(std::memory_order_acquire); });
+            continue;
+        }
+        tw->write(tw->ctx, &tw->slots[slot]);
+        tw->free_Slots.push(slot);
+    }
+}
+
+/**
+  * @brief  Start tap writer
+  * @note   Frames pushed on the capture thread are copied into slots and written on a thread of their own.
+  * @param  tw      struct tapWriter
+  * @param  slots       int, frames that may wait for the writer before pushes fail
+  * @param  slotSize    size_t, bytes allocated per slot up front, larger frames are refused
+  * @param  write   Called on the writer thread for every pushed frame
+  * @param  ctx     void *, passed back to write
+  * @retval 0       If tap writer started
+**/
+int tapWriterStart(struct tapWriter *tw, int slots, size_t slotSize, int (*write)(void *ctx, const struct tapSlot *slot), void *ctx) {
+    if (tw->is_Running.load() || slots <= 0 || slotSize == 0)
+        return -1;
+
+    tw->slots.resize(slots);
+    for (auto &ts : tw->slots)
+        ts.data.resize(slotSize);
+    tw->slot_Size = slotSize;
+    tw->free_Slots.resize(slots);
+    tw->full_Slots.resize(slots);
+    for (int i = 0; i < slots; ++i)
+        tw->free_Slots.push(i);
+    tw->write = write;
+    tw->ctx = ctx;
+    tw->is_Running = true;
+    tw->thread = std::thread(tapWriterLoop, tw);
+    return 0;
+}
+
+/**
+  * @brief  Stop tap writer
+  * @note   Returns once every queued frame has been written.
+  * @param  tw  struct tapWriter
+  * @retval 0   If tap writer stopped
+**/
+int tapWriterStop(struct tapWriter *tw) {
+    if (!tw->is_Running.load())
+        return 0;
+    {
+        std::lock_guard<std::mutex> guard(tw->lock);
+        tw->is_Running = false;
+    }
+    tw->wake.notify_one();
+    if (tw->thread.joinable())
+        tw->thread.join();
+    return 0;
+}
+
+/**
+  * @brief  Push frame
+  * @note   Copies every plane of the frame back to back into a free slot, never waits on the writer. The lock
+  *         is only taken to wake it and is never held across a write. Single producer, call from one thread only.
+  * @param  tw      struct tapWriter
+  * @param  lease   struct frameLease
+  * @param  tag     int, passed on in the slot
+  * @retval 0       If frame queued, -1 if the writer is stopped, has no free slot or the frame does not fit
+**/
+int tapWriterPush(struct tapWriter *tw, const struct frameLease *lease, int tag) {
+    const void *planes[MAX_PLANES] = {lease->mem};
+    size_t bytes[MAX_PLANES] = {(size_t) lease->bytes_Used};
+    int count = 1;
+    size_t size = 0;
+    int slot;
+
+    if (!tw->is_Running.load(std::memory_order_acquire))
+        return -1;
+    if (lease->num_Planes > 0) {
+        count = lease->num_Planes;
+        for (int p = 0; p < count; ++p) {
+            planes[p] = lease->planes[p];
+            bytes[p] = (size_t) lease->plane_Bytes[p];
+        }
+    }
+    for (int p = 0; p < count; ++p)
+        size += bytes[p];
+    if (size > tw->slot_Size || !tw->free_Slots.pop(slot))
+        return -1;
+
+    struct tapSlot &ts = tw->slots[slot];
+    ts.size = 0;
+    for (int p = 0; p < count; ++p) {
+        memcpy(ts.data.data() + ts.size, planes[p], bytes[p]);
+        ts.size += bytes[p];
+    }
+    ts.tag = tag;
+    ts.sequence = lease->sequence;
+    ts.timestamp_Us = (int64_t) lease->timestamp.tv_sec * 1000000 + lease->timestamp.tv_usec;
+    tw->full_Slots.push(slot);
+    // an empty critical section orders the push against the writer's check before it waits, so no wake is lost
+    {
+        std::lock_guard<std::mutex> guard(tw->lock);
+    }
+    tw->wake.notify_one();
+    return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef USBCAM_TAP_WRITER_H
+#define USBCAM_TAP_WRITER_H
+
+#include "frameRing.h"
+#include "utils.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct tapSlot {
+    std::vector<unsigned char> data;
+    size_t size;
+    int tag;
+    unsigned int sequence;
+    int64_t timestamp_Us;
+};
+
+struct tapWriter {
+    std::vector<struct tapSlot> slots;
+    frameRing<int> free_Slots;
+    frameRing<int> full_Slots;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::atomic<bool> is_Running{false};
+    size_t slot_Size;
+    int (*write)(void *ctx, const struct tapSlot *slot);
+    void *ctx;
+};
+
+int tapWriterStart(struct tapWriter *tw, int slots, size_t slotSize, int (*write)(void *ctx, const struct tapSlot *slot), void *ctx);
+int tapWriterStop(struct tapWriter *tw);
+int tapWriterPush(struct tapWriter *tw, const struct frameLease *lease, int tag);
+
+#endif
@@ -0,0 +1,92 @@
+#include "threadPool.h"
+
+/**
+  * @brief  Worker loop
+  * @note   Pulls job indices of the current run until the pool is stopped.
+  * @param  tp  struct threadPool
+  * @retval None
+**/
+static void workerLoop(struct threadPool *tp) {
+    std::unique_lock<std::mutex> lk(tp->lock);
+
+    while (true) {
+        tp->job_Cv.wait(lk, [tp] { return tp->is_Stopping || tp->next_Job < tp->job_Count; });
+        if (tp->is_Stopping)
+            return;
+
+        int index = tp->next_Job++;
+        const std::function<void(int)> *job = tp->job;
+        lk.unlock();
+        (*job)(index);
+        lk.lock();
+
+        if (++tp->jobs_Done == tp->job_Count)
+            tp->done_Cv.notify_all();
+    }
+}
+
+/**
+  * @brief  Initial thread pool
+  * @note   The calling thread also works on every run, so threads can be 0.
+  * @param  tp      struct threadPool
+  * @param  threads int, number of worker threads
+  * @retval 0       If thread pool started
+**/
+int threadPoolInit(struct threadPool *tp, int threads) {
+    if (!tp->threads.empty())
+        return -1;
+
+    tp->is_Stopping = false;
+    for (int i = 0; i < threads; ++i)
+        tp->threads.emplace_back(workerLoop, tp);
+    return 0;
+}
+
+/**
+  * @brief  Free thread pool
+  * @note   Must not be called while a run is in progress.
+  * @param  tp  struct threadPool
+  * @retval None
+**/
+void threadPoolFree(struct threadPool *tp) {
+    {
+        std::lock_guard<std::mutex> lk(tp->lock);
+        tp->is_Stopping = true;
+    }
+    tp->job_Cv.notify_all();
+    for (auto &thread : tp->threads)
+        thread.join();
+    tp->threads.clear();
+}
+
+/**
+  * @brief  Run jobs
+  * @note   Calls job(0) .. job(count - 1) across the pool and the caller, returns when all are done.
+  * @note   Only one thread may run jobs on a pool at a time.
+  * @param  tp      struct threadPool
+  * @param  count   int
+  * @param  job     const std::function<void(int)> &
+  * @retval None
+**/
+void threadPoolRun(struct threadPool *tp, int count, const std::function<void(int)> &job) {
+    std::unique_lock<std::mutex> lk(tp->lock);
+
+    tp->job = &job;
+    tp->job_Count = count;
+    tp->next_Job = 0;
+    tp->jobs_Done = 0;
+    tp->job_Cv.notify_all();
+
+    while (tp->next_Job < tp->job_Count) {
+        int index = tp->next_Job++;
+        lk.unlock();
+        job(index);
+        lk.lock();
+        ++tp->jobs_Done;
+    }
+    tp->done_Cv.wait(lk, [tp] { return tp->jobs_Done == tp->job_Count; });
+
+    tp->job = nullptr;
+    tp->job_Count = 0;
+    tp->next_Job = 0;
+}
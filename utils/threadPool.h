@@ -0,0 +1,26 @@
+#ifndef USBCAM_THREAD_POOL_H
+#define USBCAM_THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct threadPool {
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable job_Cv;
+    std::condition_variable done_Cv;
+    const std::function<void(int)> *job = nullptr;
+    int job_Count = 0;
+    int next_Job = 0;
+    int jobs_Done = 0;
+    bool is_Stopping = false;
+};
+
+int threadPoolInit(struct threadPool *tp, int threads);
+void threadPoolFree(struct threadPool *tp);
+void threadPoolRun(struct threadPool *tp, int count, const std::function<void(int)> &job);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef USBCAM_TRIPLE_BUFFER_H
+#define USBCAM_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+/**
+  * @brief  Lock-free triple buffer
+  * @note   One writer fills back() and publish()es it, one reader acquire()s the newest published slot as front().
+  * @note   Neither side ever waits, a slot published twice before the reader looks is simply overwritten.
+**/
+template<typename T>
+class tripleBuffer {
+public:
+    tripleBuffer() = default;
+    tripleBuffer(const tripleBuffer &) = delete;
+    tripleBuffer &operator=(const tripleBuffer &) = delete;
+
+    T &slot(int index) { return slots[index]; }
+    T &back() { return slots[backIndex]; }
+    T &front() { return slots[frontIndex]; }
+
+    /**
+      * @brief  Publish back slot
+      * @note   Writer side only, swaps the filled back slot with the shared middle slot
+      * @retval None
+    **/
+    void publish() {
+        backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    /**
+      * @brief  Acquire newest slot
+      * @note   Reader side only
+      * @retval true    If front() now holds a slot published since the last acquire
+    **/
+    bool acquire() {
+        if ((middle.load(std::memory_order_acquire) & FRESH) == 0)
+            return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+private:
+    static constexpr int FRESH = 4;
+    static constexpr int INDEX_MASK = 3;
+
+    T slots[3];
+    int backIndex = 0;
+    std::atomic<int> middle{1};
+    int frontIndex = 2;
+};
+
+#endif
@@ -1,21 +1,167 @@
 #include "utils.h"
+#include "negotiate.h"
+#include <cerrno>
 #include <fcntl.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <unistd.h>
 
+#define HEADERFRAME1 0xaf
+#define POOL_ALIGN 4096
+#define POOL_HUGE_ALIGN (2 << 20)
+
 SDL_Window *gWindow = nullptr;
 SDL_Renderer *gRenderer = nullptr;
 SDL_Texture *gTexture = nullptr;
 
+/**
+  * @brief  Prepare buffer
+  * @note   Fills index, type and memory, multi-planar buffers also get the plane array.
+  * @note   USERPTR buffers also carry their pool address and length, VIDIOC_QBUF needs them every time.
+  * @param  vd      struct videoDev
+  * @param  buf     struct v4l2_buffer
+  * @param  planes  struct v4l2_plane[VIDEO_MAX_PLANES]
+  * @param  index   int
+  * @retval None
+**/
+static void prepareBuffer(struct videoDev *vd, struct v4l2_buffer *buf, struct v4l2_plane *planes, int index) {
+    bool isUserPtr = vd->mem_Type == V4L2_MEMORY_USERPTR && vd->mem != nullptr;
+
+    memset(buf, 0, sizeof(struct v4l2_buffer));
+    buf->index = index;
+    buf->type = vd->buf_Type;
+    buf->memory = isUserPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    if (vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        memset(planes, 0, sizeof(struct v4l2_plane) * VIDEO_MAX_PLANES);
+        buf->m.planes = planes;
+        buf->length = isUserPtr ? vd->mem_Planes : VIDEO_MAX_PLANES;
+        for (int p = 0; isUserPtr && p < vd->mem_Planes; ++p) {
+            planes[p].m.userptr = (unsigned long) vd->mem[index * MAX_PLANES + p];
+            planes[p].length = (unsigned int) vd->mem_Len[index * MAX_PLANES + p];
+        }
+    } else if (isUserPtr) {
+        buf->m.userptr = (unsigned long) vd->mem[index * MAX_PLANES];
+        buf->length = (unsigned int) vd->mem_Len[index * MAX_PLANES];
+    }
+}
+
+/**
+  * @brief  Request buffers
+  * @note   VIDIOC_REQBUFS for vd->nb_Buffer buffers of the given memory type, the driver may grant more or fewer
+  * @param  vd      struct videoDev
+  * @param  memory  unsigned int, V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR
+  * @retval 0       If buffers granted
+**/
+static int requestBuffers(struct videoDev *vd, unsigned int memory) {
+    memset(&vd->re_Buf, 0, sizeof(struct v4l2_requestbuffers));
+    vd->re_Buf.count = vd->nb_Buffer > 0 ? vd->nb_Buffer : NB_BUFFER;
+    vd->re_Buf.type = vd->buf_Type;
+    vd->re_Buf.memory = memory;
+    if (ioctl(vd->fd, VIDIOC_REQBUFS, &vd->re_Buf) < 0 || vd->re_Buf.count == 0)
+        return -1;
+    vd->mem_Type = memory;
+    return 0;
+}
+
+/**
+  * @brief  Allocate USERPTR pool
+  * @note   One anonymous mapping carved into nb_Buffer buffers, each plane sized from the negotiated sizeimage.
+  * @note   With vd->huge_Pages every buffer starts on a 2 MiB boundary and the pool is MAP_HUGETLB backed,
+  *         or transparent huge pages when no hugetlbfs pages are reserved.
+  * @param  vd  struct videoDev
+  * @retval 0   If pool allocated and vd->mem / vd->mem_Len filled in
+**/
+static int allocUserPool(struct videoDev *vd) {
+    size_t align = vd->huge_Pages ? POOL_HUGE_ALIGN : POOL_ALIGN;
+    size_t planeSize[MAX_PLANES] = {};
+    size_t bufferSize = 0;
+    void *pool = MAP_FAILED;
+
+    if (vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+        vd->mem_Planes = vd->fmt.fmt.pix_mp.num_planes;
+        if (vd->mem_Planes < 1 || vd->mem_Planes > MAX_PLANES) {
+            printf("Error: %d planes per buffer not supported\n", vd->mem_Planes);
+            return -1;
+        }
+        for (int p = 0; p < vd->mem_Planes; ++p)
+            planeSize[p] = (vd->fmt.fmt.pix_mp.plane_fmt[p].sizeimage + POOL_ALIGN - 1) & ~(size_t) (POOL_ALIGN - 1);
+    } else {
+        vd->mem_Planes = 1;
+        planeSize[0] = (vd->fmt.fmt.pix.sizeimage + POOL_ALIGN - 1) & ~(size_t) (POOL_ALIGN - 1);
+    }
+    for (int p = 0; p < vd->mem_Planes; ++p) {
+        if (planeSize[p] == 0) {
+            printf("Error: Driver reported no image size for USERPTR buffers\n");
+            return -1;
+        }
+        bufferSize += planeSize[p];
+    }
+    bufferSize = (bufferSize + align - 1) & ~(align - 1);
+
+    vd->pool_Size = bufferSize * vd->nb_Buffer;
+    if (vd->huge_Pages)
+        pool = mmap(nullptr, vd->pool_Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pool == MAP_FAILED) {
+        // over-allocate so the pool itself can start on a huge page boundary
+        size_t slack = vd->huge_Pages ? align : 0;
+        unsigned char *raw = (unsigned char *) mmap(nullptr, vd->pool_Size + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            printf("Error: Unable to allocate %zu byte buffer pool\n", vd->pool_Size);
+            return -1;
+        }
+        size_t head = slack > 0 ? (align - (uintptr_t) raw % align) % align : 0;
+        if (head > 0)
+            munmap(raw, head);
+        if (slack > head)
+            munmap(raw + head + vd->pool_Size, slack - head);
+        pool = raw + head;
+        if (vd->huge_Pages)
+            madvise(pool, vd->pool_Size, MADV_HUGEPAGE);
+    }
+    vd->pool = pool;
+
+    for (int i = 0; i < vd->nb_Buffer; ++i) {
+        unsigned char *mem = (unsigned char *) pool + (size_t) i * bufferSize;
+        for (int p = 0; p < vd->mem_Planes; ++p) {
+            vd->mem[i * MAX_PLANES + p] = mem;
+            vd->mem_Len[i * MAX_PLANES + p] = planeSize[p];
+            mem += planeSize[p];
+        }
+    }
+    printf("USERPTR pool: %d buffers of %zu bytes%s\n", vd->nb_Buffer, bufferSize, vd->huge_Pages ? ", huge pages" : "");
+    return 0;
+}
+
+/**
+  * @brief  Split planes
+  * @note   Semi-planar formats in one memory plane (NV12, NV16) are split into their Y and CbCr planes,
+  *         so consumers see the same layout as with the NV12M / NV16M multi-planar variants
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval None
+**/
+static void splitPlanes(struct videoDev *vd, struct frameLease *lease) {
+    if (lease->num_Planes != 1 || vd->plane_Pitch[0] <= 0 || (vd->raw_Format != V4L2_PIX_FMT_NV12 && vd->raw_Format != V4L2_PIX_FMT_NV16))
+        return;
+
+    size_t lumaSize = (size_t) vd->plane_Pitch[0] * vd->raw_H;
+    if ((size_t) lease->plane_Bytes[0] <= lumaSize)
+        return;
+    lease->planes[1] = (unsigned char *) lease->planes[0] + lumaSize;
+    lease->plane_Bytes[1] = lease->plane_Bytes[0] - (int) lumaSize;
+    lease->plane_Bytes[0] = (int) lumaSize;
+    lease->num_Planes = 2;
+}
+
 /**
   * @brief  Open video stream
   * @note   VIDIOC_STREAMON
   * @param  vd  struct videoDev
   * @retval 0   If video stream opened
 **/
-int playStream(struct videoDev *vd) {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+static int v4l2Play(struct videoDev *vd) {
+    int type = (int) vd->buf_Type;
     int ret;
 
     ret = ioctl(vd->fd, VIDIOC_STREAMON, &type);
@@ -33,8 +179,8 @@ int playStream(struct videoDev *vd) {
   * @param  vd  struct videoDev
   * @retval 0   If video stream closed
 **/
-int stopStream(struct videoDev *vd) {
-    int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+static int v4l2Stop(struct videoDev *vd) {
+    int type = (int) vd->buf_Type;
     int ret;
 
     ret = ioctl(vd->fd, VIDIOC_STREAMOFF, &type);
@@ -48,21 +194,34 @@ int stopStream(struct videoDev *vd) {
 
 /**
   * @brief  Open video device
-  * @note   1. Open video device: O_RDWR
-  * @note   2. Query capability: VIDIOC_QUERYCAP && VIDEO_CAPTURE
+  * @note   1. Open video device: O_RDWR | O_NONBLOCK, register it with vd->epoll_Fd
+  * @note   2. Query capability: VIDIOC_QUERYCAP && VIDEO_CAPTURE or VIDEO_CAPTURE_MPLANE
   * @note   3. Query format: VIDIOC_ENUM_FMT
+  * @note   4. Negotiate frame size and interval, see negotiateFormat()
+  * @note   5. Request, map and queue vd->nb_Buffer buffers. With vd->mem_Type V4L2_MEMORY_USERPTR the buffers come from
+  *            an application pool instead, falling back to MMAP if the driver cannot capture into user memory.
   * @param  vd  struct videoDev
   * @retval 0   If video device opened
 **/
-int openVideoDevice(struct videoDev *vd) {
-    int i, ret;
+static int v4l2Open(struct videoDev *vd) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    int i, p, ret;
 
     // open video device
-    if ((vd->fd = open(vd->dev_Name, O_RDWR)) == -1) {
+    if ((vd->fd = open(vd->dev_Name, O_RDWR | O_NONBLOCK)) == -1) {
         printf("Error opening V4L interface\n");
         return -1;
     }
 
+    struct epoll_event event {};
+    event.events = EPOLLIN;
+    event.data.fd = vd->fd;
+    vd->epoll_Fd = epoll_create1(EPOLL_CLOEXEC);
+    if (vd->epoll_Fd < 0 || epoll_ctl(vd->epoll_Fd, EPOLL_CTL_ADD, vd->fd, &event) < 0) {
+        printf("Error: Unable to create epoll instance\n");
+        return -1;
+    }
+
     //query capability
     memset(&vd->cap, 0, sizeof(struct v4l2_capability));
     ret = ioctl(vd->fd, VIDIOC_QUERYCAP, &vd->cap);
@@ -75,69 +234,84 @@ int openVideoDevice(struct videoDev *vd) {
     printf("Cap.bus_info: %s\n", vd->cap.bus_info);
     printf("Cap.version.: %u.%u.%u\n", (vd->cap.version >> 16) & 0xff, (vd->cap.version >> 8) & 0xff, vd->cap.version & 0xff);
 
-    if ((vd->cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) == 0) {
+    // prefer the single-planar API, some capture devices only expose the multi-planar one
+    unsigned int caps = (vd->cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? vd->cap.device_caps : vd->cap.capabilities;
+    if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+        vd->buf_Type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    } else if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        vd->buf_Type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    } else {
         printf("Error: Video capture not supported\n");
         return -1;
     }
 
     // query format
     vd->fmt_Desc.index = 0;
-    vd->fmt_Desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    vd->fmt_Desc.type = vd->buf_Type;
     printf("Support Formats:\n");
     while (ioctl(vd->fd, VIDIOC_ENUM_FMT, &vd->fmt_Desc) != -1) {
         printf("%d. %s\n", vd->fmt_Desc.index + 1, vd->fmt_Desc.description);
         vd->fmt_Desc.index++;
     }
 
-    // set format
-    memset(&vd->fmt, 0, sizeof(struct v4l2_format));
-    vd->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->fmt.fmt.pix.width = vd->raw_W;
-    vd->fmt.fmt.pix.height = vd->raw_H;
-    vd->fmt.fmt.pix.pixelformat = vd->raw_Format;
-    vd->fmt.fmt.pix.field = V4L2_FIELD_ANY;
-    ret = ioctl(vd->fd, VIDIOC_S_FMT, &vd->fmt);
-    if (ret < 0) {
-        printf("Error: Unable to set format\n");
+    // pick, set and read back frame size and interval
+    if (negotiateFormat(vd) < 0)
         return -1;
-    }
 
-    // request buffers
-    memset(&vd->re_Buf, 0, sizeof(struct v4l2_requestbuffers));
-    vd->re_Buf.count = NB_BUFFER;
-    vd->re_Buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->re_Buf.memory = V4L2_MEMORY_MMAP;
-    ret = ioctl(vd->fd, VIDIOC_REQBUFS, &vd->re_Buf);
-    if (ret < 0) {
+    // request buffers, the driver may grant more or fewer than asked for
+    ret = -1;
+    if (vd->mem_Type == V4L2_MEMORY_USERPTR && (ret = requestBuffers(vd, V4L2_MEMORY_USERPTR)) < 0)
+        printf("USERPTR capture not supported, using MMAP buffers\n");
+    if (ret < 0 && requestBuffers(vd, V4L2_MEMORY_MMAP) < 0) {
         printf("Error: Unable to allocate buffers\n");
         return -1;
     }
+    if ((int) vd->re_Buf.count != vd->nb_Buffer)
+        printf("Requested %d buffers, driver granted %u\n", vd->nb_Buffer > 0 ? vd->nb_Buffer : NB_BUFFER, vd->re_Buf.count);
+    vd->nb_Buffer = (int) vd->re_Buf.count;
+    vd->mem = (void **) calloc((size_t) vd->nb_Buffer * MAX_PLANES, sizeof(void *));
+    vd->mem_Len = (size_t *) calloc((size_t) vd->nb_Buffer * MAX_PLANES, sizeof(size_t));
+    if (vd->mem == nullptr || vd->mem_Len == nullptr) {
+        printf("Error: Unable to allocate buffer table\n");
+        return -1;
+    }
+    vd->buf_Refs = new std::atomic<int>[vd->nb_Buffer]();
+    vd->buffers_Held = 0;
+    vd->max_Held = 0;
 
-    // map the buffers
-    for (i = 0; i < NB_BUFFER; i++) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
+    // map the buffers, multi-planar buffers get one mapping per plane at mem[i * MAX_PLANES + plane]
+    if (vd->mem_Type == V4L2_MEMORY_USERPTR && allocUserPool(vd) < 0)
+        return -1;
+    for (i = 0; vd->mem_Type == V4L2_MEMORY_MMAP && i < vd->nb_Buffer; i++) {
+        prepareBuffer(vd, &vd->buf, planes, i);
         ret = ioctl(vd->fd, VIDIOC_QUERYBUF, &vd->buf);
         if (ret < 0) {
             printf("Error: Unable to query buffer\n");
             return -1;
         }
 
-        vd->mem[i] = mmap(nullptr, vd->buf.length, PROT_READ, MAP_SHARED, vd->fd, vd->buf.m.offset);
-        if (vd->mem[i] == MAP_FAILED) {
-            printf("Error: Unable to map buffer\n");
+        int count = vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? (int) vd->buf.length : 1;
+        if (count > MAX_PLANES) {
+            printf("Error: %d planes per buffer not supported\n", count);
             return -1;
         }
+        vd->mem_Planes = count;
+        for (p = 0; p < count; ++p) {
+            size_t length = vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes[p].length : vd->buf.length;
+            off_t offset = vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE ? planes[p].m.mem_offset : vd->buf.m.offset;
+            void *mem = mmap(nullptr, length, PROT_READ, MAP_SHARED, vd->fd, offset);
+            if (mem == MAP_FAILED) {
+                printf("Error: Unable to map buffer\n");
+                return -1;
+            }
+            vd->mem[i * MAX_PLANES + p] = mem;
+            vd->mem_Len[i * MAX_PLANES + p] = length;
+        }
     }
 
     // queue the buffers
-    for (i = 0; i < NB_BUFFER; ++i) {
-        memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-        vd->buf.index = i;
-        vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        vd->buf.memory = V4L2_MEMORY_MMAP;
+    for (i = 0; i < vd->nb_Buffer; ++i) {
+        prepareBuffer(vd, &vd->buf, planes, i);
         ret = ioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
         if (ret < 0) {
             printf("Error: Unable to query buffer\n");
@@ -150,52 +324,141 @@ int openVideoDevice(struct videoDev *vd) {
 
 /**
   * @brief  Close video device
-  * @note   None
+  * @note   Unmaps and frees the buffer tables
   * @param  vd  struct videoDev
   * @retval 0   If video device closed
 **/
-int closeVideoDevice(struct videoDev *vd) {
+static int v4l2Close(struct videoDev *vd) {
     if (vd->is_Streaming)
         stopStream(vd);
+    for (int i = 0; vd->mem != nullptr && vd->pool == nullptr && i < vd->nb_Buffer * MAX_PLANES; ++i) {
+        if (vd->mem[i] != nullptr)
+            munmap(vd->mem[i], vd->mem_Len[i]);
+    }
+    if (vd->pool != nullptr)
+        munmap(vd->pool, vd->pool_Size);
+    vd->pool = nullptr;
+    free(vd->mem);
+    free(vd->mem_Len);
+    delete[] vd->buf_Refs;
+    vd->mem = nullptr;
+    vd->mem_Len = nullptr;
+    vd->buf_Refs = nullptr;
+    if (vd->epoll_Fd >= 0)
+        close(vd->epoll_Fd);
     close(vd->fd);
     return 0;
 }
 
 /**
-  * @brief  Grab frame
-  * @note   None
-  * @param  vd  struct videoDev
-  * @retval 0   If grab frame
+  * @brief  Wait frame
+  * @note   epoll on the non-blocking device fd, vd->fd or vd->epoll_Fd can also be added to any other event loop.
+  * @param  vd          struct videoDev
+  * @param  timeoutMs   int, -1 to wait forever
+  * @retval 1           If a frame is ready, 0 on timeout, -1 on error
 **/
-int grabFrame(struct videoDev *vd) {
-#define HEADERFRAME1 0xaf
+static int v4l2Wait(struct videoDev *vd, int timeoutMs) {
+    struct epoll_event event {};
     int ret;
-    if (!vd->is_Streaming)
+
+    ret = epoll_wait(vd->epoll_Fd, &event, 1, timeoutMs);
+    if (ret < 0) {
+        if (errno == EINTR)
+            return 0;
+        printf("Error: Unable to wait for frame\n");
         return -1;
+    }
+    if (ret > 0 && (event.events & (EPOLLERR | EPOLLHUP)))
+        return -1;
+    return ret > 0 ? 1 : 0;
+}
 
-    memset(&vd->buf, 0, sizeof(struct v4l2_buffer));
-    vd->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    vd->buf.memory = V4L2_MEMORY_MMAP;
+/**
+  * @brief  Lease frame
+  * @note   Dequeue a buffer and expose the mmap memory directly, no copy is made.
+  * @note   The buffer stays owned by the caller until releaseFrame() is called.
+  * @note   Never blocks, EAGAIN and empty MJPEG header frames mean no frame is ready yet.
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame leased, 1 if no frame is ready yet, -1 on error
+**/
+static int v4l2Lease(struct videoDev *vd, struct frameLease *lease) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+    int ret;
 
-    ret = ioctl(vd->fd, VIDIOC_DQBUF, &vd->buf);
+    lease->mem = nullptr;
+    lease->index = -1;
+    if (!vd->is_Streaming)
+        return -1;
+
+    prepareBuffer(vd, &buf, planes, 0);
+    ret = ioctl(vd->fd, VIDIOC_DQBUF, &buf);
     if (ret < 0) {
+        if (errno == EAGAIN || errno == EINTR)
+            return 1;
         printf("Error: Unable to dequeue buffer\n");
         return -1;
     }
 
-    switch (vd->raw_Format) {
-        case V4L2_PIX_FMT_MJPEG:
-            if (vd->buf.bytesused == HEADERFRAME1) {
-                printf("Ignoring empty buffer...\n");
-                return -1;
-            }
-
-            memcpy(vd->raw_Buf, vd->mem[vd->buf.index], vd->buf.bytesused);
-            vd->raw_Size = vd->buf.bytesused;
-            break;
+    vd->buf_Refs[buf.index].store(1, std::memory_order_relaxed);
+    int held = vd->buffers_Held.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (held > vd->max_Held.load(std::memory_order_relaxed))
+        vd->max_Held.store(held, std::memory_order_relaxed);
+
+    lease->num_Planes = vd->mem_Planes;
+    for (int p = 0; p < vd->mem_Planes; ++p) {
+        unsigned char *mem = (unsigned char *) vd->mem[buf.index * MAX_PLANES + p];
+        if (vd->buf_Type == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE) {
+            lease->planes[p] = mem + planes[p].data_offset;
+            lease->plane_Bytes[p] = (int) (planes[p].bytesused - planes[p].data_offset);
+        } else {
+            lease->planes[p] = mem;
+            lease->plane_Bytes[p] = (int) buf.bytesused;
+        }
     }
+    lease->mem = lease->planes[0];
+    lease->bytes_Used = lease->plane_Bytes[0];
+    splitPlanes(vd, lease);
+    lease->index = (int) buf.index;
+    lease->sequence = buf.sequence;
+    lease->timestamp = buf.timestamp;
+
+    // a header-only MJPEG buffer carries no image, skipping it is not an error
+    if (vd->raw_Format == V4L2_PIX_FMT_MJPEG && lease->bytes_Used == HEADERFRAME1) {
+        releaseFrame(vd, lease);
+        lease->mem = nullptr;
+        lease->index = -1;
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+  * @brief  Release frame
+  * @note   Drops one reference, the last one re-queues the buffer with VIDIOC_QBUF. The lease memory is invalid afterwards.
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame released
+**/
+static int v4l2Release(struct videoDev *vd, struct frameLease *lease) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+    int ret;
+
+    if (lease->index < 0)
+        return 0;
+
+    int index = lease->index;
+    lease->mem = nullptr;
+    lease->index = -1;
+    if (vd->buf_Refs[index].fetch_sub(1, std::memory_order_acq_rel) > 1)
+        return 0;
+    prepareBuffer(vd, &buf, planes, index);
+    vd->buffers_Held.fetch_sub(1, std::memory_order_relaxed);
 
-    ret = ioctl(vd->fd, VIDIOC_QBUF, &vd->buf);
+    ret = ioctl(vd->fd, VIDIOC_QBUF, &buf);
     if (ret < 0) {
         printf("Error: Unable to require buffer\n");
         return -1;
@@ -204,13 +467,167 @@ int grabFrame(struct videoDev *vd) {
     return 0;
 }
 
+/**
+  * @brief  Retain frame
+  * @note   Adds a reference to a leased buffer, every reference needs its own releaseFrame() on a copy of the lease
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame retained
+**/
+static int v4l2Retain(struct videoDev *vd, const struct frameLease *lease) {
+    if (lease->index < 0 || lease->index >= vd->nb_Buffer)
+        return -1;
+    vd->buf_Refs[lease->index].fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+const struct captureBackend v4l2Backend = {
+        "v4l2",
+        v4l2Open,
+        v4l2Close,
+        v4l2Play,
+        v4l2Stop,
+        v4l2Wait,
+        v4l2Lease,
+        v4l2Release,
+        v4l2Retain,
+};
+
+/**
+  * @brief  Capture backend of a device
+  * @note   Devices without an explicit backend are V4L2 devices
+  * @param  vd  struct videoDev
+  * @retval Backend table
+**/
+static const struct captureBackend *backendOf(struct videoDev *vd) {
+    if (vd->backend == nullptr)
+        vd->backend = &v4l2Backend;
+    return vd->backend;
+}
+
+/**
+  * @brief  Open video stream
+  * @note   Dispatches to vd->backend
+  * @param  vd  struct videoDev
+  * @retval 0   If video stream opened
+**/
+int playStream(struct videoDev *vd) {
+    return backendOf(vd)->play(vd);
+}
+
+/**
+  * @brief  Close video stream
+  * @note   Dispatches to vd->backend
+  * @param  vd  struct videoDev
+  * @retval 0   If video stream closed
+**/
+int stopStream(struct videoDev *vd) {
+    return backendOf(vd)->stop(vd);
+}
+
+/**
+  * @brief  Open video device
+  * @note   Dispatches to vd->backend, V4L2 unless set before the call
+  * @param  vd  struct videoDev
+  * @retval 0   If video device opened
+**/
+int openVideoDevice(struct videoDev *vd) {
+    return backendOf(vd)->open(vd);
+}
+
+/**
+  * @brief  Close video device
+  * @note   Dispatches to vd->backend
+  * @param  vd  struct videoDev
+  * @retval 0   If video device closed
+**/
+int closeVideoDevice(struct videoDev *vd) {
+    return backendOf(vd)->close(vd);
+}
+
+/**
+  * @brief  Wait frame
+  * @note   Dispatches to vd->backend
+  * @param  vd          struct videoDev
+  * @param  timeoutMs   int, -1 to wait forever
+  * @retval 1           If a frame is ready, 0 on timeout, -1 on error
+**/
+int waitFrame(struct videoDev *vd, int timeoutMs) {
+    return backendOf(vd)->wait(vd, timeoutMs);
+}
+
+/**
+  * @brief  Lease frame
+  * @note   Dispatches to vd->backend
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame leased, 1 if no frame is ready yet, -1 on error
+**/
+int leaseFrame(struct videoDev *vd, struct frameLease *lease) {
+    return backendOf(vd)->lease(vd, lease);
+}
+
+/**
+  * @brief  Release frame
+  * @note   Dispatches to vd->backend
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame released
+**/
+int releaseFrame(struct videoDev *vd, struct frameLease *lease) {
+    return backendOf(vd)->release(vd, lease);
+}
+
+/**
+  * @brief  Retain frame
+  * @note   Dispatches to vd->backend, lets several consumers share one leased buffer
+  * @param  vd      struct videoDev
+  * @param  lease   struct frameLease
+  * @retval 0       If frame retained
+**/
+int retainFrame(struct videoDev *vd, const struct frameLease *lease) {
+    return backendOf(vd)->retain(vd, lease);
+}
+
+/**
+  * @brief  Query buffer stats
+  * @note   held counts leases not yet released, V4L2 devices also report per-buffer state from VIDIOC_QUERYBUF:
+  *         queued buffers are empty in the driver, done buffers are filled and waiting to be dequeued.
+  * @note   One ioctl per buffer, meant for telemetry every now and then rather than per frame.
+  * @param  vd      struct videoDev
+  * @param  stats   struct bufferStats
+  * @retval 0       If stats queried
+**/
+int queryBufferStats(struct videoDev *vd, struct bufferStats *stats) {
+    struct v4l2_plane planes[VIDEO_MAX_PLANES];
+    struct v4l2_buffer buf;
+
+    memset(stats, 0, sizeof(struct bufferStats));
+    stats->count = vd->nb_Buffer;
+    stats->held = vd->buffers_Held.load(std::memory_order_relaxed);
+    stats->max_Held = vd->max_Held.load(std::memory_order_relaxed);
+    if (backendOf(vd) != &v4l2Backend)
+        return 0;
+
+    for (int i = 0; i < vd->nb_Buffer; ++i) {
+        prepareBuffer(vd, &buf, planes, i);
+        if (ioctl(vd->fd, VIDIOC_QUERYBUF, &buf) < 0)
+            return -1;
+        if (buf.flags & V4L2_BUF_FLAG_DONE)
+            stats->done++;
+        else if (buf.flags & V4L2_BUF_FLAG_QUEUED)
+            stats->queued++;
+    }
+    return 0;
+}
+
 /**
   * @brief  If exist error
   * @note   None
   * @param  cinfo   information
   * @retval None
 **/
-METHODDEF(void)
+GLOBAL(void)
 errorExit(j_common_ptr cinfo) {
     auto error = (errorMessagePtr) cinfo->err;
     (*cinfo->err->output_message)(cinfo);
@@ -219,13 +636,14 @@ errorExit(j_common_ptr cinfo) {
 
 /**
   * @brief  Decode jpeg
-  * @note   None
+  * @note   Per-call decompressor, see jpegStreamDecode() for the persistent one.
   * @param  jpgPtr  unsigned char *
   * @param  jpgLen  int
-  * @param  rgbPtr  unsigned char *
-  * @retval 0       Id decode successful
+  * @param  rgbPtr      unsigned char *
+  * @param  scaleDenom  int, 1, 2, 4 or 8, decode at 1/scaleDenom size in the DCT domain
+  * @retval 0           Id decode successful
 **/
-int jpegDecoder(unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr) {
+int jpegDecoder(unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int scaleDenom) {
     struct jpeg_decompress_struct cinfo {};
     struct errorMessage jError {};
 
@@ -239,27 +657,36 @@ int jpegDecoder(unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr) {
     jpeg_create_decompress(&cinfo);
     jpeg_mem_src(&cinfo, jpgPtr, jpgLen);
     jpeg_read_header(&cinfo, true);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scaleDenom;
     jpeg_start_decompress(&cinfo);
 
     int row_stride = cinfo.output_width * cinfo.output_components;
 
-    JSAMPARRAY buffer = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
+    // decode straight into rgbPtr, libjpeg returns up to one row group per call
+    JSAMPARRAY rows = (JSAMPARRAY) (*cinfo.mem->alloc_small)((j_common_ptr) &cinfo, JPOOL_IMAGE, cinfo.output_height * sizeof(JSAMPROW));
+    for (JDIMENSION i = 0; i < cinfo.output_height; ++i)
+        rows[i] = rgbPtr + (size_t) i * row_stride;
 
-    // unsigned char *p = rgbPtr;
-    int bytes = 0;
-
-    while (cinfo.output_scanline < cinfo.output_height) {
-        jpeg_read_scanlines(&cinfo, buffer, 1);
-
-        memcpy(rgbPtr + bytes, buffer[0], row_stride);
-        bytes += row_stride;
-    }
+    while (cinfo.output_scanline < cinfo.output_height)
+        jpeg_read_scanlines(&cinfo, rows + cinfo.output_scanline, cinfo.output_height - cinfo.output_scanline);
 
     jpeg_finish_decompress(&cinfo);
     jpeg_destroy_decompress(&cinfo);
     return 0;
 }
 
+/**
+  * @brief  Scaled size
+  * @note   Output size libjpeg produces for a 1/scaleDenom decode.
+  * @param  size        int
+  * @param  scaleDenom  int
+  * @retval Scaled size, rounded up
+**/
+int jpegScaledSize(int size, int scaleDenom) {
+    return (size + scaleDenom - 1) / scaleDenom;
+}
+
 /**
   * @brief  Free SDL
   * @note   None
@@ -284,52 +711,59 @@ void SDLFree() {
 
 /**
   * @brief  Initial SDL
-  * @note   None
+  * @note   Works under SDL_VIDEODRIVER=dummy or offscreen for headless runs
   * @param  video_W
   * @param  video_H
-  * @retval true    If successfully initial
+  * @param  format  SDL_PIXELFORMAT_RGB24, or SDL_PIXELFORMAT_IYUV / YUY2 / UYVY to let the GPU do colour conversion
+  * @param  vsync   int, 1 to let SDL_RenderPresent wait for vsync
+  * @retval 0       If successfully initial
 **/
-int SDLInit(int video_W, int video_H) {
+int SDLInit(int video_W, int video_H, Uint32 format, int vsync) {
+    const char *driver;
+    Uint32 windowFlags = SDL_WINDOW_SHOWN;
+
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't initialize SDL: %s", SDL_GetError());
         goto SDLError;
     }
 
-    gWindow = SDL_CreateWindow("Display", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, video_W, video_H / 2, SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL);
+    // the dummy and offscreen drivers used for headless runs have no OpenGL window support
+    driver = SDL_GetCurrentVideoDriver();
+    if (driver == nullptr || (strcmp(driver, "dummy") != 0 && strcmp(driver, "offscreen") != 0))
+        windowFlags |= SDL_WINDOW_OPENGL;
+
+    gWindow = SDL_CreateWindow("Display", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, video_W, video_H / 2, windowFlags);
     if (!gWindow) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create SDL window: %s", SDL_GetError());
         goto SDLError;
     }
 
-    gRenderer = SDL_CreateRenderer(gWindow, -1, 0);
+    gRenderer = SDL_CreateRenderer(gWindow, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
     if (!gRenderer) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create SDL renderer: %s", SDL_GetError());
         goto SDLError;
     }
 
-    gTexture = SDL_CreateTexture(gRenderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, video_W, video_H);
+    gTexture = SDL_CreateTexture(gRenderer, format, SDL_TEXTUREACCESS_STREAMING, video_W, video_H);
     if (!gTexture) {
         SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't create SDL texture: %s", SDL_GetError());
         goto SDLError;
     }
 
-    return true;
+    return 0;
 SDLError:
     SDLFree();
-    return false;
+    return -1;
 }
 
 /**
-  * @brief  Display SDL
-  * @note   None
-  * @param  buffer  unsigned char *
+  * @brief  Present SDL
+  * @note   Copy the current texture to the window
   * @param  width   int
   * @param  height  int
   * @retval None
 **/
-void SDLDisplay(unsigned char *buffer, int width, int height) {
-    SDL_UpdateTexture(gTexture, nullptr, buffer, width * 3);
-
+static void SDLPresent(int width, int height) {
     SDL_Rect srcRect;
     srcRect.x = 0;
     srcRect.y = 0;
@@ -344,4 +778,90 @@ void SDLDisplay(unsigned char *buffer, int width, int height) {
     SDL_RenderClear(gRenderer);
     SDL_RenderCopy(gRenderer, gTexture, &srcRect, &dstRect);
     SDL_RenderPresent(gRenderer);
-}
\ No newline at end of file
+}
+
+/**
+  * @brief  Display SDL
+  * @note   Any packed texture format, e.g. RGB24 or YUY2 straight from a YUYV capture buffer
+  * @param  buffer  unsigned char *
+  * @param  width   int
+  * @param  height  int
+  * @param  pitch   int, bytes between rows, 0 for tightly packed RGB24
+  * @retval None
+**/
+void SDLDisplay(unsigned char *buffer, int width, int height, int pitch) {
+    SDL_UpdateTexture(gTexture, nullptr, buffer, pitch > 0 ? pitch : width * 3);
+    SDLPresent(width, height);
+}
+
+/**
+  * @brief  Display SDL planar YUV
+  * @note   Texture must be SDL_PIXELFORMAT_IYUV, half the upload of RGB24 for 4:2:0 and no CPU colour conversion
+  * @param  planes  Y, U and V planes
+  * @param  pitches bytes between rows of each plane
+  * @param  width   int
+  * @param  height  int
+  * @retval None
+**/
+void SDLDisplayYUV(unsigned char *const planes[3], const int pitches[3], int width, int height) {
+    SDL_UpdateYUVTexture(gTexture, nullptr, planes[0], pitches[0], planes[1], pitches[1], planes[2], pitches[2]);
+    SDLPresent(width, height);
+}
+
+/**
+  * @brief  Lock SDL frame
+  * @note   Hands out the streaming texture memory so the decoder can write into it directly
+  * @param  pixels  unsigned char **
+  * @param  pitch   int *
+  * @retval 0       If texture locked
+**/
+int SDLLockFrame(unsigned char **pixels, int *pitch) {
+    void *mem;
+
+    if (SDL_LockTexture(gTexture, nullptr, &mem, pitch) < 0) {
+        SDL_LogError(SDL_LOG_CATEGORY_APPLICATION, "Couldn't lock SDL texture: %s", SDL_GetError());
+        return -1;
+    }
+    *pixels = (unsigned char *) mem;
+    return 0;
+}
+
+/**
+  * @brief  Lock SDL planar YUV frame
+  * @note   IYUV textures lock as one block: Y, then U and V at half pitch and half height
+  * @note   NV12 textures lock as Y, then interleaved CbCr at the same pitch and half height, planes[2] is planes[1]
+  * @param  planes  Y, U and V planes
+  * @param  pitches bytes between rows of each plane
+  * @retval 0       If texture locked
+**/
+int SDLLockFrameYUV(unsigned char *planes[3], int pitches[3]) {
+    Uint32 format;
+    int height;
+
+    if (SDL_QueryTexture(gTexture, &format, nullptr, nullptr, &height) < 0 || SDLLockFrame(&planes[0], &pitches[0]) < 0)
+        return -1;
+    if (format == SDL_PIXELFORMAT_NV12) {
+        pitches[1] = pitches[2] = pitches[0];
+        planes[1] = planes[2] = planes[0] + (size_t) pitches[0] * height;
+        return 0;
+    }
+    pitches[1] = (pitches[0] + 1) / 2;
+    pitches[2] = pitches[1];
+    planes[1] = planes[0] + (size_t) pitches[0] * height;
+    planes[2] = planes[1] + (size_t) pitches[1] * ((height + 1) / 2);
+    return 0;
+}
+
+/**
+  * @brief  Unlock SDL frame
+  * @note   Uploads the locked texture and optionally presents it
+  * @param  width   int
+  * @param  height  int
+  * @param  present int, 0 to drop the frame (e.g. after a failed decode)
+  * @retval None
+**/
+void SDLUnlockFrame(int width, int height, int present) {
+    SDL_UnlockTexture(gTexture);
+    if (present)
+        SDLPresent(width, height);
+}
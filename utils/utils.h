@@ -2,6 +2,7 @@
 #define CAMERA_CPP_UTILS_H
 
 #include <SDL2/SDL.h>
+#include <atomic>
 #include <csetjmp>
 #include <cstdio>
 #include <cstdlib>
@@ -10,25 +11,43 @@
 #include <linux/videodev2.h>
 
 #define NB_BUFFER 4
+#define MAX_PLANES 3
+
+struct captureBackend;
 
 struct videoDev {
+    const struct captureBackend *backend;
+    void *backend_Data;
+    int backend_Flags;
     int fd;
+    int epoll_Fd;
     char dev_Name[64];
     struct v4l2_capability cap;
     struct v4l2_fmtdesc fmt_Desc;
     struct v4l2_format fmt;
     struct v4l2_buffer buf;
     struct v4l2_requestbuffers re_Buf;
-    void *mem[NB_BUFFER];
-    unsigned char *raw_Buf;
+    unsigned int buf_Type;
+    int nb_Buffer;
+    int mem_Planes;
+    unsigned int mem_Type;
+    int huge_Pages;
+    void *pool;
+    size_t pool_Size;
+    int plane_Pitch[MAX_PLANES];
+    void **mem;
+    size_t *mem_Len;
+    std::atomic<int> *buf_Refs;
+    std::atomic<int> buffers_Held;
+    std::atomic<int> max_Held;
     int raw_W;
     int raw_H;
     int raw_Format;
     int raw_Size;
-    unsigned char *rgb_Buf;
+    int raw_Fps;
+    struct v4l2_fract raw_Interval;
     int rgb_W;
     int rgb_H;
-    int rgb_Size;
     int is_Streaming;
 };
 
@@ -39,19 +58,61 @@ struct errorMessage {
 
 typedef struct errorMessage *errorMessagePtr;
 
+struct frameLease {
+    void *mem;
+    int bytes_Used;
+    int num_Planes;
+    void *planes[MAX_PLANES];
+    int plane_Bytes[MAX_PLANES];
+    int index;
+    unsigned int sequence;
+    struct timeval timestamp;
+};
+
+struct bufferStats {
+    int count;
+    int queued;
+    int done;
+    int held;
+    int max_Held;
+};
+
+struct captureBackend {
+    const char *name;
+    int (*open)(struct videoDev *vd);
+    int (*close)(struct videoDev *vd);
+    int (*play)(struct videoDev *vd);
+    int (*stop)(struct videoDev *vd);
+    int (*wait)(struct videoDev *vd, int timeoutMs);
+    int (*lease)(struct videoDev *vd, struct frameLease *lease);
+    int (*release)(struct videoDev *vd, struct frameLease *lease);
+    int (*retain)(struct videoDev *vd, const struct frameLease *lease);
+};
+
+extern const struct captureBackend v4l2Backend;
+
 int playStream(struct videoDev *vd);
 int stopStream(struct videoDev *vd);
 int openVideoDevice(struct videoDev *vd);
 int closeVideoDevice(struct videoDev *vd);
-int grabFrame(struct videoDev *vd);
+int waitFrame(struct videoDev *vd, int timeoutMs);
+int leaseFrame(struct videoDev *vd, struct frameLease *lease);
+int releaseFrame(struct videoDev *vd, struct frameLease *lease);
+int retainFrame(struct videoDev *vd, const struct frameLease *lease);
+int queryBufferStats(struct videoDev *vd, struct bufferStats *stats);
 
-METHODDEF(void)
+EXTERN(void)
 errorExit(j_common_ptr cinfo);
 
-int jpegDecoder(unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr);
+int jpegDecoder(unsigned char *jpgPtr, int jpgLen, unsigned char *rgbPtr, int scaleDenom = 1);
+int jpegScaledSize(int size, int scaleDenom);
 
 void SDLFree();
-int SDLInit(int video_W, int video_H);
-void SDLDisplay(unsigned char *buf, int width, int height);
+int SDLInit(int video_W, int video_H, Uint32 format = SDL_PIXELFORMAT_RGB24, int vsync = 0);
+void SDLDisplay(unsigned char *buf, int width, int height, int pitch = 0);
+void SDLDisplayYUV(unsigned char *const planes[3], const int pitches[3], int width, int height);
+int SDLLockFrame(unsigned char **pixels, int *pitch);
+int SDLLockFrameYUV(unsigned char *planes[3], int pitches[3]);
+void SDLUnlockFrame(int width, int height, int present);
 
 #endif
@@ -0,0 +1,272 @@
+#include "yuyv.h"
+#include <cstring>
+#include <linux/videodev2.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUYV_X86 1
+#endif
+
+typedef void (*yuyvRowFn)(const unsigned char *src, unsigned char *dst, int width, int uyvy, int bgra);
+
+/**
+  * @brief  Clamp to a byte
+  * @note   None
+  * @param  v   int
+  * @retval v clamped to 0..255
+**/
+static inline unsigned char clampByte(int v) {
+    return (unsigned char) (v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/**
+  * @brief  Convert row, scalar
+  * @note   BT.601 limited range in 8-bit fixed point, the SIMD kernels produce the exact same bytes
+  * @param  src     const unsigned char *, width / 2 macropixels
+  * @param  dst     unsigned char *
+  * @param  width   int, even
+  * @param  uyvy    int, 1 for U Y0 V Y1 order, 0 for Y0 U Y1 V
+  * @param  bgra    int, 1 for 4 byte B G R A output, 0 for 3 byte R G B
+  * @retval None
+**/
+static void convertRowScalar(const unsigned char *src, unsigned char *dst, int width, int uyvy, int bgra) {
+    int yOff = uyvy ? 1 : 0, cOff = uyvy ? 0 : 1;
+
+    for (int x = 0; x < width; x += 2, src += 4) {
+        int u = src[cOff] - 128, v = src[cOff + 2] - 128;
+        int rv = 409 * v + 128, guv = -100 * u - 208 * v + 128, bu = 516 * u + 128;
+
+        for (int i = 0; i < 2; ++i) {
+            int c = 298 * (src[yOff + 2 * i] - 16);
+            unsigned char r = clampByte((c + rv) >> 8), g = clampByte((c + guv) >> 8), b = clampByte((c + bu) >> 8);
+            if (bgra) {
+                dst[0] = b;
+                dst[1] = g;
+                dst[2] = r;
+                dst[3] = 255;
+                dst += 4;
+            } else {
+                dst[0] = r;
+                dst[1] = g;
+                dst[2] = b;
+                dst += 3;
+            }
+        }
+    }
+}
+
+#ifdef YUYV_X86
+/**
+  * @brief  Convert 8 pixels, SSE2
+  * @note   Chroma products come from _mm_madd_epi16 on the U V pairs, luma from Y duplicated into 32-bit lanes,
+  *         all in 32-bit so the result matches convertRowScalar() exactly
+  * @param  in      __m128i, 16 bytes = 8 pixels
+  * @param  uyvy    int
+  * @param  r       __m128i *, 8 bytes in the low half
+  * @param  g       __m128i *
+  * @param  b       __m128i *
+  * @retval None
+**/
+__attribute__((target("sse2"))) static inline void convert8Sse2(__m128i in, int uyvy, __m128i *r, __m128i *g, __m128i *b) {
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    __m128i y = uyvy ? _mm_srli_epi16(in, 8) : _mm_and_si128(in, lowByte);
+    __m128i uv = uyvy ? _mm_and_si128(in, lowByte) : _mm_srli_epi16(in, 8);
+    y = _mm_sub_epi16(y, _mm_set1_epi16(16));
+    uv = _mm_sub_epi16(uv, _mm_set1_epi16(128));
+
+    // one 32-bit chroma term per macropixel, duplicated for its two pixels
+    const __m128i round = _mm_set1_epi32(128);
+    __m128i rv = _mm_add_epi32(_mm_madd_epi16(uv, _mm_set1_epi32(409 << 16)), round);
+    __m128i guv = _mm_add_epi32(_mm_madd_epi16(uv, _mm_set1_epi32((int) ((-208u << 16) | (-100 & 0xFFFF)))), round);
+    __m128i bu = _mm_add_epi32(_mm_madd_epi16(uv, _mm_set1_epi32(516)), round);
+    const __m128i yCoef = _mm_set1_epi32(298);
+    __m128i cLo = _mm_madd_epi16(_mm_unpacklo_epi16(y, _mm_setzero_si128()), yCoef);
+    __m128i cHi = _mm_madd_epi16(_mm_unpackhi_epi16(y, _mm_setzero_si128()), yCoef);
+
+    __m128i rLo = _mm_srai_epi32(_mm_add_epi32(cLo, _mm_unpacklo_epi32(rv, rv)), 8);
+    __m128i rHi = _mm_srai_epi32(_mm_add_epi32(cHi, _mm_unpackhi_epi32(rv, rv)), 8);
+    __m128i gLo = _mm_srai_epi32(_mm_add_epi32(cLo, _mm_unpacklo_epi32(guv, guv)), 8);
+    __m128i gHi = _mm_srai_epi32(_mm_add_epi32(cHi, _mm_unpackhi_epi32(guv, guv)), 8);
+    __m128i bLo = _mm_srai_epi32(_mm_add_epi32(cLo, _mm_unpacklo_epi32(bu, bu)), 8);
+    __m128i bHi = _mm_srai_epi32(_mm_add_epi32(cHi, _mm_unpackhi_epi32(bu, bu)), 8);
+
+    __m128i r16 = _mm_packs_epi32(rLo, rHi), g16 = _mm_packs_epi32(gLo, gHi), b16 = _mm_packs_epi32(bLo, bHi);
+    *r = _mm_packus_epi16(r16, r16);
+    *g = _mm_packus_epi16(g16, g16);
+    *b = _mm_packus_epi16(b16, b16);
+}
+
+/**
+  * @brief  Convert row, SSE2
+  * @note   8 pixels per step, BGRA is stored directly, RGB24 goes through a small staging buffer
+  * @param  src     const unsigned char *
+  * @param  dst     unsigned char *
+  * @param  width   int, even
+  * @param  uyvy    int
+  * @param  bgra    int
+  * @retval None
+**/
+__attribute__((target("sse2"))) static void convertRowSse2(const unsigned char *src, unsigned char *dst, int width, int uyvy, int bgra) {
+    const __m128i alpha = _mm_set1_epi8((char) 0xFF);
+    alignas(16) unsigned char stage[32];
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8, src += 16) {
+        __m128i r, g, b;
+        convert8Sse2(_mm_loadu_si128((const __m128i *) src), uyvy, &r, &g, &b);
+        if (bgra) {
+            __m128i bg = _mm_unpacklo_epi8(b, g), ra = _mm_unpacklo_epi8(r, alpha);
+            _mm_storeu_si128((__m128i *) dst, _mm_unpacklo_epi16(bg, ra));
+            _mm_storeu_si128((__m128i *) (dst + 16), _mm_unpackhi_epi16(bg, ra));
+            dst += 32;
+        } else {
+            __m128i rg = _mm_unpacklo_epi8(r, g), ba = _mm_unpacklo_epi8(b, alpha);
+            _mm_store_si128((__m128i *) stage, _mm_unpacklo_epi16(rg, ba));
+            _mm_store_si128((__m128i *) (stage + 16), _mm_unpackhi_epi16(rg, ba));
+            for (int i = 0; i < 8; ++i, dst += 3)
+                memcpy(dst, stage + 4 * i, 3);
+        }
+    }
+    convertRowScalar(src, dst, width - x, uyvy, bgra);
+}
+
+/**
+  * @brief  Convert row, AVX2
+  * @note   Same arithmetic as convert8Sse2() on 16 pixels, RGB24 is compacted with a per-lane byte shuffle
+  * @param  src     const unsigned char *
+  * @param  dst     unsigned char *
+  * @param  width   int, even
+  * @param  uyvy    int
+  * @param  bgra    int
+  * @retval None
+**/
+__attribute__((target("avx2"))) static void convertRowAvx2(const unsigned char *src, unsigned char *dst, int width, int uyvy, int bgra) {
+    const __m256i lowByte = _mm256_set1_epi16(0x00FF), round = _mm256_set1_epi32(128), yCoef = _mm256_set1_epi32(298);
+    const __m256i alpha = _mm256_set1_epi8((char) 0xFF);
+    const __m128i packRgb = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    int x = 0;
+
+    // RGB24 stores 16 bytes for every 12, keep two pixels of slack for the overhang
+    for (; x + 16 + (bgra ? 0 : 2) <= width; x += 16, src += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *) src);
+        __m256i y = uyvy ? _mm256_srli_epi16(in, 8) : _mm256_and_si256(in, lowByte);
+        __m256i uv = uyvy ? _mm256_and_si256(in, lowByte) : _mm256_srli_epi16(in, 8);
+        y = _mm256_sub_epi16(y, _mm256_set1_epi16(16));
+        uv = _mm256_sub_epi16(uv, _mm256_set1_epi16(128));
+
+        __m256i rv = _mm256_add_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32(409 << 16)), round);
+        __m256i guv = _mm256_add_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32((int) ((-208u << 16) | (-100 & 0xFFFF)))), round);
+        __m256i bu = _mm256_add_epi32(_mm256_madd_epi16(uv, _mm256_set1_epi32(516)), round);
+        __m256i cLo = _mm256_madd_epi16(_mm256_unpacklo_epi16(y, _mm256_setzero_si256()), yCoef);
+        __m256i cHi = _mm256_madd_epi16(_mm256_unpackhi_epi16(y, _mm256_setzero_si256()), yCoef);
+
+        __m256i r16 = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(cLo, _mm256_unpacklo_epi32(rv, rv)), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(cHi, _mm256_unpackhi_epi32(rv, rv)), 8));
+        __m256i g16 = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(cLo, _mm256_unpacklo_epi32(guv, guv)), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(cHi, _mm256_unpackhi_epi32(guv, guv)), 8));
+        __m256i b16 = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_add_epi32(cLo, _mm256_unpacklo_epi32(bu, bu)), 8),
+                                         _mm256_srai_epi32(_mm256_add_epi32(cHi, _mm256_unpackhi_epi32(bu, bu)), 8));
+        __m256i r = _mm256_packus_epi16(r16, r16), g = _mm256_packus_epi16(g16, g16), b = _mm256_packus_epi16(b16, b16);
+
+        // every 128-bit lane holds 8 pixels, lane 0 pixels 0..7 and lane 1 pixels 8..15
+        __m256i lo, hi;
+        if (bgra) {
+            __m256i bg = _mm256_unpacklo_epi8(b, g), ra = _mm256_unpacklo_epi8(r, alpha);
+            lo = _mm256_unpacklo_epi16(bg, ra);
+            hi = _mm256_unpackhi_epi16(bg, ra);
+            _mm256_storeu_si256((__m256i *) dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i *) (dst + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+            dst += 64;
+        } else {
+            __m256i rg = _mm256_unpacklo_epi8(r, g), ba = _mm256_unpacklo_epi8(b, alpha);
+            lo = _mm256_unpacklo_epi16(rg, ba);
+            hi = _mm256_unpackhi_epi16(rg, ba);
+            _mm_storeu_si128((__m128i *) dst, _mm_shuffle_epi8(_mm256_castsi256_si128(lo), packRgb));
+            _mm_storeu_si128((__m128i *) (dst + 12), _mm_shuffle_epi8(_mm256_castsi256_si128(hi), packRgb));
+            _mm_storeu_si128((__m128i *) (dst + 24), _mm_shuffle_epi8(_mm256_extracti128_si256(lo, 1), packRgb));
+            _mm_storeu_si128((__m128i *) (dst + 36), _mm_shuffle_epi8(_mm256_extracti128_si256(hi, 1), packRgb));
+            dst += 48;
+        }
+    }
+    convertRowSse2(src, dst, width - x, uyvy, bgra);
+}
+#endif
+
+/**
+  * @brief  Kernel available
+  * @note   None
+  * @param  kernel  enum yuyvKernel
+  * @retval 1       If the CPU can run kernel
+**/
+int yuyvKernelAvailable(int kernel) {
+    switch (kernel) {
+        case YUYV_KERNEL_AUTO:
+        case YUYV_KERNEL_SCALAR:
+            return 1;
+#ifdef YUYV_X86
+        case YUYV_KERNEL_SSE2:
+            return __builtin_cpu_supports("sse2");
+        case YUYV_KERNEL_AVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return 0;
+    }
+}
+
+/**
+  * @brief  Kernel name
+  * @note   YUYV_KERNEL_AUTO names the kernel it resolves to
+  * @param  kernel  enum yuyvKernel
+  * @retval Name
+**/
+const char *yuyvKernelName(int kernel) {
+    if (kernel == YUYV_KERNEL_AUTO)
+        kernel = yuyvKernelAvailable(YUYV_KERNEL_AVX2) ? YUYV_KERNEL_AVX2 : (yuyvKernelAvailable(YUYV_KERNEL_SSE2) ? YUYV_KERNEL_SSE2 : YUYV_KERNEL_SCALAR);
+    switch (kernel) {
+        case YUYV_KERNEL_SSE2:
+            return "sse2";
+        case YUYV_KERNEL_AVX2:
+            return "avx2";
+        default:
+            return "scalar";
+    }
+}
+
+/**
+  * @brief  Convert packed YUV
+  * @note   YUYV or UYVY, BT.601 limited range, straight from the capture buffer into RGB24 or BGRA
+  * @param  src         const unsigned char *
+  * @param  srcPitch    int, 0 for width * 2
+  * @param  srcFormat   V4L2_PIX_FMT_YUYV or V4L2_PIX_FMT_UYVY
+  * @param  dst         unsigned char *
+  * @param  dstPitch    int, 0 for tightly packed
+  * @param  output      YUYV_OUT_RGB24 or YUYV_OUT_BGRA
+  * @param  width       int, even
+  * @param  height      int
+  * @param  kernel      enum yuyvKernel, YUYV_KERNEL_AUTO picks the widest the CPU supports
+  * @retval 0           If converted
+**/
+int yuyvConvert(const unsigned char *src, int srcPitch, unsigned int srcFormat, unsigned char *dst, int dstPitch, int output,
+                int width, int height, int kernel) {
+    int bgra = output == YUYV_OUT_BGRA;
+    int uyvy = srcFormat == V4L2_PIX_FMT_UYVY;
+    yuyvRowFn convertRow = convertRowScalar;
+
+    if ((srcFormat != V4L2_PIX_FMT_YUYV && !uyvy) || (width & 1) || !yuyvKernelAvailable(kernel))
+        return -1;
+#ifdef YUYV_X86
+    if ((kernel == YUYV_KERNEL_AUTO && yuyvKernelAvailable(YUYV_KERNEL_AVX2)) || kernel == YUYV_KERNEL_AVX2)
+        convertRow = convertRowAvx2;
+    else if ((kernel == YUYV_KERNEL_AUTO && yuyvKernelAvailable(YUYV_KERNEL_SSE2)) || kernel == YUYV_KERNEL_SSE2)
+        convertRow = convertRowSse2;
+#endif
+
+    if (srcPitch == 0)
+        srcPitch = width * 2;
+    if (dstPitch == 0)
+        dstPitch = width * (bgra ? 4 : 3);
+    for (int row = 0; row < height; ++row)
+        convertRow(src + (size_t) row * srcPitch, dst + (size_t) row * dstPitch, width, uyvy, bgra);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef USBCAM_YUYV_H
+#define USBCAM_YUYV_H
+
+enum yuyvKernel {
+    YUYV_KERNEL_AUTO,
+    YUYV_KERNEL_SCALAR,
+    YUYV_KERNEL_SSE2,
+    YUYV_KERNEL_AVX2
+};
+
+enum yuyvOutput {
+    YUYV_OUT_RGB24,
+    YUYV_OUT_BGRA
+};
+
+int yuyvConvert(const unsigned char *src, int srcPitch, unsigned int srcFormat, unsigned char *dst, int dstPitch, int output,
+                int width, int height, int kernel = YUYV_KERNEL_AUTO);
+int yuyvKernelAvailable(int kernel);
+const char *yuyvKernelName(int kernel);
+
+#endif